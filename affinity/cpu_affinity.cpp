@@ -0,0 +1,150 @@
+#include "cpu_affinity.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+//CPU 所在节点见 /sys/devices/system/cpu/cpuN/ 下的 nodeM 目录，没有该目录（未启用 NUMA）时视为节点 0
+static int read_cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return 0;
+    int node = 0;
+    while (struct dirent *ent = readdir(dir))
+    {
+        int n;
+        if (sscanf(ent->d_name, "node%d", &n) == 1)
+        {
+            node = n;
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool cpu_affinity::init()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return false;
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    if (cpus.empty())
+        return false;
+
+    m_cpu_node.assign(cpus.back() + 1, 0);
+    m_nodes = 1;
+    for (int cpu : cpus)
+    {
+        m_cpu_node[cpu] = read_cpu_node(cpu);
+        if (m_cpu_node[cpu] + 1 > m_nodes)
+            m_nodes = m_cpu_node[cpu] + 1;
+    }
+    m_loop_cpu = cpus.front();
+    m_loop_node = m_cpu_node[m_loop_cpu];
+
+    //工作线程：先用本节点的其余 CPU，再按编号使用其它节点；只有一个 CPU 时与主线程共用
+    m_worker_cpus.clear();
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int cpu : cpus)
+        {
+            bool local = m_cpu_node[cpu] == m_loop_node;
+            if (cpu != m_loop_cpu && local == (pass == 0))
+                m_worker_cpus.push_back(cpu);
+        }
+    }
+    if (m_worker_cpus.empty())
+        m_worker_cpus.push_back(m_loop_cpu);
+    m_cpus.swap(cpus);
+    return true;
+}
+
+int cpu_affinity::node_of(int cpu) const
+{
+    return (cpu >= 0 && cpu < (int)m_cpu_node.size()) ? m_cpu_node[cpu] : m_loop_node;
+}
+
+static bool pin(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+bool cpu_affinity::pin_loop()
+{
+    return enabled() && pin(pthread_self(), m_loop_cpu);
+}
+
+bool cpu_affinity::pin_worker(pthread_t thread, int index)
+{
+    return enabled() && pin(thread, m_worker_cpus[index % m_worker_cpus.size()]);
+}
+
+//首次访问决定页所在的节点：连接对象数组由主线程分配，但读写缓冲区的页多数由工作线程先写到，
+//这里设为优先本节点（MPOL_PREFERRED，本节点内存不足时仍可从其它节点分配），并迁移已经分配的页
+bool cpu_affinity::bind_local(void *addr, size_t len)
+{
+    if (!enabled() || m_nodes <= 1 || !len)
+        return true;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+    unsigned long mask[16];
+    memset(mask, 0, sizeof(mask));
+    if (m_loop_node >= (int)(sizeof(mask) * 8))
+        return false;
+    mask[m_loop_node / (sizeof(unsigned long) * 8)] |= 1UL << (m_loop_node % (sizeof(unsigned long) * 8));
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask, sizeof(mask) * 8, MPOL_MF_MOVE) == 0;
+}
+
+//网卡的接收队列与 CPU 的对应关系（RSS/RPS、中断亲和性）决定了连接的数据包在哪个 CPU 上完成协议栈处理，
+//落在其它节点上的连接，其 socket 缓冲区与连接对象分处两个节点
+void cpu_affinity::incoming(int fd)
+{
+    if (!enabled() || m_nodes <= 1)
+        return;
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) != 0 || cpu < 0)
+        return;
+    if (node_of(cpu) == m_loop_node)
+        m_rx_local.fetch_add(1, std::memory_order_relaxed);
+    else
+        m_rx_remote.fetch_add(1, std::memory_order_relaxed);
+}
+
+void cpu_affinity::metrics(std::string &text)
+{
+    if (!enabled())
+        return;
+    char line[160];
+    int len = snprintf(line, sizeof(line), "cpu_loop %d\nnuma_node %d\n", m_loop_cpu, m_loop_node);
+    text.append(line, len);
+    if (m_nodes <= 1)
+        return;
+    len = snprintf(line, sizeof(line), "rx_local_node %lu\nrx_remote_node %lu\n",
+                   m_rx_local.load(std::memory_order_relaxed), m_rx_remote.load(std::memory_order_relaxed));
+    text.append(line, len);
+}
@@ -0,0 +1,55 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+
+// CPU 亲和性与 NUMA 放置。
+// 服务器只有一个事件循环（主线程），连接对象和定时器数组都由它管理：主线程绑定到允许使用的第一个 CPU，
+// 连接对象数组的内存优先放在该 CPU 所在的节点上；工作线程依次绑定到同一节点的其余 CPU，
+// 本节点用完后才使用其它节点，工作线程与主线程之间交接的连接对象始终在本节点内访问。
+class cpu_affinity
+{
+public:
+    static cpu_affinity *get_instance()
+    {
+        static cpu_affinity instance;
+        return &instance;
+    }
+
+    // 读取本进程允许使用的 CPU 及其所在节点，规划主线程和工作线程的位置；失败时返回 false，不做任何绑定
+    bool init();
+    bool enabled() const { return !m_cpus.empty(); }
+    int loop_cpu() const { return m_loop_cpu; }
+    int loop_node() const { return m_loop_node; }
+
+    // 把调用线程绑定到主线程的 CPU
+    bool pin_loop();
+    // 把第 index 个工作线程绑定到规划的 CPU
+    bool pin_worker(pthread_t thread, int index);
+    // 把 [addr, addr + len) 的内存放到主线程所在节点，已分配的页一并迁移；单节点机器上不做任何事
+    bool bind_local(void *addr, size_t len);
+    // 记录新连接的接收队列由哪个 CPU 处理（SO_INCOMING_CPU），统计落在其它节点上的连接（只在主线程调用）
+    void incoming(int fd);
+
+    void metrics(std::string &text);
+
+private:
+    cpu_affinity() : m_loop_cpu(-1), m_loop_node(0), m_nodes(1), m_rx_local(0), m_rx_remote(0) {}
+
+    int node_of(int cpu) const;
+
+    std::vector<int> m_cpus;            // 允许使用的 CPU，按编号排列
+    std::vector<int> m_cpu_node;        // CPU 编号 -> 节点
+    std::vector<int> m_worker_cpus;     // 工作线程依次使用的 CPU，本节点优先
+    int m_loop_cpu;                     // 主线程所在的 CPU
+    int m_loop_node;                    // 主线程所在的节点
+    int m_nodes;                        // 节点数
+    std::atomic<unsigned long> m_rx_local;     // 接收队列由本节点 CPU 处理的连接数
+    std::atomic<unsigned long> m_rx_remote;    // 接收队列由其它节点 CPU 处理的连接数
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "password_hasher.h"
+
+#include <crypt.h>
+#include <string.h>
+#include <memory>
+
+std::string password_hasher::hash(const std::string &password)
+{
+    char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+    // rbytes 传 NULL，由 libcrypt 从系统随机源获取盐
+    if (!crypt_gensalt_rn(HASH_PREFIX, HASH_COST, NULL, 0, salt, sizeof(salt)))
+        return std::string();
+
+    // crypt_data 约 32KB，放在堆上避免撑爆工作线程的栈
+    std::unique_ptr<crypt_data> data(new crypt_data());
+    const char *out = crypt_r(password.c_str(), salt, data.get());
+    if (!out || out[0] == '*')
+        return std::string();
+    return std::string(out);
+}
+
+bool password_hasher::verify(const std::string &password, const std::string &stored)
+{
+    if (!is_hashed(stored))
+        return const_time_equal(password.data(), password.size(), stored.data(), stored.size());
+
+    std::unique_ptr<crypt_data> data(new crypt_data());
+    const char *out = crypt_r(password.c_str(), stored.c_str(), data.get());
+    if (!out || out[0] == '*')
+        return false;
+    return const_time_equal(out, strlen(out), stored.data(), stored.size());
+}
+
+bool password_hasher::is_hashed(const std::string &stored)
+{
+    return !stored.empty() && stored[0] == '$';
+}
+
+// 比较耗时只与较长一方的长度有关，避免按前缀泄露信息
+bool password_hasher::const_time_equal(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t n = alen > blen ? alen : blen;
+    unsigned char diff = (alen != blen);
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char x = i < alen ? a[i] : 0;
+        unsigned char y = i < blen ? b[i] : 0;
+        diff |= x ^ y;
+    }
+    return diff == 0;
+}
@@ -0,0 +1,27 @@
+#ifndef PASSWORD_HASHER_H
+#define PASSWORD_HASHER_H
+
+#include <string>
+
+// 口令散列工具，基于 libcrypt 的 crypt_r / crypt_gensalt_rn。
+// 默认使用 yescrypt（"$y$"），单次计算约数十毫秒，必须放在独立的校验线程池中执行。
+class password_hasher
+{
+public:
+    static constexpr const char *HASH_PREFIX = "$y$";   // yescrypt
+    static constexpr unsigned long HASH_COST = 0;       // 0 表示使用 libcrypt 的默认代价
+
+    // 生成带随机盐的散列串，失败时返回空串
+    static std::string hash(const std::string &password);
+
+    // 校验口令；stored 为旧版明文时退化为常量时间的明文比较
+    static bool verify(const std::string &password, const std::string &stored);
+
+    // 判断数据库中保存的是否已是散列串（以 '$' 开头）
+    static bool is_hashed(const std::string &stored);
+
+private:
+    static bool const_time_equal(const char *a, size_t alen, const char *b, size_t blen);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "verify_cache.h"
+
+#include <sys/random.h>
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+
+verify_cache::verify_cache() : m_ttl(300), m_max_entries(10000)
+{
+    // 取不到随机数时不启用缓存：可预测的密钥会让摘要退化为无盐的口令散列
+    m_keyed = getrandom(m_key, sizeof(m_key), 0) == sizeof(m_key);
+}
+
+void verify_cache::init(int ttl_seconds, size_t max_entries)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ttl = ttl_seconds;
+    m_max_entries = max_entries;
+}
+
+//HMAC-SHA256(密钥, 用户名 '\0' 口令)：同一口令在不同用户下的摘要不同
+bool verify_cache::digest(const std::string &name, const std::string &password, digest_t &out) const
+{
+    std::string message;
+    message.reserve(name.size() + 1 + password.size());
+    message.append(name).push_back('\0');
+    message.append(password);
+    unsigned int len = 0;
+    bool ok = HMAC(EVP_sha256(), m_key, sizeof(m_key), (const unsigned char *)message.data(), message.size(),
+                   out.data(), &len) != NULL && len == DIGEST_LEN;
+    OPENSSL_cleanse(&message[0], message.size());
+    return ok;
+}
+
+bool verify_cache::lookup(const std::string &name, const std::string &password)
+{
+    digest_t d;
+    if (!m_keyed || !digest(name, password, d))
+        return false;
+    time_t now = time(NULL);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(name);
+    if (it == m_entries.end())
+        return false;
+    if (it->second.expire <= now)
+    {
+        m_entries.erase(it);
+        return false;
+    }
+    return CRYPTO_memcmp(it->second.digest.data(), d.data(), DIGEST_LEN) == 0;
+}
+
+void verify_cache::insert(const std::string &name, const std::string &password)
+{
+    digest_t d;
+    if (!m_keyed || m_ttl <= 0 || !digest(name, password, d))
+        return;
+    time_t now = time(NULL);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 条目过多时整体清理过期项，仍然超限则放弃缓存本次结果
+    if (m_entries.size() >= m_max_entries)
+    {
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (it->second.expire <= now)
+                it = m_entries.erase(it);
+            else
+                ++it;
+        }
+        if (m_entries.size() >= m_max_entries)
+            return;
+    }
+    m_entries[name] = entry{d, now + m_ttl};
+}
+
+void verify_cache::erase(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.erase(name);
+}
@@ -0,0 +1,53 @@
+#ifndef VERIFY_CACHE_H
+#define VERIFY_CACHE_H
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <time.h>
+
+// 已校验会话缓存：记录最近一次成功登录的“用户名 -> 口令摘要”，
+// 同一用户在有效期内用相同口令重复登录时无需再做一次昂贵的散列计算。
+// 摘要为以进程启动时生成的随机密钥计算的 HMAC-SHA256，只用于命中判断，不会落盘；
+// 没有密钥就无法由内存中的摘要离线猜测口令。
+class verify_cache
+{
+public:
+    static verify_cache *get_instance()
+    {
+        static verify_cache instance;
+        return &instance;
+    }
+
+    void init(int ttl_seconds, size_t max_entries);
+
+    bool lookup(const std::string &name, const std::string &password);
+    void insert(const std::string &name, const std::string &password);
+    void erase(const std::string &name);
+
+private:
+    verify_cache();
+    ~verify_cache() {}
+
+    static const size_t KEY_LEN = 32;       // HMAC 密钥长度
+    static const size_t DIGEST_LEN = 32;    // SHA-256 输出长度
+    typedef std::array<unsigned char, DIGEST_LEN> digest_t;
+
+    bool digest(const std::string &name, const std::string &password, digest_t &out) const;
+
+    struct entry
+    {
+        digest_t digest;    // 口令摘要
+        time_t expire;      // 过期时间
+    };
+
+    std::unordered_map<std::string, entry> m_entries;
+    std::mutex m_mutex;
+    unsigned char m_key[KEY_LEN];   // 进程启动时生成的随机 HMAC 密钥
+    bool m_keyed;           // 取到了随机密钥，否则不缓存
+    int m_ttl;              // 缓存有效期（秒）
+    size_t m_max_entries;   // 最大缓存条目数
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef VERIFY_POOL_H
+#define VERIFY_POOL_H
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <stdexcept>
+
+// 口令校验专用的有界线程池。
+// 散列计算是 CPU 密集型任务，与静态文件请求共用 threadpool 会拉高所有请求的尾延迟，
+// 因此单独限制线程数和排队深度：队列满时 submit() 立即返回 false，由调用方回复 503。
+class verify_pool {
+public:
+    verify_pool(int thread_number = 2, int max_pending = 64);
+    ~verify_pool();
+    bool submit(std::function<void()> job);
+    int pending();
+    void stop();
+
+private:
+    void run();
+
+private:
+    int m_thread_number;                        // 校验线程数
+    int m_max_pending;                          // 允许排队的最大任务数
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_jobs;   // 待校验任务
+    std::mutex m_jobslocker;
+    std::condition_variable m_jobscond;
+    bool m_stop;
+};
+
+inline verify_pool::verify_pool(int thread_number, int max_pending)
+    : m_thread_number(thread_number),
+      m_max_pending(max_pending),
+      m_stop(false) {
+    if (thread_number <= 0 || max_pending <= 0) {
+        throw std::invalid_argument("Verify thread number and max pending must be positive");
+    }
+
+    m_threads.reserve(thread_number);
+    for (int i = 0; i < thread_number; ++i) {
+        m_threads.emplace_back(&verify_pool::run, this);
+    }
+}
+
+inline verify_pool::~verify_pool() {
+    stop();
+    for (auto& thread : m_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+inline void verify_pool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_jobslocker);
+        m_stop = true;
+    }
+    m_jobscond.notify_all();
+}
+
+inline bool verify_pool::submit(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(m_jobslocker);
+    if (m_stop || m_jobs.size() >= static_cast<size_t>(m_max_pending)) {
+        return false;
+    }
+    m_jobs.push_back(std::move(job));
+    m_jobscond.notify_one();
+    return true;
+}
+
+inline int verify_pool::pending() {
+    std::lock_guard<std::mutex> lock(m_jobslocker);
+    return static_cast<int>(m_jobs.size());
+}
+
+inline void verify_pool::run() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(m_jobslocker);
+        m_jobscond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+        if (m_stop) {
+            break;
+        }
+        std::function<void()> job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        job();
+    }
+}
+
+#endif
@@ -0,0 +1,197 @@
+// 请求报文解析的微基准：用几组真实浏览器的请求头，比较
+// 1. 行扫描：find_line_end（运行时选择的 SIMD 实现）与逐字节查找 '\r'/'\n'（原 parse_line 的做法）；
+// 2. 头部识别：lookup_header 的哈希查找与逐个 strncasecmp（原 parse_headers 的做法）；
+// 3. 两者合起来的整条请求。
+// 用法：parser_bench [每组请求的重复次数，默认 200000]
+
+#include "../http/http_scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <chrono>
+#include <string>
+
+struct sample
+{
+    const char *name;
+    const char *request;
+};
+
+static const sample SAMPLES[] = {
+    {"chrome",
+     "GET /static/js/app.3f9c2b.js HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "Connection: keep-alive\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+     "Chrome/128.0.0.0 Safari/537.36\r\n"
+     "sec-ch-ua-platform: \"Windows\"\r\n"
+     "Accept: */*\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Sec-Fetch-Mode: no-cors\r\n"
+     "Sec-Fetch-Dest: script\r\n"
+     "Referer: https://www.example.com/index.html\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+     "Cookie: sid=8c1f0e2a9b7d4c3e5f6a7b8c9d0e1f2a; _ga=GA1.1.1234567890.1700000000; theme=dark\r\n"
+     "\r\n"},
+    {"firefox",
+     "GET /index.html HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:130.0) Gecko/20100101 Firefox/130.0\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+     "Accept-Language: en-US,en;q=0.5\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Connection: keep-alive\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Sec-Fetch-Site: none\r\n"
+     "Sec-Fetch-User: ?1\r\n"
+     "Priority: u=0, i\r\n"
+     "\r\n"},
+    {"safari",
+     "GET /images/banner.jpg HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "Accept: image/webp,image/avif,image/jxl,image/heic,image/heic-sequence,video/*;q=0.8,image/png,"
+     "image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "Sec-Fetch-Mode: no-cors\r\n"
+     "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_5 like Mac OS X) AppleWebKit/605.1.15 "
+     "(KHTML, like Gecko) Version/17.5 Mobile/15E148 Safari/604.1\r\n"
+     "Referer: https://www.example.com/\r\n"
+     "Connection: keep-alive\r\n"
+     "Sec-Fetch-Dest: image\r\n"
+     "Cookie: sid=8c1f0e2a9b7d4c3e5f6a7b8c9d0e1f2a\r\n"
+     "\r\n"},
+    {"login-post",
+     "POST /2CGISQL.cgi HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "Connection: keep-alive\r\n"
+     "Content-Length: 27\r\n"
+     "Cache-Control: max-age=0\r\n"
+     "Origin: https://www.example.com\r\n"
+     "Content-Type: application/x-www-form-urlencoded\r\n"
+     "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) "
+     "Chrome/128.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+     "Referer: https://www.example.com/log.html\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9\r\n"
+     "\r\n"},
+};
+
+static const size_t SAMPLE_NUM = sizeof(SAMPLES) / sizeof(SAMPLES[0]);
+
+//原 parse_line 的做法：逐字节查找行结束符
+static const char *scalar_line_end(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n')
+            return p;
+    }
+    return end;
+}
+
+//原 parse_headers 的做法：逐个 strncasecmp，顺序与原代码相同，其余头部在此基础上补齐
+static HEADER_ID strncasecmp_header(const char *name, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        HEADER_ID id;
+    } chain[] = {
+        {"Connection", HEADER_CONNECTION},
+        {"Content-length", HEADER_CONTENT_LENGTH},
+        {"Host", HEADER_HOST},
+        {"Cookie", HEADER_COOKIE},
+        {"Transfer-Encoding", HEADER_TRANSFER_ENCODING},
+        {"Accept-Encoding", HEADER_ACCEPT_ENCODING},
+        {"Upgrade", HEADER_UPGRADE},
+        {"HTTP2-Settings", HEADER_HTTP2_SETTINGS},
+        {"Sec-WebSocket-Key", HEADER_SEC_WEBSOCKET_KEY},
+        {"Sec-WebSocket-Version", HEADER_SEC_WEBSOCKET_VERSION},
+    };
+    for (const auto &c : chain)
+    {
+        if (strlen(c.name) == len && strncasecmp(name, c.name, len) == 0)
+            return c.id;
+    }
+    return HEADER_UNKNOWN;
+}
+
+typedef const char *(*line_fn)(const char *, const char *);
+typedef HEADER_ID (*header_fn)(const char *, size_t);
+
+//扫描整条请求：逐行定位行结束符，对头部行识别名字。返回识别出的头部数，防止被优化掉
+static unsigned parse_once(const std::string &req, line_fn find_end, header_fn identify)
+{
+    const char *p = req.data();
+    const char *end = p + req.size();
+    unsigned known = 0;
+    bool first = true;
+    while (p < end)
+    {
+        const char *eol = find_end(p, end);
+        if (eol <= p)
+            break;
+        if (!first && identify)
+        {
+            const char *colon = (const char *)memchr(p, ':', eol - p);
+            if (colon && identify(p, colon - p) != HEADER_UNKNOWN)
+                ++known;
+        }
+        first = false;
+        p = eol + 2;
+    }
+    return known;
+}
+
+static double run(const std::string &req, long iterations, line_fn find_end, header_fn identify)
+{
+    volatile unsigned sink = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i)
+        sink = sink + parse_once(req, find_end, identify);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    printf("scan impl: %s, %ld iterations per sample\n", scan_impl_name(), iterations);
+    printf("%-12s %6s  %12s %12s  %12s %12s  %12s %12s\n", "sample", "bytes", "lines/old", "lines/new",
+           "hdrs/old", "hdrs/new", "full/old", "full/new");
+
+    for (size_t i = 0; i < SAMPLE_NUM; ++i)
+    {
+        std::string req(SAMPLES[i].request);
+        //新旧两种做法识别出的头部必须一致
+        if (parse_once(req, scalar_line_end, strncasecmp_header) != parse_once(req, find_line_end, lookup_header))
+        {
+            fprintf(stderr, "%s: header lookup mismatch\n", SAMPLES[i].name);
+            return 1;
+        }
+        double lines_old = run(req, iterations, scalar_line_end, NULL);
+        double lines_new = run(req, iterations, find_line_end, NULL);
+        double hdrs_old = run(req, iterations, find_line_end, strncasecmp_header) - lines_new;
+        double hdrs_new = run(req, iterations, find_line_end, lookup_header) - lines_new;
+        double full_old = run(req, iterations, scalar_line_end, strncasecmp_header);
+        double full_new = run(req, iterations, find_line_end, lookup_header);
+        printf("%-12s %6zu  %10.1fns %10.1fns  %10.1fns %10.1fns  %10.1fns %10.1fns\n", SAMPLES[i].name,
+               req.size(), lines_old, lines_new, hdrs_old, hdrs_new, full_old, full_new);
+    }
+    return 0;
+}
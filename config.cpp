@@ -1,8 +1,212 @@
 #include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdexcept>
+
+//去掉首尾空白
+static char *trim(char *text)
+{
+    while (*text == ' ' || *text == '\t')
+        ++text;
+    char *end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        --end;
+    *end = '\0';
+    return text;
+}
+
+//非负整数，字节数可带 k/m/g 后缀
+static bool parse_number(const char *text, bool size_suffix, unsigned long long &out)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || errno || text[0] == '-')
+        return false;
+    if (size_suffix && *end)
+    {
+        switch (*end++ | 0x20)
+        {
+            case 'k': value <<= 10; break;
+            case 'm': value <<= 20; break;
+            case 'g': value <<= 30; break;
+            default: return false;
+        }
+    }
+    if (*end)
+        return false;
+    out = value;
+    return true;
+}
+
+bool Config::load_file(const char *path, std::string &err)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        err = std::string("cannot open ") + path + ": " + strerror(errno);
+        return false;
+    }
+
+    //节名.键名 -> 参数，min 为允许的最小值
+    struct int_key { const char *name; int *value; int min; };
+    const int_key ints[] = {
+        {"server.port", &PORT, 1},
+        {"server.trig_mode", &TRIGMode, 0},
+        {"server.opt_linger", &OPT_LINGER, 0},
+        {"server.thread_num", &thread_num, 1},
+        {"server.max_thread_num", &max_thread_num, 0},
+        {"server.actor_model", &actor_model, 0},
+        {"server.tls", &tls, 0},
+        {"server.affinity", &affinity, 0},
+        {"server.max_fd", &max_fd, 16},
+        {"server.timeslot", &timeslot, 1},
+        {"server.read_buffer_size", &read_buffer_size, 512},
+        {"log.write", &LOGWrite, 0},
+        {"log.close", &close_log, 0},
+        {"log.split_lines", &log_split_lines, 1},
+        {"log.queue_size", &log_queue_size, 1},
+        {"db.port", &db_port, 1},
+        {"db.sql_num", &sql_num, 1},
+        {"timeout.header", &tunables.header_timeout, 1},
+        {"timeout.body", &tunables.body_timeout, 1},
+        {"timeout.write", &tunables.write_timeout, 1},
+        {"timeout.keepalive", &tunables.keepalive_timeout, 1},
+        {"timeout.min_rate", &tunables.min_rate, 1},
+        {"limit.ip_max_conn", &tunables.ip_max_conn, 0},
+        {"limit.ip_rate", &tunables.ip_rate, 0},
+        {"limit.ip_burst", &tunables.ip_burst, 1},
+    };
+    struct size_key { const char *name; size_t *value; };
+    const size_key sizes[] = {
+        {"cache.static_budget", &tunables.static_cache_budget},
+        {"cache.proxy_budget", &tunables.proxy_cache_budget},
+    };
+    static const char *levels[] = {"debug", "info", "warn", "error"};
+
+    char line[1024];
+    std::string section;
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        ++line_no;
+        char *comment = strpbrk(line, "#;");
+        if (comment)
+            *comment = '\0';
+        char *text = trim(line);
+        if (!*text)
+            continue;
+
+        char where[300];
+        snprintf(where, sizeof(where), "%s:%d: ", path, line_no);
+        if (*text == '[')
+        {
+            char *close = strchr(text, ']');
+            if (!close || close[1])
+            {
+                err = std::string(where) + "bad section header";
+                ok = false;
+                break;
+            }
+            *close = '\0';
+            section = trim(text + 1);
+            continue;
+        }
+        char *eq = strchr(text, '=');
+        if (!eq)
+        {
+            err = std::string(where) + "expected key = value";
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        std::string name = section + "." + trim(text);
+        char *value = trim(eq + 1);
+
+        bool known = false;
+        unsigned long long number;
+        for (const int_key &key : ints)
+        {
+            if (name != key.name)
+                continue;
+            known = true;
+            if (!parse_number(value, false, number) || number < (unsigned long long)key.min || number > 0x7fffffff)
+            {
+                err = std::string(where) + name + " must be an integer >= " + std::to_string(key.min);
+                ok = false;
+            }
+            else
+                *key.value = (int)number;
+        }
+        for (const size_key &key : sizes)
+        {
+            if (name != key.name)
+                continue;
+            known = true;
+            if (!parse_number(value, true, number))
+            {
+                err = std::string(where) + name + " must be a byte count (k/m/g suffix allowed)";
+                ok = false;
+            }
+            else
+                *key.value = (size_t)number;
+        }
+        if (name == "db.host")
+        {
+            known = true;
+            db_host = value;
+        }
+        else if (name == "log.level")
+        {
+            known = true;
+            int level = -1;
+            for (int i = 0; i < 4; ++i)
+            {
+                if (strcasecmp(value, levels[i]) == 0)
+                    level = i;
+            }
+            if (level < 0)
+            {
+                err = std::string(where) + "log.level must be debug, info, warn or error";
+                ok = false;
+            }
+            else
+                tunables.log_level = level;
+        }
+        //拼错的键名直接报错，不悄悄忽略
+        if (ok && !known)
+        {
+            err = std::string(where) + "unknown key " + name;
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:T:c:a:S:A:f:";
+
+    //先找出 -f 读取配置文件，其余命令行选项再覆盖文件中的值；缺省的配置文件不存在时全部使用默认值
+    bool explicit_file = false;
+    opterr = 0;
+    while ((opt = getopt(argc, argv, str)) != -1) {
+        if (opt == 'f') {
+            config_file = optarg;
+            explicit_file = true;
+        }
+    }
+    if (explicit_file || access(config_file.c_str(), F_OK) == 0) {
+        std::string err;
+        if (!load_file(config_file.c_str(), err)) {
+            throw std::runtime_error("配置文件有误: " + err);
+        }
+    }
+    optind = 1;
+    opterr = 1;
 
     // 对 optarg 的有效性检查，避免非法输入导致的未定义行为。
     auto validate_and_convert = [](const char* optarg, const std::string& option_name) -> int {
@@ -40,6 +244,10 @@ void Config::parse_arg(int argc, char*argv[]){
             value = validate_and_convert(optarg, "-t (thread num)");
             if (value != -1) thread_num = value;
             break;
+        case 'T':
+            value = validate_and_convert(optarg, "-T (max thread num)");
+            if (value != -1) max_thread_num = value;
+            break;
         case 'c':
             value = validate_and_convert(optarg, "-c (close log)");
             if (value != -1) close_log = value;
@@ -48,6 +256,16 @@ void Config::parse_arg(int argc, char*argv[]){
             value = validate_and_convert(optarg, "-a (actor model)");
             if (value != -1) actor_model = value;
             break;
+        case 'S':
+            value = validate_and_convert(optarg, "-S (tls)");
+            if (value != -1) tls = value;
+            break;
+        case 'A':
+            value = validate_and_convert(optarg, "-A (cpu affinity)");
+            if (value != -1) affinity = value;
+            break;
+        case 'f':
+            break;
         default:
             std::cerr << "Unknown option: " << static_cast<char>(opt) << std::endl;
             break;
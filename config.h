@@ -3,7 +3,10 @@
 
 #include "webserver.h"
 #include <iostream>
+#include <string>
 
+// 启动参数：默认值 < 配置文件（INI 格式，-f 指定，缺省为 CONFIG_FILE）< 命令行选项。
+// 配置文件的格式和各项含义见 README；收到 SIGHUP 时只重新读取 server_tunables 中的参数
 class Config
 {
 public:
@@ -16,8 +19,11 @@ public:
     static constexpr int DEFAULT_OPT_LINGER = 0;        // 优雅关闭链接，默认不使用
     static constexpr int DEFAULT_SQL_NUM = 8;           // 数据库连接池数量，默认8
     static constexpr int DEFAULT_THREAD_NUM = 8;        // 线程池内的线程数量，默认8
+    static constexpr int DEFAULT_MAX_THREAD_NUM = 0;    // 线程池弹性扩容的最大线程数，默认0（不扩容）
     static constexpr int DEFAULT_CLOSE_LOG = 0;         // 关闭日志，默认不关闭
     static constexpr int DEFAULT_ACTOR_MODEL = 0;       // 并发模型，默认是proactor
+    static constexpr int DEFAULT_TLS = 0;               // 监听端口启用TLS，默认不启用
+    static constexpr int DEFAULT_AFFINITY = 0;          // 绑定CPU并按NUMA节点放置内存，默认不启用
 
     Config()
         : PORT(DEFAULT_PORT),
@@ -28,11 +34,38 @@ public:
           OPT_LINGER(DEFAULT_OPT_LINGER),
           sql_num(DEFAULT_SQL_NUM),
           thread_num(DEFAULT_THREAD_NUM),
+          max_thread_num(DEFAULT_MAX_THREAD_NUM),
           close_log(DEFAULT_CLOSE_LOG),
-          actor_model(DEFAULT_ACTOR_MODEL) {}
+          actor_model(DEFAULT_ACTOR_MODEL),
+          tls(DEFAULT_TLS),
+          affinity(DEFAULT_AFFINITY),
+          config_file(CONFIG_FILE),
+          max_fd(MAX_FD),
+          timeslot(TIMESLOT),
+          read_buffer_size(http_conn::READ_BUFFER_SIZE),
+          log_split_lines(LOG_SPLIT_LINES),
+          log_queue_size(LOG_QUEUE_SIZE),
+          db_host(DB_HOST),
+          db_port(DB_PORT)
+    {
+        tunables.header_timeout = http_conn::HEADER_TIMEOUT;
+        tunables.body_timeout = http_conn::BODY_TIMEOUT;
+        tunables.write_timeout = http_conn::WRITE_TIMEOUT;
+        tunables.keepalive_timeout = http_conn::KEEPALIVE_TIMEOUT;
+        tunables.min_rate = http_conn::MIN_RATE;
+        tunables.ip_max_conn = IP_MAX_CONN;
+        tunables.ip_rate = IP_RATE;
+        tunables.ip_burst = IP_BURST;
+        tunables.static_cache_budget = STATIC_CACHE_BUDGET;
+        tunables.proxy_cache_budget = PROXY_CACHE_BUDGET;
+        tunables.log_level = 0;
+    }
     ~Config(){};
 
+    // 配置文件有误时抛出 std::runtime_error
     void parse_arg(int argc, char*argv[]);
+    // 读取配置文件，文件中出现的参数覆盖当前值；文件不存在或有误时返回 false，err 为原因，已读取的参数不回退
+    bool load_file(const char *path, std::string &err);
 
     int getPort() { return PORT;}
     int getLOGWrite() { return LOGWrite;}
@@ -42,8 +75,20 @@ public:
     int getOPTLINGER() { return OPT_LINGER;}
     int getSqlNum() { return sql_num;}
     int getThreadNum() { return thread_num;}
+    int getMaxThreadNum() { return max_thread_num;}
     int getCloseLog() { return close_log;}
     int getActorModel() { return actor_model;}
+    int getTLS() { return tls;}
+    int getAffinity() { return affinity;}
+    const std::string &getConfigFile() const { return config_file;}
+    int getMaxFd() const { return max_fd;}
+    int getTimeslot() const { return timeslot;}
+    int getReadBufferSize() const { return read_buffer_size;}
+    int getLogSplitLines() const { return log_split_lines;}
+    int getLogQueueSize() const { return log_queue_size;}
+    const std::string &getDbHost() const { return db_host;}
+    int getDbPort() const { return db_port;}
+    const server_tunables &getTunables() const { return tunables;}
 
 private:
     int PORT;               // 端口号
@@ -54,8 +99,20 @@ private:
     int OPT_LINGER;         // 优雅关闭链接
     int sql_num;            // 数据库连接池数量
     int thread_num;         // 线程池内的线程数量
+    int max_thread_num;     // 线程池内的最大线程数量
     int close_log;          // 关闭日志
     int actor_model;        // 并发模型
+    int tls;                // 启用TLS
+    int affinity;           // 绑定CPU
+    std::string config_file;    // 配置文件路径
+    int max_fd;                 // 最大文件描述符
+    int timeslot;               // 定时器时间片
+    int read_buffer_size;       // 每个连接的读缓冲区大小
+    int log_split_lines;        // 单个日志文件的最大行数
+    int log_queue_size;         // 异步日志队列长度
+    std::string db_host;        // 数据库地址
+    int db_port;                // 数据库端口
+    server_tunables tunables;   // 可在运行中重新加载的参数
 };
 
 #endif
\ No newline at end of file
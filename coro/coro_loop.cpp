@@ -0,0 +1,182 @@
+#include "coro_loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+
+bool coro_loop::init(int epollfd, int max_fd)
+{
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd < 0)
+        return false;
+    epoll_event event;
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, m_eventfd, &event) != 0)
+    {
+        close(m_eventfd);
+        m_eventfd = -1;
+        return false;
+    }
+    m_waiters.assign(max_fd, NULL);
+    m_thread = std::this_thread::get_id();
+    m_epollfd = epollfd;
+    return true;
+}
+
+long coro_loop::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+//事件循环线程上从不阻塞：描述符无效时直接失败，超出 m_waiters 的描述符（max_fd 之外的上游连接）按需扩大。
+//事件循环以外的线程就地等待（EPOLLIN/EPOLLOUT 与 POLLIN/POLLOUT 取值相同），定时器就地睡眠
+bool coro_loop::wait_awaiter::await_ready()
+{
+    ready = false;
+    if (loop->on_loop())
+    {
+        if (events == 0)
+            return deadline <= now_ms();
+        if (fd < 0)
+            return true;
+        if (fd >= (int)loop->m_waiters.size())
+            loop->m_waiters.resize(std::max<size_t>(fd + 1, loop->m_waiters.size() * 2), NULL);
+        return false;
+    }
+    while (true)
+    {
+        long left = deadline - now_ms();
+        if (left <= 0)
+            return true;
+        if (events == 0)
+        {
+            struct timespec ts = {left / 1000, (left % 1000) * 1000000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        struct pollfd pfd = {fd, (short)events, 0};
+        int ret = poll(&pfd, 1, (int)left);
+        if (ret > 0)
+        {
+            ready = true;
+            return true;
+        }
+        if (ret == 0 || errno != EINTR)
+            return true;
+    }
+}
+
+bool coro_loop::wait_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    if (events != 0)
+    {
+        epoll_event event;
+        event.data.fd = fd;
+        event.events = events | EPOLLONESHOT;
+        if (epoll_ctl(loop->m_epollfd, EPOLL_CTL_ADD, fd, &event) != 0 &&
+            (errno != EEXIST || epoll_ctl(loop->m_epollfd, EPOLL_CTL_MOD, fd, &event) != 0))
+            return false;
+        loop->m_waiters[fd] = this;
+        loop->m_waiting++;
+    }
+    handle = h;
+    timer = loop->m_timers.emplace(deadline, this);
+    return true;
+}
+
+//等待结束后把描述符移出 epoll，之后它可能被放回上游连接池或交给 upstream_table 转发，由新的持有者重新注册
+void coro_loop::finish(wait_awaiter *w, bool ready)
+{
+    if (w->events != 0)
+    {
+        m_waiters[w->fd] = NULL;
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, w->fd, 0);
+        m_waiting--;
+    }
+    m_timers.erase(w->timer);
+    m_resumed++;
+    w->ready = ready && !w->cancelled;
+    w->handle.resume();
+}
+
+bool coro_loop::dispatch(int fd)
+{
+    if (fd < 0 || m_epollfd < 0)
+        return false;
+    if (fd == m_eventfd)
+    {
+        uint64_t count;
+        while (read(m_eventfd, &count, sizeof(count)) > 0)
+            ;
+        std::vector<std::coroutine_handle<>> posted;
+        {
+            std::lock_guard<std::mutex> lock(m_posted_lock);
+            posted.swap(m_posted);
+        }
+        for (std::coroutine_handle<> h : posted)
+        {
+            m_resumed++;
+            h.resume();
+        }
+        return true;
+    }
+    if (fd >= (int)m_waiters.size() || !m_waiters[fd])
+        return false;
+    finish(m_waiters[fd], true);
+    return true;
+}
+
+void coro_loop::post(std::coroutine_handle<> h)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_posted_lock);
+        m_posted.push_back(h);
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(m_eventfd, &one, sizeof(one));
+    (void)ret;
+}
+
+int coro_loop::timeout() const
+{
+    if (m_timers.empty())
+        return -1;
+    long left = m_timers.begin()->first - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+void coro_loop::expire()
+{
+    long now = now_ms();
+    while (!m_timers.empty() && m_timers.begin()->first <= now)
+        finish(m_timers.begin()->second, false);
+}
+
+//截止时刻提前到最早，本轮中描述符恰好就绪也按取消处理；等待留在 m_waiters 中直到恢复，
+//本轮剩余的事件不会把该描述符误当作客户端连接
+bool coro_loop::cancel(int fd)
+{
+    if (!on_loop() || fd < 0 || fd >= (int)m_waiters.size() || !m_waiters[fd])
+        return false;
+    wait_awaiter *w = m_waiters[fd];
+    w->cancelled = true;
+    m_timers.erase(w->timer);
+    w->timer = m_timers.emplace(0, w);
+    return true;
+}
+
+void coro_loop::metrics(std::string &text)
+{
+    char line[96];
+    int len = snprintf(line, sizeof(line), "coro_waiting %d\ncoro_resumed %lu\n",
+                       m_waiting.load(std::memory_order_relaxed), m_resumed.load(std::memory_order_relaxed));
+    text.append(line, len);
+}
@@ -0,0 +1,133 @@
+#ifndef CORO_LOOP_H
+#define CORO_LOOP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "coro_task.h"
+
+// 由主线程事件循环驱动的协程等待对象。
+// 主线程中 co_await wait() 把描述符以 EPOLLONESHOT 加入 epoll 后挂起，就绪或超时后由事件循环恢复协程，
+// 一个线程可以同时挂起任意多个等待上游的请求；主线程上从不阻塞，描述符无效时等待立即以 false 结束。
+// 其它线程中同一个 wait() 就地 poll，协程不挂起，
+// 同一份协程代码既能在事件循环上异步执行，也能在工作线程中以 coro_task::sync() 同步执行。
+// 工作线程用 co_await schedule() 把协程交给主线程继续执行。
+class coro_loop
+{
+public:
+    static coro_loop *get_instance()
+    {
+        static coro_loop instance;
+        return &instance;
+    }
+
+    // 在事件循环所在的线程中调用：创建用于跨线程唤醒的 eventfd 并加入 epoll
+    bool init(int epollfd, int max_fd);
+    // 当前线程是否为事件循环线程
+    bool on_loop() const { return m_epollfd >= 0 && std::this_thread::get_id() == m_thread; }
+
+    // 单调时钟的毫秒数，等待的截止时刻以此为准
+    static long now_ms();
+
+    // 等待描述符就绪（EPOLLIN/EPOLLOUT），co_await 的结果为 false 表示到了截止时刻、被取消或描述符无效
+    struct wait_awaiter
+    {
+        coro_loop *loop;
+        int fd;
+        uint32_t events;                // 为 0 时是不关联描述符的定时器
+        long deadline;
+        bool ready;
+        bool cancelled;
+        std::coroutine_handle<> handle;
+        std::multimap<long, wait_awaiter *>::iterator timer;
+
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const { return ready; }
+    };
+    wait_awaiter wait(int fd, uint32_t events, long deadline) { return wait_awaiter{this, fd, events, deadline, false, false, {}, {}}; }
+    // 定时器：挂起到截止时刻后由事件循环恢复，不关联描述符（events 为 0），co_await 的结果恒为 false
+    wait_awaiter sleep_until(long deadline) { return wait_awaiter{this, -1, 0, deadline, false, false, {}, {}}; }
+
+    // 切换到事件循环线程：已在其中时不挂起
+    struct schedule_awaiter
+    {
+        coro_loop *loop;
+
+        bool await_ready() const { return loop->on_loop(); }
+        void await_suspend(std::coroutine_handle<> h) { loop->post(h); }
+        void await_resume() const {}
+    };
+    schedule_awaiter schedule() { return schedule_awaiter{this}; }
+    // 把挂起的协程交给事件循环恢复，可在任意线程中调用
+    void post(std::coroutine_handle<> h);
+
+    // 事件循环调用：fd 是 eventfd 或有协程在等待时恢复相应的协程并返回 true，否则返回 false
+    bool dispatch(int fd);
+    // 距最近的截止时刻的毫秒数，作为 epoll_wait 的超时；没有等待中的协程时为 -1
+    int timeout() const;
+    // 恢复已到截止时刻的协程
+    void expire();
+    // 取消描述符上挂起的等待：由下一轮事件循环的 expire() 恢复协程，co_await 的结果为 false，
+    // 不会在调用者中重入。只能在事件循环线程中调用，没有挂起的等待时返回 false
+    bool cancel(int fd);
+
+    void metrics(std::string &text);
+
+private:
+    coro_loop() : m_epollfd(-1), m_eventfd(-1), m_waiting(0), m_resumed(0) {}
+    ~coro_loop() {}
+
+    void finish(wait_awaiter *w, bool ready);
+
+    int m_epollfd;
+    int m_eventfd;
+    std::thread::id m_thread;
+    std::vector<wait_awaiter *> m_waiters;              // 按描述符索引，挂起在该描述符上的等待，按需扩大
+    std::multimap<long, wait_awaiter *> m_timers;       // 截止时刻 -> 等待（含定时器）
+    std::mutex m_posted_lock;
+    std::vector<std::coroutine_handle<>> m_posted;      // 其它线程交给主线程继续执行的协程
+    std::atomic<int> m_waiting;                         // 挂起在描述符上的协程数
+    std::atomic<unsigned long> m_resumed;               // 由事件循环恢复的次数
+};
+
+// 把 fn 交给线程池 pool（提供 submit(std::function<void()>)）执行，协程随后在该线程中继续，不占用发起它的线程。
+// co_await 的结果为 fn 的返回值；线程池已满时不挂起，结果为空
+template <typename Pool, typename F>
+struct offload_awaiter
+{
+    typedef std::invoke_result_t<F &> result_type;
+
+    Pool *pool;
+    F fn;
+    std::optional<result_type> result;
+
+    bool await_ready() const { return !pool; }
+    //提交成功后任务随时可能在线程池中恢复协程并销毁本对象，之后不能再访问成员
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        return pool->submit([this, h]() {
+            result.emplace(fn());
+            h.resume();
+        });
+    }
+    std::optional<result_type> await_resume() { return std::move(result); }
+};
+
+template <typename Pool, typename F>
+offload_awaiter<Pool, F> coro_offload(Pool *pool, F fn)
+{
+    return offload_awaiter<Pool, F>{pool, std::move(fn), std::nullopt};
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <utility>
+
+// C++20 协程的任务类型。
+// coro_task<T> 创建后不立即执行，被 co_await 时才开始，结束时直接切回等待它的协程（对称转移，不增加调用栈深度）。
+// 顶层任务有两种启动方式：coro_spawn() 就地启动、之后自行销毁；sync() 在主线程以外启动并阻塞到任务结束。
+// 协程在哪个线程上继续取决于它等待的对象，见 coro_loop.h。
+
+template <typename T>
+class coro_task;
+
+//任务结束时恢复等待它的协程，没有等待者时（coro_spawn 之外不会出现）停在结束点
+struct coro_final_awaiter
+{
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+    {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct coro_promise_base
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    coro_final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct coro_result : coro_promise_base
+{
+    std::optional<T> value;
+
+    void return_value(T v) { value = std::move(v); }
+    T get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct coro_result<void> : coro_promise_base
+{
+    void return_void() {}
+    void get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+//coro_spawn 和 sync() 的外层协程：立即开始，结束后自行销毁
+struct coro_detached
+{
+    struct promise_type
+    {
+        coro_detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename T = void>
+class coro_task
+{
+public:
+    struct promise_type : coro_result<T>
+    {
+        coro_task get_return_object() { return coro_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    coro_task(coro_task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    coro_task(const coro_task &) = delete;
+    coro_task &operator=(const coro_task &) = delete;
+    ~coro_task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().get(); }
+
+    // 在当前线程中启动任务并阻塞到它结束。等待描述符在主线程以外就地 poll，协程通常一直在本线程中运行；
+    // 任务挂起（co_await schedule() 转到主线程、交给线程池等）时在这里等待，由恢复它的线程运行到结束。
+    // 不能在主线程中调用：任务等待事件循环时会死锁
+    T sync()
+    {
+        std::promise<void> done;
+        std::future<void> finished = done.get_future();
+        run_and_notify(m_handle, std::move(done));
+        finished.wait();
+        return m_handle.promise().get();
+    }
+
+private:
+    explicit coro_task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+    //等待任务结束的外层协程，任务在哪个线程中结束就在哪个线程中通知 sync()；
+    //promise 保存在外层协程帧中，sync() 返回后通知方仍可安全地访问它
+    struct join_awaiter
+    {
+        std::coroutine_handle<promise_type> h;
+
+        bool await_ready() const noexcept { return h.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            h.promise().continuation = awaiting;
+            return h;
+        }
+        void await_resume() const noexcept {}
+    };
+    static coro_detached run_and_notify(std::coroutine_handle<promise_type> h, std::promise<void> done)
+    {
+        co_await join_awaiter{h};
+        done.set_value();
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// 就地启动任务，直到它第一次挂起才返回；任务的生命周期由它自己管理
+inline coro_detached coro_spawn(coro_task<void> task)
+{
+    co_await task;
+}
+
+#endif
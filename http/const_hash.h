@@ -0,0 +1,54 @@
+#ifndef CONST_HASH_H
+#define CONST_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+
+// 编译期哈希表的公共部分：FNV-1a 哈希和开放寻址槽的构造。
+// 路由表（router.h）、请求头名（http_scan.cpp）和 MIME 类型表（mime.h）都在编译期构造成这种表，
+// 运行时查找只需一次哈希和极少量比较，不做任何堆分配。
+
+constexpr size_t cstrlen(const char *s)
+{
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+// fold_case 为 true 时 ASCII 字母统一转小写后参与计算，用于不区分大小写的查找
+constexpr uint32_t fnv1a(const char *s, size_t len, bool fold_case = false)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (fold_case && c >= 'A' && c <= 'Z')
+            c = c - 'A' + 'a';
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 编译期构造哈希槽，槽内存放 entries 下标，-1 表示空槽；hash(entry) 给出条目键的哈希值，
+// 须与运行时查找使用同一种哈希。SLOTS 为 2 的幂且大于条目数，线性探测
+template <size_t SLOTS, typename T, size_t N, typename Hash>
+constexpr std::array<int, SLOTS> build_hash_slots(const T (&entries)[N], Hash hash)
+{
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "slot count must be a power of two");
+    std::array<int, SLOTS> slots{};
+    for (size_t i = 0; i < SLOTS; ++i)
+        slots[i] = -1;
+    for (size_t i = 0; i < N; ++i)
+    {
+        size_t pos = hash(entries[i]) & (SLOTS - 1);
+        while (slots[pos] != -1)
+            pos = (pos + 1) & (SLOTS - 1);
+        slots[pos] = static_cast<int>(i);
+    }
+    return slots;
+}
+
+#endif
@@ -0,0 +1,649 @@
+#include "h2_session.h"
+#include "http_scan.h"
+#include "../session/session_store.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+const char h2_session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+static const uint16_t SETTINGS_ENABLE_PUSH = 0x2;
+static const uint16_t SETTINGS_MAX_CONCURRENT_STREAMS = 0x3;
+static const uint16_t SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+static const uint16_t SETTINGS_MAX_FRAME_SIZE = 0x5;
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void append_u32(std::string &out, uint32_t v)
+{
+    char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+    out.append(b, 4);
+}
+
+//HTTP2-Settings 头是 base64url 编码（可省略结尾的 '='）
+static bool base64url_decode(const char *text, std::string &out)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+    for (; *text && *text != '='; ++text)
+    {
+        char c = *text;
+        int v;
+        if (c >= 'A' && c <= 'Z')
+            v = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            v = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            v = 62;
+        else if (c == '_' || c == '/')
+            v = 63;
+        else
+            return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+h2_stream::~h2_stream()
+{
+    if (map)
+        munmap(map, map_len);
+}
+
+h2_session::h2_session(request_handler on_request)
+    : m_on_request(on_request), m_in_pos(0), m_preface_received(false), m_goaway(false),
+      m_last_stream_id(0), m_header_stream(0), m_header_end_stream(false),
+      m_send_window(DEFAULT_WINDOW), m_peer_initial_window(DEFAULT_WINDOW), m_peer_max_frame(MAX_FRAME_SIZE)
+{
+}
+
+bool h2_session::start(const char *upgrade_settings)
+{
+    if (upgrade_settings)
+    {
+        //HTTP2-Settings 的内容等同于一个 SETTINGS 帧的负载，101 响应即视为确认，不再回复 ACK
+        std::string payload;
+        if (!base64url_decode(upgrade_settings, payload) || payload.size() % 6 != 0 ||
+            apply_settings((const uint8_t *)payload.data(), payload.size()) != H2_NO_ERROR)
+            return false;
+        m_out.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    }
+
+    write_frame_header(6, H2_SETTINGS, 0, 0);
+    char setting[2] = {(char)(SETTINGS_MAX_CONCURRENT_STREAMS >> 8), (char)SETTINGS_MAX_CONCURRENT_STREAMS};
+    m_out.append(setting, 2);
+    append_u32(m_out, MAX_CONCURRENT_STREAMS);
+    return true;
+}
+
+h2_stream *h2_session::open_upgrade_stream()
+{
+    std::unique_ptr<h2_stream> stream(new h2_stream);
+    stream->id = 1;
+    stream->request_done = true;
+    stream->send_window = m_peer_initial_window;
+    h2_stream *s = stream.get();
+    m_streams[1] = std::move(stream);
+    m_last_stream_id = 1;
+    return s;
+}
+
+bool h2_session::feed(const char *data, size_t len)
+{
+    if (m_goaway)
+        return true;
+    m_in.append(data, len);
+
+    if (!m_preface_received)
+    {
+        size_t n = m_in.size() - m_in_pos;
+        size_t cmp = n < PREFACE_LEN ? n : PREFACE_LEN;
+        if (memcmp(m_in.data() + m_in_pos, PREFACE, cmp) != 0)
+            return connection_error(H2_PROTOCOL_ERROR);
+        if (n < PREFACE_LEN)
+            return true;
+        m_in_pos += PREFACE_LEN;
+        m_preface_received = true;
+    }
+
+    while (m_in.size() - m_in_pos >= 9)
+    {
+        const uint8_t *p = (const uint8_t *)m_in.data() + m_in_pos;
+        uint32_t frame_len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        if (frame_len > MAX_FRAME_SIZE)
+            return connection_error(H2_FRAME_SIZE_ERROR);
+        if (m_in.size() - m_in_pos < 9 + frame_len)
+            break;
+        if (!process_frame(p[3], p[4], read_u32(p + 5) & 0x7fffffff, p + 9, frame_len))
+            return false;
+        m_in_pos += 9 + frame_len;
+        if (m_goaway)
+            break;
+    }
+
+    //已处理的输入及时回收，未完整到达的帧留在开头
+    if (m_in_pos == m_in.size())
+    {
+        m_in.clear();
+        m_in_pos = 0;
+    }
+    else if (m_in_pos > MAX_FRAME_SIZE)
+    {
+        m_in.erase(0, m_in_pos);
+        m_in_pos = 0;
+    }
+    return true;
+}
+
+bool h2_session::process_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len)
+{
+    //头部块没有结束时，只能出现同一个流的 CONTINUATION
+    if (m_header_stream && (type != H2_CONTINUATION || stream_id != m_header_stream))
+        return connection_error(H2_PROTOCOL_ERROR);
+
+    switch (type)
+    {
+        case H2_DATA:
+            return on_data(flags, stream_id, payload, len);
+        case H2_HEADERS:
+            return on_headers(flags, stream_id, payload, len);
+        case H2_PRIORITY:
+        {
+            //不做优先级调度，所有流轮转发送
+            if (stream_id == 0)
+                return connection_error(H2_PROTOCOL_ERROR);
+            if (len != 5)
+                reset_stream(stream_id, H2_FRAME_SIZE_ERROR);
+            return true;
+        }
+        case H2_RST_STREAM:
+        {
+            if (stream_id == 0 || stream_id > m_last_stream_id)
+                return connection_error(H2_PROTOCOL_ERROR);
+            if (len != 4)
+                return connection_error(H2_FRAME_SIZE_ERROR);
+            close_stream(stream_id);
+            return true;
+        }
+        case H2_SETTINGS:
+        {
+            if (stream_id != 0)
+                return connection_error(H2_PROTOCOL_ERROR);
+            if (flags & FLAG_ACK)
+                return len == 0 ? true : connection_error(H2_FRAME_SIZE_ERROR);
+            if (len % 6 != 0)
+                return connection_error(H2_FRAME_SIZE_ERROR);
+            H2_ERROR_CODE err = apply_settings(payload, len);
+            if (err != H2_NO_ERROR)
+                return connection_error(err);
+            write_frame_header(0, H2_SETTINGS, FLAG_ACK, 0);
+            return true;
+        }
+        case H2_PUSH_PROMISE:
+            return connection_error(H2_PROTOCOL_ERROR);     // 客户端不能推送
+        case H2_PING:
+        {
+            if (stream_id != 0)
+                return connection_error(H2_PROTOCOL_ERROR);
+            if (len != 8)
+                return connection_error(H2_FRAME_SIZE_ERROR);
+            if (!(flags & FLAG_ACK))
+            {
+                write_frame_header(8, H2_PING, FLAG_ACK, 0);
+                m_out.append((const char *)payload, 8);
+            }
+            return true;
+        }
+        case H2_GOAWAY:
+        {
+            if (stream_id != 0)
+                return connection_error(H2_PROTOCOL_ERROR);
+            m_goaway = true;
+            return true;
+        }
+        case H2_WINDOW_UPDATE:
+            return on_window_update(stream_id, payload, len);
+        case H2_CONTINUATION:
+        {
+            if (m_header_stream == 0)
+                return connection_error(H2_PROTOCOL_ERROR);
+            if (m_header_block.size() + len > MAX_HEADER_BLOCK)
+                return connection_error(H2_PROTOCOL_ERROR);
+            m_header_block.append((const char *)payload, len);
+            if (flags & FLAG_END_HEADERS)
+                return on_header_block(stream_id, m_header_end_stream);
+            return true;
+        }
+        default:
+            return true;    // 未知类型的帧必须忽略
+    }
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len)
+{
+    if (stream_id == 0)
+        return connection_error(H2_PROTOCOL_ERROR);
+
+    uint32_t pad = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1)
+            return connection_error(H2_FRAME_SIZE_ERROR);
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (flags & FLAG_PRIORITY)
+    {
+        if (len < 5)
+            return connection_error(H2_FRAME_SIZE_ERROR);
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len)
+        return connection_error(H2_PROTOCOL_ERROR);
+    len -= pad;
+
+    //新流的 ID 必须是奇数且单调递增；已存在的流上只可能是 trailer
+    if (m_streams.find(stream_id) == m_streams.end())
+    {
+        if (stream_id % 2 == 0 || stream_id <= m_last_stream_id)
+            return connection_error(H2_PROTOCOL_ERROR);
+        m_last_stream_id = stream_id;
+    }
+
+    m_header_block.assign((const char *)payload, len);
+    m_header_stream = stream_id;
+    m_header_end_stream = flags & FLAG_END_STREAM;
+    if (flags & FLAG_END_HEADERS)
+        return on_header_block(stream_id, m_header_end_stream);
+    return true;
+}
+
+bool h2_session::on_header_block(uint32_t stream_id, bool end_stream)
+{
+    m_header_stream = 0;
+
+    //即使随后拒绝该流，也必须解码头部块以保持 HPACK 动态表与对端一致
+    std::vector<hpack_field> fields;
+    bool ok = m_decoder.decode((const uint8_t *)m_header_block.data(), m_header_block.size(), fields);
+    m_header_block.clear();
+    if (!ok)
+        return connection_error(H2_COMPRESSION_ERROR);
+
+    auto it = m_streams.find(stream_id);
+    h2_stream *stream;
+    if (it == m_streams.end())
+    {
+        if (m_streams.size() >= MAX_CONCURRENT_STREAMS)
+        {
+            reset_stream(stream_id, H2_REFUSED_STREAM);
+            return true;
+        }
+        std::unique_ptr<h2_stream> created(new h2_stream);
+        created->id = stream_id;
+        created->send_window = m_peer_initial_window;
+        stream = created.get();
+        m_streams[stream_id] = std::move(created);
+
+        bool regular_seen = false;
+        for (const hpack_field &field : fields)
+        {
+            const std::string &name = field.first;
+            const std::string &value = field.second;
+            if (!name.empty() && name[0] == ':')
+            {
+                //伪头部必须位于普通头部之前
+                if (regular_seen)
+                    break;
+                if (name == ":method")
+                    stream->method = value;
+                else if (name == ":path")
+                    stream->path = value;
+                continue;
+            }
+            regular_seen = true;
+            if (name == "cookie")
+            {
+                //HTTP/2 允许把 Cookie 拆成多个头部，逐个查找
+                size_t sid_len;
+                const char *sid = find_cookie(value.data(), value.size(), "sid", &sid_len);
+                if (sid && !stream->session_valid)
+                    stream->session_valid = session_store::get_instance()->validate(sid, sid_len);
+            }
+            else if (name == "accept-encoding")
+                parse_accept_encoding(value.data(), value.size(), &stream->accept_gzip, &stream->accept_br);
+        }
+        if (stream->method.empty() || stream->path.empty() || stream->path[0] != '/')
+        {
+            reset_stream(stream_id, H2_PROTOCOL_ERROR);
+            close_stream(stream_id);
+            return true;
+        }
+        stream->headers = std::move(fields);
+    }
+    else
+    {
+        stream = it->second.get();
+        //请求已结束的流上不能再有头部；trailer 必须结束请求，其内容忽略
+        if (stream->request_done || !end_stream)
+        {
+            reset_stream(stream_id, stream->request_done ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR);
+            close_stream(stream_id);
+            return true;
+        }
+    }
+
+    if (end_stream)
+    {
+        stream->request_done = true;
+        dispatch(*stream);
+    }
+    return true;
+}
+
+bool h2_session::on_data(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len)
+{
+    if (stream_id == 0)
+        return connection_error(H2_PROTOCOL_ERROR);
+
+    //整个帧（含填充）都计入流量控制；请求体随到随消费，立即归还连接窗口
+    uint32_t frame_len = len;
+    if (frame_len > 0)
+        write_window_update(0, frame_len);
+
+    uint32_t pad = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1)
+            return connection_error(H2_FRAME_SIZE_ERROR);
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (pad > len)
+        return connection_error(H2_PROTOCOL_ERROR);
+    uint32_t data_len = len - pad;
+
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end())
+    {
+        if (stream_id > m_last_stream_id)
+            return connection_error(H2_PROTOCOL_ERROR);
+        return true;    // 已被重置或关闭的流，迟到的数据直接丢弃
+    }
+    h2_stream &stream = *it->second;
+    if (stream.request_done)
+    {
+        reset_stream(stream_id, H2_STREAM_CLOSED);
+        close_stream(stream_id);
+        return true;
+    }
+    if (stream.body.size() + data_len > MAX_BODY_SIZE)
+    {
+        reset_stream(stream_id, H2_CANCEL);
+        close_stream(stream_id);
+        return true;
+    }
+    stream.body.append((const char *)payload, data_len);
+
+    if (flags & FLAG_END_STREAM)
+    {
+        stream.request_done = true;
+        dispatch(stream);
+    }
+    else if (frame_len > 0)
+        write_window_update(stream_id, frame_len);
+    return true;
+}
+
+H2_ERROR_CODE h2_session::apply_settings(const uint8_t *payload, size_t len)
+{
+    for (size_t off = 0; off + 6 <= len; off += 6)
+    {
+        uint16_t id = ((uint16_t)payload[off] << 8) | payload[off + 1];
+        uint32_t value = read_u32(payload + off + 2);
+        switch (id)
+        {
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1)
+                    return H2_PROTOCOL_ERROR;
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if (value > MAX_WINDOW)
+                    return H2_FLOW_CONTROL_ERROR;
+                //初始窗口的变化量作用于所有已打开的流
+                int64_t delta = (int64_t)value - m_peer_initial_window;
+                for (auto &entry : m_streams)
+                {
+                    entry.second->send_window += delta;
+                    if (entry.second->send_window > MAX_WINDOW)
+                        return H2_FLOW_CONTROL_ERROR;
+                }
+                m_peer_initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < MAX_FRAME_SIZE || value > 0xffffff)
+                    return H2_PROTOCOL_ERROR;
+                m_peer_max_frame = value;
+                break;
+            default:
+                break;      // 其余设置（动态表大小、头部列表上限等）对本端的编码方式没有影响
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+bool h2_session::on_window_update(uint32_t stream_id, const uint8_t *payload, uint32_t len)
+{
+    if (len != 4)
+        return connection_error(H2_FRAME_SIZE_ERROR);
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+
+    if (stream_id == 0)
+    {
+        if (increment == 0)
+            return connection_error(H2_PROTOCOL_ERROR);
+        m_send_window += increment;
+        if (m_send_window > MAX_WINDOW)
+            return connection_error(H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end())
+        return stream_id > m_last_stream_id ? connection_error(H2_PROTOCOL_ERROR) : true;
+    h2_stream &stream = *it->second;
+    if (increment == 0 || stream.send_window + increment > MAX_WINDOW)
+    {
+        reset_stream(stream_id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+        close_stream(stream_id);
+        return true;
+    }
+    stream.send_window += increment;
+    return true;
+}
+
+void h2_session::dispatch(h2_stream &stream)
+{
+    m_on_request(stream);
+    if (!stream.deferred)
+        settle(stream);
+}
+
+bool h2_session::resume(uint32_t stream_id, const request_handler &respond_fn)
+{
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end() || !it->second->deferred)
+        return false;
+    h2_stream &stream = *it->second;
+    stream.deferred = false;
+    respond_fn(stream);
+    settle(stream);
+    return true;
+}
+
+//请求处理完毕：未给出响应时回复 500
+void h2_session::settle(h2_stream &stream)
+{
+    if (!stream.responded)
+    {
+        std::string block;
+        hpack_encode_status(block, 500);
+        respond(stream, block, NULL, 0);
+    }
+    //没有响应体的流在 HEADERS 帧上已经结束
+    if (stream.len == 0)
+        close_stream(stream.id);
+}
+
+void h2_session::respond(h2_stream &stream, const std::string &header_block, const char *body, size_t len)
+{
+    //头部块超过对端最大帧长时拆成 HEADERS + CONTINUATION
+    size_t off = 0;
+    bool first = true;
+    do
+    {
+        size_t n = header_block.size() - off;
+        if (n > m_peer_max_frame)
+            n = m_peer_max_frame;
+        uint8_t flags = 0;
+        if (first && len == 0)
+            flags |= FLAG_END_STREAM;
+        if (off + n == header_block.size())
+            flags |= FLAG_END_HEADERS;
+        write_frame_header(n, first ? H2_HEADERS : H2_CONTINUATION, flags, stream.id);
+        m_out.append(header_block, off, n);
+        off += n;
+        first = false;
+    } while (off < header_block.size());
+
+    stream.responded = true;
+    stream.data = body;
+    stream.len = len;
+    stream.sent = 0;
+}
+
+void h2_session::pump()
+{
+    //升级而来的连接在收到客户端前言之前只发送 101、SETTINGS 和响应头，避免客户端还没切换协议就被数据淹没
+    if (!m_preface_received)
+        return;
+
+    size_t budget = PUMP_BYTES;
+    bool progress = true;
+    std::vector<uint32_t> finished;
+
+    //每轮给每个有数据的流发一帧，直到窗口或本次预算用完
+    while (progress && budget > 0 && m_send_window > 0)
+    {
+        progress = false;
+        for (auto &entry : m_streams)
+        {
+            h2_stream &s = *entry.second;
+            if (!s.responded || s.sent >= s.len || s.send_window <= 0)
+                continue;
+            size_t n = s.len - s.sent;
+            if (n > m_peer_max_frame)
+                n = m_peer_max_frame;
+            if ((int64_t)n > s.send_window)
+                n = s.send_window;
+            if ((int64_t)n > m_send_window)
+                n = m_send_window;
+            if (n > budget)
+                n = budget;
+
+            bool last = s.sent + n == s.len;
+            write_frame_header(n, H2_DATA, last ? FLAG_END_STREAM : 0, s.id);
+            m_out.append(s.data + s.sent, n);
+            s.sent += n;
+            s.send_window -= n;
+            m_send_window -= n;
+            budget -= n;
+            progress = true;
+            if (last)
+                finished.push_back(s.id);
+            if (budget == 0 || m_send_window <= 0)
+                break;
+        }
+    }
+
+    for (uint32_t id : finished)
+    {
+        auto it = m_streams.find(id);
+        if (it != m_streams.end() && it->second->request_done)
+            m_streams.erase(it);
+    }
+}
+
+bool h2_session::has_pending_data() const
+{
+    for (const auto &entry : m_streams)
+    {
+        if (entry.second->deferred || (entry.second->responded && entry.second->sent < entry.second->len))
+            return true;
+    }
+    return false;
+}
+
+bool h2_session::has_deferred() const
+{
+    for (const auto &entry : m_streams)
+    {
+        if (entry.second->deferred)
+            return true;
+    }
+    return false;
+}
+
+void h2_session::write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    char head[9] = {(char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+                    (char)(stream_id >> 24), (char)(stream_id >> 16), (char)(stream_id >> 8), (char)stream_id};
+    m_out.append(head, 9);
+}
+
+void h2_session::write_window_update(uint32_t stream_id, uint32_t increment)
+{
+    write_frame_header(4, H2_WINDOW_UPDATE, 0, stream_id);
+    append_u32(m_out, increment);
+}
+
+void h2_session::reset_stream(uint32_t stream_id, H2_ERROR_CODE code)
+{
+    write_frame_header(4, H2_RST_STREAM, 0, stream_id);
+    append_u32(m_out, code);
+}
+
+bool h2_session::connection_error(H2_ERROR_CODE code)
+{
+    write_frame_header(8, H2_GOAWAY, 0, 0);
+    append_u32(m_out, m_last_stream_id);
+    append_u32(m_out, code);
+    m_goaway = true;
+    return false;
+}
+
+void h2_session::close_stream(uint32_t stream_id)
+{
+    m_streams.erase(stream_id);
+}
@@ -0,0 +1,163 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+
+#include "hpack.h"
+#include "static_cache.h"
+
+struct cached_response;
+
+// HTTP/2 明文连接（h2c，RFC 9113）的帧层：解析客户端帧、维护流状态和双向流量控制窗口，
+// 把响应编码成 HEADERS/DATA 帧放入输出缓冲。与 socket、epoll 无关，由 http_conn 负责收发字节。
+// 一个请求在收齐（END_STREAM）后交给构造时传入的回调处理，回调通过 respond() 给出响应，
+// 或调用 defer() 把请求交给异步任务，之后由连接的持有者通过 resume() 给出响应；
+// 响应体只保存指针，由 pump() 在流量控制窗口允许时分帧拷贝到输出缓冲，多个流轮转发送。
+
+enum H2_FRAME_TYPE
+{
+    H2_DATA = 0x0,
+    H2_HEADERS = 0x1,
+    H2_PRIORITY = 0x2,
+    H2_RST_STREAM = 0x3,
+    H2_SETTINGS = 0x4,
+    H2_PUSH_PROMISE = 0x5,
+    H2_PING = 0x6,
+    H2_GOAWAY = 0x7,
+    H2_WINDOW_UPDATE = 0x8,
+    H2_CONTINUATION = 0x9
+};
+
+enum H2_ERROR_CODE
+{
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED = 0x5,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_CANCEL = 0x8,
+    H2_COMPRESSION_ERROR = 0x9
+};
+
+// 一个请求/响应流
+struct h2_stream
+{
+    h2_stream() : id(0), request_done(false), responded(false), deferred(false), session_valid(false),
+                  accept_gzip(false), accept_br(false), send_window(0), data(NULL), len(0), sent(0),
+                  map(NULL), map_len(0) {}
+    ~h2_stream();
+    h2_stream(const h2_stream &) = delete;
+    h2_stream &operator=(const h2_stream &) = delete;
+
+    uint32_t id;
+    bool request_done;          // 已收到 END_STREAM，请求完整
+    bool responded;             // 已生成响应头
+    bool deferred;              // 请求已交给异步任务，响应稍后由 resume() 给出
+
+    // 请求（解码头部时即解析出会话和可接受的编码；原始头部保留在 headers 中，供反向代理转发）
+    std::string method;
+    std::string path;
+    std::vector<hpack_field> headers;
+    bool session_valid;         // Cookie 中携带有效会话
+    bool accept_gzip;
+    bool accept_br;
+    std::string body;
+
+    // 响应体，发送完毕前由下面之一保持有效
+    int64_t send_window;        // 本流的发送窗口
+    const char *data;
+    size_t len;
+    size_t sent;
+    std::shared_ptr<const static_entry> entry;  // 静态缓存条目
+    std::shared_ptr<const cached_response> cached;  // 反向代理的缓存条目
+    std::string owned;                          // 动态生成的内容
+    void *map;                                  // 未进缓存的大文件映射，流关闭时解除
+    size_t map_len;
+};
+
+class h2_session
+{
+public:
+    static const char PREFACE[];                        // 客户端连接前言
+    static const size_t PREFACE_LEN = 24;
+    static const uint32_t MAX_FRAME_SIZE = 16384;       // 本端接收的最大帧负载（协议默认值）
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100; // 本端允许的并发流数
+    static const int64_t DEFAULT_WINDOW = 65535;        // 协议规定的初始窗口
+    static const int64_t MAX_WINDOW = 0x7fffffff;
+    static const size_t MAX_HEADER_BLOCK = 64 << 10;    // 头部块（含 CONTINUATION）的最大长度
+    static const size_t MAX_BODY_SIZE = 8 << 20;        // 请求体最大长度
+    static const size_t PUMP_BYTES = 256 << 10;         // 每次 pump() 最多生成的 DATA 字节数
+
+    typedef std::function<void(h2_stream &)> request_handler;
+
+    explicit h2_session(request_handler on_request);
+
+    // 开始会话：写出本端 SETTINGS。由 HTTP/1.1 Upgrade 而来时先应用 HTTP2-Settings 头中的对端设置
+    bool start(const char *upgrade_settings = NULL);
+    // 由 HTTP/1.1 Upgrade 而来的请求作为流 1（请求已完整），随后立即交给回调处理
+    h2_stream *open_upgrade_stream();
+    // 把完整的请求交给回调，回调既未给出响应也未推迟时回复 500
+    void dispatch(h2_stream &stream);
+    // 推迟响应：只能在请求处理回调中调用，流保持打开直到 resume()
+    void defer(h2_stream &stream) { stream.deferred = true; }
+    // 异步任务完成后在推迟的流上调用 respond_fn 给出响应（未给出时回复 500）；
+    // 流已被对端重置、不再等待响应时不调用，返回 false
+    bool resume(uint32_t stream_id, const request_handler &respond_fn);
+
+    // 输入收到的字节（可以是不完整的帧），出现连接级错误时写出 GOAWAY 并返回 false
+    bool feed(const char *data, size_t len);
+
+    // 给出响应：header_block 为 HPACK 编码的完整头部块（含 :status），响应体指针需在流关闭前有效。
+    // 只能在请求处理回调或 resume() 的 respond_fn 中调用
+    void respond(h2_stream &stream, const std::string &header_block, const char *body, size_t len);
+
+    // 在流量控制窗口允许的范围内把待发送的响应体分帧写入输出缓冲
+    void pump();
+
+    const std::string &output() const { return m_out; }
+    void clear_output() { m_out.clear(); }
+    bool has_pending_data() const;      // 还有被流量控制挡住的响应体，或尚未给出的推迟响应
+    bool has_deferred() const;          // 还有尚未给出的推迟响应
+    bool closing() const { return m_goaway; }
+
+private:
+    bool process_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    bool on_headers(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    bool on_header_block(uint32_t stream_id, bool end_stream);
+    bool on_data(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    H2_ERROR_CODE apply_settings(const uint8_t *payload, size_t len);
+    bool on_window_update(uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    void write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id);
+    void write_window_update(uint32_t stream_id, uint32_t increment);
+    void reset_stream(uint32_t stream_id, H2_ERROR_CODE code);
+    bool connection_error(H2_ERROR_CODE code);
+    void close_stream(uint32_t stream_id);
+    void settle(h2_stream &stream);
+
+    request_handler m_on_request;
+    std::string m_in;                   // 尚未构成完整帧的输入
+    size_t m_in_pos;                    // m_in 中已处理的位置
+    std::string m_out;                  // 待发送的帧
+    bool m_preface_received;
+    bool m_goaway;                      // 已发出或收到 GOAWAY，输出发送完毕后关闭连接
+    hpack_decoder m_decoder;
+    std::map<uint32_t, std::unique_ptr<h2_stream>> m_streams;
+    uint32_t m_last_stream_id;          // 已处理的最大客户端流 ID
+
+    std::string m_header_block;         // 跨 CONTINUATION 累积的头部块
+    uint32_t m_header_stream;           // 正在接收头部块的流，0 表示没有
+    bool m_header_end_stream;
+
+    int64_t m_send_window;              // 连接级发送窗口
+    int64_t m_peer_initial_window;      // 对端 SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;          // 对端 SETTINGS_MAX_FRAME_SIZE
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "hpack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// RFC 7541 附录 A 静态表，下标从 1 开始
+static const struct
+{
+    const char *name;
+    const char *value;
+} STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+// RFC 7541 附录 B 中 257 个符号（含 EOS）的 Huffman 码长。
+// 该编码是规范 Huffman 编码：同一码长的码字按符号顺序连续递增，因此只凭码长就能还原解码表
+static const uint8_t HUFFMAN_CODE_LEN[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+static const int HUFFMAN_MAX_LEN = 30;
+static const int HUFFMAN_EOS = 256;
+
+// 规范 Huffman 解码表：每个码长的首个码字、码字个数和在有序符号表中的起始位置
+struct huffman_table
+{
+    uint32_t first[HUFFMAN_MAX_LEN + 1];
+    uint32_t count[HUFFMAN_MAX_LEN + 1];
+    uint32_t offset[HUFFMAN_MAX_LEN + 1];
+    uint16_t symbols[257];
+
+    huffman_table()
+    {
+        memset(count, 0, sizeof(count));
+        for (int s = 0; s < 257; ++s)
+            ++count[HUFFMAN_CODE_LEN[s]];
+
+        uint32_t code = 0, pos = 0;
+        for (int len = 1; len <= HUFFMAN_MAX_LEN; ++len)
+        {
+            first[len] = code;
+            offset[len] = pos;
+            pos += count[len];
+            code = (code + count[len]) << 1;
+        }
+
+        uint32_t fill[HUFFMAN_MAX_LEN + 1];
+        memcpy(fill, offset, sizeof(fill));
+        for (int s = 0; s < 257; ++s)
+            symbols[fill[HUFFMAN_CODE_LEN[s]]++] = s;
+    }
+};
+
+bool hpack_huffman_decode(const uint8_t *data, size_t len, std::string &out)
+{
+    static const huffman_table table;
+
+    uint32_t code = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (int shift = 7; shift >= 0; --shift)
+        {
+            code = (code << 1) | ((data[i] >> shift) & 1);
+            if (++bits > HUFFMAN_MAX_LEN)
+                return false;
+            //码长为 bits 的码字落在 [first, first + count) 内即命中，比它短的前缀都不会落入该区间
+            uint32_t index = code - table.first[bits];
+            if (index < table.count[bits])
+            {
+                int symbol = table.symbols[table.offset[bits] + index];
+                if (symbol == HUFFMAN_EOS)
+                    return false;
+                out.push_back((char)symbol);
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    //末尾的填充必须是 EOS 码字的前缀（全 1）且不超过 7 位
+    return bits <= 7 && code == (1u << bits) - 1;
+}
+
+static bool decode_int(const uint8_t *&p, const uint8_t *end, int prefix_bits, uint64_t &value)
+{
+    if (p >= end)
+        return false;
+    uint64_t mask = (1u << prefix_bits) - 1;
+    value = *p++ & mask;
+    if (value < mask)
+        return true;
+    for (int shift = 0; p < end && shift <= 56; shift += 7)
+    {
+        uint8_t b = *p++;
+        value += (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool decode_string(const uint8_t *&p, const uint8_t *end, std::string &out)
+{
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if (!decode_int(p, end, 7, len) || len > (uint64_t)(end - p))
+        return false;
+    out.clear();
+    if (huffman)
+    {
+        if (!hpack_huffman_decode(p, len, out))
+            return false;
+    }
+    else
+        out.assign((const char *)p, len);
+    p += len;
+    return out.size() <= hpack_decoder::MAX_STRING_LEN;
+}
+
+bool hpack_decoder::get_field(uint64_t index, hpack_field &field) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_SIZE)
+    {
+        field.first = STATIC_TABLE[index - 1].name;
+        field.second = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= m_table.size())
+        return false;
+    field = m_table[index];
+    return true;
+}
+
+void hpack_decoder::evict(size_t limit)
+{
+    while (m_size > limit && !m_table.empty())
+    {
+        const hpack_field &old = m_table.back();
+        m_size -= old.first.size() + old.second.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(const hpack_field &field)
+{
+    size_t size = field.first.size() + field.second.size() + 32;
+    //比整张表还大的条目会清空动态表，自身也不插入
+    if (size > m_max_size)
+    {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    m_table.push_front(field);
+    m_size += size;
+}
+
+bool hpack_decoder::decode(const uint8_t *data, size_t len, std::vector<hpack_field> &out)
+{
+    const uint8_t *p = data, *end = data + len;
+    bool update_allowed = true;     // 表大小更新只能出现在头部块开头
+    while (p < end)
+    {
+        uint8_t b = *p;
+        hpack_field field;
+        uint64_t index;
+        if (b & 0x80)
+        {
+            //已索引的头部字段
+            if (!decode_int(p, end, 7, index) || !get_field(index, field))
+                return false;
+        }
+        else if ((b & 0xe0) == 0x20)
+        {
+            //动态表大小更新
+            if (!update_allowed || !decode_int(p, end, 5, index) || index > DEFAULT_TABLE_SIZE)
+                return false;
+            m_max_size = index;
+            evict(m_max_size);
+            continue;
+        }
+        else
+        {
+            //字面量：带增量索引（01 前缀，6 位索引），或不索引/永不索引（0000/0001 前缀，4 位索引）
+            bool indexing = (b & 0xc0) == 0x40;
+            if (!decode_int(p, end, indexing ? 6 : 4, index))
+                return false;
+            if (index)
+            {
+                if (!get_field(index, field))
+                    return false;
+            }
+            else if (!decode_string(p, end, field.first))
+                return false;
+            if (!decode_string(p, end, field.second))
+                return false;
+            if (indexing)
+                insert(field);
+        }
+        update_allowed = false;
+        out.push_back(field);
+    }
+    return true;
+}
+
+static void encode_int(std::string &out, int prefix_bits, uint8_t flags, uint64_t value)
+{
+    uint64_t mask = (1u << prefix_bits) - 1;
+    if (value < mask)
+    {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | mask));
+    value -= mask;
+    while (value >= 0x80)
+    {
+        out.push_back((char)(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static void encode_string(std::string &out, const char *str, size_t len)
+{
+    encode_int(out, 7, 0x00, len);
+    out.append(str, len);
+}
+
+void hpack_encode_status(std::string &out, int status)
+{
+    int index = 0;
+    switch (status)
+    {
+        case 200: index = 8; break;
+        case 204: index = 9; break;
+        case 206: index = 10; break;
+        case 304: index = 11; break;
+        case 400: index = 12; break;
+        case 404: index = 13; break;
+        case 500: index = 14; break;
+        default: break;
+    }
+    if (index)
+    {
+        encode_int(out, 7, 0x80, index);
+        return;
+    }
+    char value[4];
+    int len = snprintf(value, sizeof(value), "%03d", status);
+    encode_int(out, 4, 0x00, 8);
+    encode_string(out, value, len);
+}
+
+void hpack_encode_header(std::string &out, const char *name, const char *value, size_t value_len)
+{
+    size_t index = 0;
+    for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i)
+    {
+        if (strcmp(STATIC_TABLE[i].name, name) == 0)
+        {
+            index = i + 1;
+            break;
+        }
+    }
+    if (index)
+        encode_int(out, 4, 0x00, index);
+    else
+    {
+        out.push_back(0x00);
+        encode_string(out, name, strlen(name));
+    }
+    encode_string(out, value, value_len);
+}
@@ -0,0 +1,48 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <utility>
+
+// HPACK（RFC 7541）头部压缩。
+// 解码端完整实现静态表、动态表、表大小更新和 Huffman 解码；
+// 编码端只输出“不索引的字面量”（名字尽量引用静态表），不使用动态表也不做 Huffman 编码，
+// 因此无需跟随对端的 SETTINGS_HEADER_TABLE_SIZE。
+
+typedef std::pair<std::string, std::string> hpack_field;
+
+class hpack_decoder
+{
+public:
+    static const size_t DEFAULT_TABLE_SIZE = 4096;  // 本端通告的 SETTINGS_HEADER_TABLE_SIZE（使用默认值）
+    static const size_t MAX_STRING_LEN = 8192;      // 单个名字/值解码后的长度上限
+
+    hpack_decoder() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE) {}
+
+    // 解码一个完整的头部块，失败（格式错误、索引越界等）时返回 false，属于连接级 COMPRESSION_ERROR
+    bool decode(const uint8_t *data, size_t len, std::vector<hpack_field> &out);
+
+private:
+    bool get_field(uint64_t index, hpack_field &field) const;
+    void insert(const hpack_field &field);
+    void evict(size_t limit);
+
+    std::deque<hpack_field> m_table;    // 动态表，表头为最新插入的条目
+    size_t m_size;                      // 动态表当前大小（每个条目按名字长度+值长度+32 计）
+    size_t m_max_size;                  // 动态表大小上限，由表大小更新指令调整
+};
+
+// 解码 Huffman 编码的字符串，填充不合法（超过 7 位或不全为 1）或出现 EOS 时返回 false
+bool hpack_huffman_decode(const uint8_t *data, size_t len, std::string &out);
+
+// 编码 :status 伪头部，常见状态码直接引用静态表
+void hpack_encode_status(std::string &out, int status);
+
+// 以“不索引的字面量”编码一个头部，名字须为小写
+void hpack_encode_header(std::string &out, const char *name, const char *value, size_t value_len);
+
+#endif
@@ -1,6 +1,15 @@
 #include "http_conn.h"
+#include "http_scan.h"
+#include "ws_hub.h"
+#include "../auth/password_hasher.h"
+#include "../auth/verify_cache.h"
+#include "../proxy/upstream.h"
+#include "../threadpool/threadpool.h"
 
 #include <mysql/mysql.h>
+#include <openssl/err.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <fstream>
 #include <mutex>
 
@@ -14,12 +23,67 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body is larger than the server is willing to process.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is busy, please retry later.\n";
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "Too many requests from your address, please slow down.\n";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server is unavailable or sent an invalid response.\n";
+const char *error_504_title = "Gateway Timeout";
+const char *error_504_form = "The upstream server did not respond in time.\n";
 
 std::mutex m_lock;
-std::map<std::string, std::string> users;
+std::map<std::string, std::string> users;   // 用户名 -> 口令散列（旧数据可能仍是明文）
+connection_pool *sql_pool = NULL;           // 校验线程池执行注册/口令升级时使用的数据库连接池
+
+//对用户名做 SQL 转义，散列串只含 [./0-9A-Za-z$]，无需转义
+static std::string escape_sql(MYSQL *mysql, const std::string &str)
+{
+    std::string out(str.size() * 2 + 1, '\0');
+    unsigned long len = mysql_real_escape_string(mysql, &out[0], str.c_str(), str.size());
+    out.resize(len);
+    return out;
+}
+
+//从 "user=xxx&password=yyy" 形式的请求体中取出用户名和口令
+static bool parse_credentials(const char *body, long len, char *name, char *password)
+{
+    long i;
+    for (i = 5; i < len && body[i] != '&' && i - 5 < 99; ++i)
+        name[i - 5] = body[i];
+    name[i - 5] = '\0';
+    if (i >= len || body[i] != '&')
+        return false;
+
+    int j = 0;
+    for (i = i + 10; i < len && j < 99; ++i, ++j)
+        password[j] = body[i];
+    password[j] = '\0';
+    return true;
+}
+
+//Date 头的值只精确到秒，每个线程每秒格式化一次
+static const char *http_date()
+{
+    static thread_local time_t cached_sec = 0;
+    static thread_local char cached_date[40];
+    time_t now = time(NULL);
+    if (now != cached_sec)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(cached_date, sizeof(cached_date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        cached_sec = now;
+    }
+    return cached_date;
+}
 
 void http_conn::initmysql_result(connection_pool *connPool)
 {
+    sql_pool = connPool;
+
     //先从连接池中取一个连接
     MYSQL *mysql = nullptr;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -96,7 +160,17 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 }
 
 int http_conn::m_user_count = 0;
+std::atomic<unsigned long> http_conn::m_shed_count(0);
+std::atomic<bool> http_conn::m_draining(false);
+int http_conn::m_read_buffer_size = READ_BUFFER_SIZE;
+std::atomic<int> http_conn::m_header_timeout(HEADER_TIMEOUT);
+std::atomic<int> http_conn::m_body_timeout(BODY_TIMEOUT);
+std::atomic<int> http_conn::m_write_timeout(WRITE_TIMEOUT);
+std::atomic<int> http_conn::m_keepalive_timeout(KEEPALIVE_TIMEOUT);
+std::atomic<int> http_conn::m_min_rate(MIN_RATE);
 int http_conn::m_epollfd = -1;
+verify_pool *http_conn::m_verify_pool = NULL;
+threadpool<http_conn> *http_conn::m_threadpool = NULL;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -104,9 +178,17 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        if (m_ws)
+        {
+            ws_hub::get_instance()->unsubscribe(m_sockfd);
+            m_ws.reset();
+        }
+        proxy_abort();
+        tls_free(true);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        ip_limiter::get_instance()->release(m_address.sin_addr.s_addr);
     }
 }
 
@@ -114,29 +196,51 @@ void http_conn::close_conn(bool real_close)
 void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
                      int close_log, std::string user, std::string passwd, std::string sqlname)
 {
+    //只分配实际用到的连接对象的缓冲区，由主线程首次写入，与连接对象位于同一节点
+    if (!m_read_buf)
+        m_read_buf = new char[m_read_buffer_size];
     m_sockfd = sockfd;
+    m_conn_gen++;
     m_address = addr;
     m_TRIGMode = TRIGMode;
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
+    m_h2.reset();
+    m_h2_results.clear();
+    m_h2_parked = false;
+    m_ws.reset();
+    proxy_abort();
+    m_lane = LANE_FAST;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
     m_close_log = close_log;
 
+    //上一个使用该描述符的连接可能已由定时器直接关闭，遗留的 SSL 对象在这里释放
+    tls_free(false);
+    m_ktls_send = false;
+    m_tls_ready = !tls_context::get_instance()->enabled();
+    if (!m_tls_ready)
+    {
+        m_ssl = tls_context::get_instance()->create(sockfd);
+        if (!m_ssl)
+            LOG_ERROR("%s", "create SSL object failed");
+    }
+
     strcpy(sql_user, user.c_str());
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
     init();
+    //新连接从 accept 起计请求头期限（TLS 握手也在其中）
+    set_phase(PHASE_HEADER);
 }
 
 //初始化新接受的连接
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -145,69 +249,192 @@ void http_conn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_header_count = 0;
+    m_body_start = 0;
+    m_body_remaining = 0;
+    m_session_valid = false;
+    m_session_token[0] = '\0';
     m_host = 0;
     m_start_line = 0;
+    m_header_start = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
+    m_file_address = 0;
+    m_static_body = NULL;
+    m_cached.reset();
+    m_accept_gzip = false;
+    m_accept_br = false;
+    m_upgrade_h2c = false;
+    m_http2_settings = 0;
+    m_upgrade_ws = false;
+    m_ws_key = 0;
+    m_ws_version = 0;
+    m_ws_accept.clear();
+    m_chunked = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_stream_sent = 0;
+    //大请求体/大响应用过的缓冲区不长期占用，普通大小的保留容量供下一个请求复用
+    if (m_body.capacity() > (size_t)m_read_buffer_size)
+        std::string().swap(m_body);
+    else
+        m_body.clear();
+    if (m_dynamic_body.capacity() > WRITE_BUFFER_SIZE)
+        std::string().swap(m_dynamic_body);
+    else
+        m_dynamic_body.clear();
     m_state = 0;
     timer_flag = 0;
     improv = 0;
+    set_phase(PHASE_IDLE);
+
+    //缓冲区中的内容都以 m_read_idx/m_write_idx 为界访问，无需每个请求清零整块缓冲区
+    m_read_buf[0] = '\0';
+    m_write_buf[0] = '\0';
+    m_real_file[0] = '\0';
+}
+
+//长连接上一个请求处理完毕：保留缓冲区中已经读到的下一个（流水线）请求，其余状态复位
+void http_conn::keep_alive_reset()
+{
+    long consumed = m_checked_idx;
+    long leftover = m_read_idx - consumed;
+    init();
+    if (leftover > 0)
+    {
+        memmove(m_read_buf, m_read_buf + consumed, leftover);
+        m_read_idx = leftover;
+        //下一个请求已有部分字节到达，直接开始计请求头期限
+        set_phase(PHASE_HEADER);
+    }
+}
+
+//进入新阶段，截止时间从此刻重新计算
+void http_conn::set_phase(PHASE phase)
+{
+    m_phase_start.store(time(NULL), std::memory_order_relaxed);
+    m_phase_bytes.store(0, std::memory_order_relaxed);
+    m_phase.store(phase, std::memory_order_release);
+}
+
+//登录注册（散列计算、数据库）和反向代理（同步等待上游）归入慢车道
+http_conn::LANE http_conn::route_lane(const route *r, bool proxied)
+{
+    if (r)
+        return (r->handler == ROUTE_LOGIN || r->handler == ROUTE_REGISTER) ? LANE_SLOW : LANE_FAST;
+    return proxied ? LANE_SLOW : LANE_FAST;
+}
+
+//主线程入队时调用。请求行已经读入（proactor 模式、流水线请求）时按路由预先分类；
+//尚未读取（reactor 模式的读事件）、请求行不完整或是 HTTP/2 连接时，沿用该连接上一个请求的分类
+int http_conn::lane()
+{
+    if (!m_tls_ready || m_h2 || m_ws || m_check_state != CHECK_STATE_REQUESTLINE)
+        return m_lane;
+    const char *line = m_read_buf + m_start_line;
+    const char *end = m_read_buf + m_read_idx;
+    unsigned method;
+    if (end - line > 4 && memcmp(line, "GET ", 4) == 0)
+        method = 1u << GET;
+    else if (end - line > 5 && memcmp(line, "POST ", 5) == 0)
+        method = 1u << POST;
+    else
+        return m_lane;
+    const char *path = (const char *)memchr(line, ' ', end - line) + 1;
+    const char *path_end = (const char *)memchr(path, ' ', end - path);
+    if (!path_end || *path != '/')
+        return m_lane;
+    size_t len = path_end - path;
+    const route *r = find_route(method, path, len);
+    m_lane = route_lane(r, !r && upstream_table::get_instance()->match(path, len));
+    return m_lane;
+}
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+void http_conn::set_timeouts(int header, int body, int write, int keepalive, int min_rate)
+{
+    m_header_timeout.store(header, std::memory_order_relaxed);
+    m_body_timeout.store(body, std::memory_order_relaxed);
+    m_write_timeout.store(write, std::memory_order_relaxed);
+    m_keepalive_timeout.store(keepalive, std::memory_order_relaxed);
+    m_min_rate.store(min_rate > 0 ? min_rate : 1, std::memory_order_relaxed);
+}
+
+//请求头期限从第一个字节起算，之后收到数据也不顺延，逐字节慢速发送请求头的连接到期即被回收；
+//请求体和响应按已传输的字节数顺延，低于最低速率的慢速收发同样到期回收
+time_t http_conn::deadline() const
+{
+    if (m_ws)
+        return 0;
+    int phase = m_phase.load(std::memory_order_acquire);
+    time_t start = m_phase_start.load(std::memory_order_relaxed);
+    size_t bytes = m_phase_bytes.load(std::memory_order_relaxed);
+    int min_rate = m_min_rate.load(std::memory_order_relaxed);
+    switch (phase)
+    {
+        case PHASE_IDLE:
+            return start + m_keepalive_timeout.load(std::memory_order_relaxed);
+        case PHASE_HEADER:
+            return start + m_header_timeout.load(std::memory_order_relaxed);
+        case PHASE_BODY:
+            return start + m_body_timeout.load(std::memory_order_relaxed) + bytes / min_rate;
+        case PHASE_WRITE:
+        default:
+            return start + m_write_timeout.load(std::memory_order_relaxed) + bytes / min_rate;
+    }
 }
 
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    //按 16/32 字节步长定位下一个行结束符，而不是逐字节比较
+    const char *end = m_read_buf + m_read_idx;
+    const char *pos = find_line_end(m_read_buf + m_checked_idx, end);
+    m_checked_idx = pos - m_read_buf;
+    if (pos == end)
+        return LINE_OPEN;
+
+    if (*pos == '\r')
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
-        {
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        else if (temp == '\n')
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
+    }
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
     }
-    return LINE_OPEN;
+    return LINE_BAD;
 }
 
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    if (m_h2)
+        h2_unpark();
+    if (m_read_idx >= m_read_buffer_size)
     {
         return false;
     }
+    //TLS 握手尚未完成，由工作线程在 process() 中推进
+    if (!m_tls_ready)
+        return true;
     int bytes_read = 0;
 
     //LT读取数据
-    if (0 == m_TRIGMode)
+    if (0 == m_TRIGMode && !m_ssl)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx, 0);
         m_read_idx += bytes_read;
 
         if (bytes_read <= 0)
@@ -215,14 +442,17 @@ bool http_conn::read_once()
             return false;
         }
 
+        received(bytes_read);
         return true;
     }
-    //ET读数据
+    //ET读数据；TLS 连接在两种模式下都读到没有数据为止，一次 SSL_read 最多只取出一条记录
     else
     {
-        while (true)
+        //缓冲区满时先停止读取，剩余数据留在内核中，处理完请求体回收缓冲区后重新注册读事件时会再次触发
+        //（TLS 连接已解密的剩余数据留在 OpenSSL 中，不会再触发读事件，由 has_buffered_request() 等处直接接着读）
+        while (m_read_idx < m_read_buffer_size)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            bytes_read = sock_read(m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx);
             if (bytes_read == -1)
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -234,11 +464,21 @@ bool http_conn::read_once()
                 return false;
             }
             m_read_idx += bytes_read;
+            received(bytes_read);
         }
         return true;
     }
 }
 
+//空闲的长连接收到下一个请求的第一个字节时开始计请求头期限，读取请求体时累计字节数
+void http_conn::received(size_t n)
+{
+    if (m_phase.load(std::memory_order_relaxed) == PHASE_IDLE)
+        set_phase(PHASE_HEADER);
+    else
+        m_phase_bytes.fetch_add(n, std::memory_order_relaxed);
+}
+
 //解析http请求行，获得请求方法，目标url及http版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 {
@@ -280,9 +520,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
+    m_header_start = m_checked_idx;
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
@@ -292,52 +530,232 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     if (text[0] == '\0')
     {
+        //同时出现 Transfer-Encoding 和 Content-Length 时以分块编码为准
+        if (m_chunked)
+        {
+            m_body_start = m_checked_idx;
+            m_chunk_state = CHUNK_SIZE;
+            m_check_state = CHECK_STATE_CONTENT;
+            set_phase(PHASE_BODY);
+            return NO_REQUEST;
+        }
         if (m_content_length != 0)
         {
+            if (m_content_length < 0)
+                return BAD_REQUEST;
+            if (m_content_length > MAX_BODY_SIZE)
+                return ENTITY_TOO_LARGE;
+            m_body_start = m_checked_idx;
+            m_body_remaining = m_content_length;
+            //声明的长度只是客户端的一面之词：预留量不超过读缓冲区大小，其余随数据到达按需增长，
+            //只发请求头不发请求体的连接不会占用 MAX_BODY_SIZE 大小的内存
+            m_body.reserve(m_content_length < m_read_buffer_size ? m_content_length : m_read_buffer_size);
             m_check_state = CHECK_STATE_CONTENT;
+            set_phase(PHASE_BODY);
             return NO_REQUEST;
         }
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+
+    if (++m_header_count > MAX_HEADER_COUNT)
+        return BAD_REQUEST;
+
+    char *colon = strchr(text, ':');
+    if (!colon)
+        return NO_REQUEST;
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+
+    //通过预计算的头部哈希表识别，未识别的头部直接忽略
+    switch (lookup_header(text, colon - text))
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        case HEADER_CONNECTION:
         {
-            m_linger = true;
+            if (strcasecmp(value, "keep-alive") == 0)
+                m_linger = true;
+            break;
         }
-    }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }
-    else if (strncasecmp(text, "Host:", 5) == 0)
-    {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
-    else
-    {
-        LOG_INFO("oop!unknow header: %s", text);
+        case HEADER_CONTENT_LENGTH:
+        {
+            m_content_length = atol(value);
+            break;
+        }
+        case HEADER_HOST:
+        {
+            m_host = value;
+            break;
+        }
+        case HEADER_COOKIE:
+        {
+            parse_cookie(value);
+            break;
+        }
+        case HEADER_ACCEPT_ENCODING:
+        {
+            parse_accept_encoding(value, strlen(value), &m_accept_gzip, &m_accept_br);
+            break;
+        }
+        case HEADER_UPGRADE:
+        {
+            //只识别 h2c 和 websocket，其它协议升级请求按普通请求处理
+            for (char *tok = value; *tok; )
+            {
+                tok += strspn(tok, " \t,");
+                size_t len = strcspn(tok, " \t,");
+                if (len == 3 && strncasecmp(tok, "h2c", 3) == 0)
+                    m_upgrade_h2c = true;
+                else if (len == 9 && strncasecmp(tok, "websocket", 9) == 0)
+                    m_upgrade_ws = true;
+                tok += len;
+            }
+            break;
+        }
+        case HEADER_SEC_WEBSOCKET_KEY:
+        {
+            m_ws_key = value;
+            break;
+        }
+        case HEADER_SEC_WEBSOCKET_VERSION:
+        {
+            m_ws_version = atoi(value);
+            break;
+        }
+        case HEADER_HTTP2_SETTINGS:
+        {
+            m_http2_settings = value;
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING:
+        {
+            //只支持 chunked（可位于编码列表末尾），其余传输编码无法确定请求体边界
+            size_t len = strlen(value);
+            while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+                --len;
+            if (len < 7 || strncasecmp(value + len - 7, "chunked", 7) != 0)
+                return BAD_REQUEST;
+            m_chunked = true;
+            break;
+        }
+        default:
+            break;
     }
     return NO_REQUEST;
 }
 
-//判断http请求是否被完整读入
+//从 Cookie 头中取出 sid 并到会话表校验
+void http_conn::parse_cookie(char *text)
+{
+    size_t len;
+    const char *sid = find_cookie(text, strlen(text), "sid", &len);
+    if (sid)
+        m_session_valid = session_store::get_instance()->validate(sid, len);
+}
+
+//读取定长请求体：把已到达的部分转存到 m_body 并回收读缓冲区
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    long n = m_read_idx - m_checked_idx;
+    if (n > m_body_remaining)
+        n = m_body_remaining;
+    m_body.append(text, n);
+    m_checked_idx += n;
+    m_start_line = m_checked_idx;
+    m_body_remaining -= n;
+
+    if (m_body_remaining > 0)
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST;
+        compact_body();
+        return NO_REQUEST;
     }
-    return NO_REQUEST;
+    return GET_REQUEST;
+}
+
+//解码分块传输编码的请求体，可跨多次读取逐步推进
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    while (true)
+    {
+        switch (m_chunk_state)
+        {
+            case CHUNK_SIZE:
+            case CHUNK_DATA_END:
+            case CHUNK_TRAILER:
+            {
+                LINE_STATUS line_status = parse_line();
+                if (line_status == LINE_BAD)
+                    return BAD_REQUEST;
+                if (line_status == LINE_OPEN)
+                {
+                    compact_body();
+                    return NO_REQUEST;
+                }
+                char *text = get_line();
+                m_start_line = m_checked_idx;
+
+                if (m_chunk_state == CHUNK_DATA_END)
+                {
+                    if (text[0] != '\0')
+                        return BAD_REQUEST;
+                    m_chunk_state = CHUNK_SIZE;
+                }
+                else if (m_chunk_state == CHUNK_TRAILER)
+                {
+                    //trailer 头部直接忽略，空行表示请求结束
+                    if (text[0] == '\0')
+                        return GET_REQUEST;
+                }
+                else
+                {
+                    char *end = NULL;
+                    long size = strtol(text, &end, 16);
+                    if (end == text || size < 0 || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+                        return BAD_REQUEST;
+                    if (size > MAX_BODY_SIZE - (long)m_body.size())
+                        return ENTITY_TOO_LARGE;
+                    if (size == 0)
+                        m_chunk_state = CHUNK_TRAILER;
+                    else
+                    {
+                        m_body_remaining = size;
+                        m_chunk_state = CHUNK_DATA;
+                    }
+                }
+                break;
+            }
+            case CHUNK_DATA:
+            {
+                long n = m_read_idx - m_checked_idx;
+                if (n > m_body_remaining)
+                    n = m_body_remaining;
+                m_body.append(m_read_buf + m_checked_idx, n);
+                m_checked_idx += n;
+                m_start_line = m_checked_idx;
+                m_body_remaining -= n;
+                if (m_body_remaining > 0)
+                {
+                    compact_body();
+                    return NO_REQUEST;
+                }
+                m_chunk_state = CHUNK_DATA_END;
+                break;
+            }
+        }
+    }
+}
+
+//请求体已转存到 m_body：把尚未消费的残留字节（如不完整的分块长度行）移到请求体起始处，
+//让出读缓冲区继续接收，请求行和头部所在区域保持不动
+void http_conn::compact_body()
+{
+    long pending = m_read_idx - m_start_line;
+    long shift = m_start_line - m_body_start;
+    if (shift <= 0)
+        return;
+    if (pending > 0)
+        memmove(m_read_buf + m_body_start, m_read_buf + m_start_line, pending);
+    m_checked_idx -= shift;
+    m_start_line = m_body_start;
+    m_read_idx = m_body_start + pending;
 }
 
 http_conn::HTTP_CODE http_conn::process_read()
@@ -346,13 +764,12 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;             // 初始化返回值为 NO_REQUEST，表示没有完整的请求
     char *text = 0;                         // 用于存储每一行的文本
 
-    // 用于不断读取和解析 HTTP 请求的每一行
-    // 当检查状态为 CONTENT（处理请求体）并且行状态为 LINE_OK，或者检查下一行的状态为 LINE_OK 时继续
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
+    // 解析进度（m_checked_idx、m_check_state、m_header_count、m_body_remaining）都保存在连接对象中，
+    // 报文分多个 TCP 段到达时，每次只从上次停下的位置继续扫描，总代价与报文长度成线性关系
+    while (m_check_state != CHECK_STATE_CONTENT && (line_status = parse_line()) == LINE_OK)
     {
         text = get_line();                  // 获取一行文本
-        m_start_line = m_checked_idx;       // 记录行的起始位置
-        LOG_INFO("%s", text);               // 日志记录获取的行文本
+        m_start_line = m_checked_idx;       // 记录下一行的起始位置
 
         switch (m_check_state)
         {
@@ -377,214 +794,894 @@ http_conn::HTTP_CODE http_conn::process_read()
                 }
                 break;
             }
-            // 处理请求体
-            case CHECK_STATE_CONTENT:
-            {
-                ret = parse_content(text);
-                if (ret == GET_REQUEST)
-                    return do_request();
-                line_status = LINE_OPEN;        // 标记为未完成的行状态
-                break;
-            }
             default:    // 如果检查状态不合法，返回 500 错误
                 return INTERNAL_ERROR;
         }
     }
+    if (line_status == LINE_BAD)
+        return BAD_REQUEST;
+
+    // 处理请求体：只需比较已到达的字节数，不再逐行扫描
+    if (m_check_state == CHECK_STATE_CONTENT)
+    {
+        ret = m_chunked ? parse_chunked() : parse_content(m_read_buf + m_checked_idx);
+        if (ret == GET_REQUEST)
+            return do_request();
+        return ret;
+    }
     return NO_REQUEST;
 }
 
+//按路由表分派请求，未命中路由的按反向代理前缀匹配，再未命中的按静态文件处理
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
-
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                std::lock_guard<std::mutex> lock(m_lock);
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(std::pair<std::string, std::string>(name, password));
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
+    //请求已收齐：处理（可能同步等待上游）和发送响应共用发送期限
+    set_phase(PHASE_WRITE);
+    //排空中的进程不再保持长连接，客户端的下一个请求发往新进程
+    if (m_draining.load(std::memory_order_relaxed))
+        m_linger = false;
+
+    //按客户端地址限速，超出时回复 429
+    if (!ip_limiter::get_instance()->allow(m_address.sin_addr.s_addr))
+        return TOO_MANY_REQUESTS;
+
+    //h2c 升级只接受不带请求体的请求，且必须同时给出 HTTP2-Settings
+    //h2c 只用于明文连接，TLS 连接通过 ALPN 协商 h2
+    if (m_upgrade_h2c && m_http2_settings && m_method == GET && m_body.empty() && !m_ssl)
+        return H2_UPGRADE;
+
+    //"//welcome.html"、"/./welcome.html" 与 "/welcome.html" 按同一路径查找路由和检查会话
+    m_url[normalize_path(m_url, strlen(m_url))] = '\0';
+    const route *r = find_route(1u << m_method, m_url, strlen(m_url));
+    upstream_pool *pool = r ? NULL : upstream_table::get_instance()->match(m_url, strlen(m_url));
+    //reactor 模式下该连接的下一个读事件按本次请求的分类入队
+    m_lane = route_lane(r, pool);
+    if (!r)
+        return pool ? do_proxy(pool) : map_file(m_url);
+
+    //需要登录的接口，未携带有效会话时改为返回登录页
+    if (r->need_session && !m_session_valid)
+        return map_file("/log.html");
+
+    switch (r->handler)
+    {
+        case ROUTE_LOGIN:
+            return do_verify(true);
+        case ROUTE_REGISTER:
+            return do_verify(false);
+        case ROUTE_METRICS:
+            return do_metrics();
+        case ROUTE_WEBSOCKET:
+            return do_websocket();
+        case ROUTE_STATIC:
+        default:
+            return map_file(r->file ? r->file : m_url);
     }
+}
 
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//登录/注册：提取用户名和口令后交给校验线程池
+http_conn::HTTP_CODE http_conn::do_verify(bool is_login)
+{
+    //将用户名和密码提取出来
+    //user=123&password=123
+    char name[100], password[100];
+    if (!parse_credentials(m_body.data(), m_body.size(), name, password))
+        return BAD_REQUEST;
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '1')
+    //登录时先查已校验缓存，命中则无需再做散列计算
+    if (is_login && verify_cache::get_instance()->lookup(name, password))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        std::string session = session_store::get_instance()->create(name);
+        strcpy(m_session_token, session.c_str());
+        m_session_valid = !session.empty();
+        return map_file("/welcome.html");
     }
-    else if (*(p + 1) == '5')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '6')
+    //否则把散列计算和数据库写入交给独立的校验线程池，不占用处理静态请求的工作线程
+    bool rejected = false;
+    coro_spawn(verify_async(is_login, name, password, &rejected));
+    if (rejected)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        LOG_WARN("verify pool is saturated, reject %s", is_login ? "login" : "register");
+        return SERVICE_UNAVAILABLE;
     }
-    else if (*(p + 1) == '7')
+    return ASYNC_REQUEST;
+}
+
+//在工作线程中启动，co_await 把校验交给校验线程池后挂起，之后在校验线程中继续，生成响应前再转到主线程。
+//mysqlclient 只有阻塞接口，查询仍需占用一个校验线程；校验线程池已满时不挂起，经 rejected 告知调用方
+coro_task<void> http_conn::verify_async(bool is_login, std::string name, std::string password, bool *rejected)
+{
+    int sockfd = m_sockfd;
+    unsigned int conn_gen = m_conn_gen;
+    std::optional<const char *> url = co_await coro_offload(m_verify_pool, [this, is_login, &name, &password]() {
+        return is_login ? verify_login(name, password) : register_user(name, password);
+    });
+    if (!url)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        *rejected = true;
+        co_return;
+    }
+    //登录成功时签发会话
+    std::string session;
+    if (is_login && strcmp(*url, "/welcome.html") == 0)
+        session = session_store::get_instance()->create(name);
+    //定时器在主线程中关闭和复用连接，转到主线程后再判断连接是否仍有效、写入连接状态
+    co_await coro_loop::get_instance()->schedule();
+    finish_async(sockfd, conn_gen, *url, session);
+}
+
+//运行指标，纯文本格式，每行一个 "名称 值"；以分块编码流式输出，先写出的部分立即发送
+http_conn::HTTP_CODE http_conn::do_metrics()
+{
+    begin_chunked(200, ok_200_title, "text/plain");
+    std::string text = metrics_text();
+    add_chunk(text.data(), text.size());
+    flush_chunked();
+    end_chunked();
+    return DYNAMIC_REQUEST;
+}
+
+//WebSocket 握手（RFC 6455 4.2.1）：校验升级请求并计算 Sec-WebSocket-Accept，由 process_write 回复 101
+http_conn::HTTP_CODE http_conn::do_websocket()
+{
+    //key 是 16 字节随机数的 base64，固定 24 个字符
+    if (!m_upgrade_ws || !m_ws_key || strcspn(m_ws_key, " \t") != 24 || m_ws_version != 13 || !m_body.empty())
+        return BAD_REQUEST;
+    m_ws_accept = ws_accept_key(m_ws_key, 24);
+    return WS_UPGRADE;
+}
 
-        free(m_url_real);
+//请求头在读缓冲区中逐行以 "\0\0" 结尾，遇到空行结束
+relay_headers http_conn::request_headers()
+{
+    relay_headers headers;
+    for (char *line = m_read_buf + m_header_start; *line; )
+    {
+        size_t len = strlen(line);
+        char *colon = (char *)memchr(line, ':', len);
+        if (colon)
+        {
+            char *value = colon + 1;
+            value += strspn(value, " \t");
+            size_t value_len = line + len - value;
+            while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+                --value_len;
+            headers.emplace_back(std::string(line, colon - line), std::string(value, value_len));
+        }
+        line += len + 2;
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    return headers;
+}
 
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
+//转发给上游的请求头
+std::string http_conn::proxy_head(const char *method, const std::string &path, const relay_headers &headers,
+                                  size_t body_len)
+{
+    relay_request request(method, path.data(), path.size());
+    for (const auto &h : headers)
+        request.add_header(h.first.data(), h.first.size(), h.second.data(), h.second.size());
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    return request.finish(ip, m_ssl != NULL, body_len);
+}
 
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
+//先查响应缓存：命中时 cached 返回缓存条目，过期条目交给主线程上的协程在后台重新获取。
+//head 返回转发给上游的请求头，key 和 x_cache 返回缓存键和 X-Cache 头的取值；waited 表示已等过同一 key 的获取
+CACHE_STATUS http_conn::proxy_lookup(upstream_pool *pool, const char *method, const std::string &path,
+                                     const relay_headers &headers, const std::string &body, std::string &head,
+                                     std::string &key, std::shared_ptr<const cached_response> &cached,
+                                     const char *&x_cache, bool waited)
+{
+    head = proxy_head(method, path, headers, body.size());
+    response_cache *cache = response_cache::get_instance();
+    CACHE_STATUS status = body.empty() ? cache->lookup(method, path, headers, key, cached, waited) : CACHE_BYPASS;
+    switch (status)
+    {
+        case CACHE_HIT:
+            x_cache = "HIT";
+            break;
+        case CACHE_STALE:
+            x_cache = "STALE";
+            coro_spawn(cache->revalidate(pool, head, path, headers, key));
+            break;
+        case CACHE_MISS:
+            x_cache = "MISS";
+            break;
+        case CACHE_PENDING:
+        case CACHE_BYPASS:
+        default:
+            x_cache = NULL;
+            break;
+    }
+    return status;
+}
 
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+//未命中时由本请求向上游获取，可缓存的响应以 cached 返回，否则和不使用缓存时一样由 conn/resp/in 交给调用方转发
+coro_task<RELAY_RESULT> http_conn::proxy_fetch(CACHE_STATUS status, upstream_pool *pool, const char *method,
+                                               const std::string &head, const std::string &path,
+                                               const relay_headers &headers, const std::string &body,
+                                               const std::string &key, upstream_conn &conn, upstream_response &resp,
+                                               std::string &in, std::shared_ptr<const cached_response> &cached)
+{
+    if (status == CACHE_MISS)
+        co_return co_await response_cache::get_instance()->fetch(pool, head, path, headers, key, conn, resp, in, cached);
+    co_return co_await relay_exchange(pool, head, body, strcmp(method, "GET") == 0, conn, resp, in);
+}
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+//反向代理：缓存命中时直接生成响应；否则交给主线程上的协程等待同一 key 的获取或与上游交换，
+//等待期间不占用任何线程，完成后由 proxy_async 生成响应并注册写事件
+http_conn::HTTP_CODE http_conn::do_proxy(upstream_pool *pool)
+{
+    relay_headers headers = request_headers();
+    const char *method = m_method == POST ? "POST" : "GET";
+    std::string head, key;
+    const char *x_cache = NULL;
+    CACHE_STATUS status = proxy_lookup(pool, method, m_url, headers, m_body, head, key, m_cached, x_cache);
+    if (status == CACHE_HIT || status == CACHE_STALE)
+    {
+        upstream_conn conn;
+        upstream_response resp;
+        return proxy_response(pool, RELAY_OK, x_cache, conn, resp, std::string());
+    }
+    coro_spawn(proxy_async(pool, status, method, x_cache, std::string(m_url), std::move(headers), std::move(head),
+                           std::move(m_body), std::move(key)));
+    return ASYNC_REQUEST;
 }
-void http_conn::unmap()
+
+//参数按值保存在协程帧中：等待期间连接可能被定时器关闭并分配给新的客户端。
+//先转到主线程，之后的等待（上游描述符、同一 key 的获取）都由主线程恢复，访问连接时始终在主线程中
+coro_task<void> http_conn::proxy_async(upstream_pool *pool, CACHE_STATUS status, const char *method,
+                                       const char *x_cache, std::string path, relay_headers headers,
+                                       std::string head, std::string body, std::string key)
 {
-    if (m_file_address)
+    int sockfd = m_sockfd;
+    unsigned int conn_gen = m_conn_gen;
+    co_await coro_loop::get_instance()->schedule();
+
+    //登记在连接上，连接关闭时由 proxy_abort 取消等待。转到主线程之前连接就已关闭时不登记，
+    //仍照常完成获取：可能已有其它请求在等这次获取
+    proxy_wait pending;
+    upstream_conn &conn = pending.conn;
+    if (still_owned(sockfd, conn_gen))
+        m_proxy_wait = &pending;
+    upstream_response resp;
+    std::string in;
+    std::shared_ptr<const cached_response> cached;
+    response_cache *cache = response_cache::get_instance();
+    //请求合并：等同一 key 的获取结束后重新查找，结果不可缓存时各自访问上游
+    while (status == CACHE_PENDING)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        pending.key = key;
+        co_await cache->wait_flight(key, &pending.flight);
+        pending.flight = nullptr;
+        if (!still_owned(sockfd, conn_gen))
+            co_return;
+        status = proxy_lookup(pool, method, path, headers, body, head, key, cached, x_cache, true);
+    }
+    RELAY_RESULT result = RELAY_OK;
+    if (!cached)
+        result = co_await proxy_fetch(status, pool, method, head, path, headers, body, key, conn, resp, in, cached);
+    if (!still_owned(sockfd, conn_gen))
+    {
+        if (result == RELAY_OK && !cached)
+            pool->release(conn, false);
+        co_return;
+    }
+    m_proxy_wait = NULL;
+    m_cached = cached;
+    if (!process_write(proxy_response(pool, result, x_cache, conn, resp, in)))
+    {
+        close_conn();
+        co_return;
     }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
-bool http_conn::write()
+
+//响应头和随之到达的部分响应体放入 m_dynamic_body 发出，其余响应体在写事件中由 proxy_pump 边读边转发。
+//可缓存的响应已读完整个响应体写入缓存，以 CACHED_REQUEST 发出
+http_conn::HTTP_CODE http_conn::proxy_response(upstream_pool *pool, RELAY_RESULT result, const char *x_cache,
+                                               upstream_conn &conn, upstream_response &resp, const std::string &in)
 {
-    int temp = 0;
+    if (result != RELAY_OK)
+    {
+        LOG_WARN("proxy %s failed: %s", m_url, result == RELAY_TIMEOUT ? "upstream timeout" : "bad gateway");
+        return result == RELAY_TIMEOUT ? GATEWAY_TIMEOUT : BAD_GATEWAY;
+    }
 
-    if (bytes_to_send == 0)
+    char status[64];
+    if (m_cached)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
-        return true;
+        int len = snprintf(status, sizeof(status), "HTTP/1.1 %d ", m_cached->status);
+        m_dynamic_body.append(status, len).append(m_cached->reason).append("\r\n");
+        m_dynamic_body.append(m_cached->headers);
+        len = snprintf(status, sizeof(status), "Age:%ld\r\nX-Cache:%s\r\n",
+                       (long)(m_cached->age + time(NULL) - m_cached->stored), x_cache);
+        m_dynamic_body.append(status, len);
+        m_dynamic_body.append(m_linger ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n");
+        m_stream_sent = 0;
+        return CACHED_REQUEST;
     }
 
-    while (1)
+    std::unique_ptr<proxy_stream> stream(new proxy_stream(pool, conn, resp));
+    //响应体以上游关闭为界时，客户端只能同样以关闭连接结束响应
+    if (resp.framing == FRAMING_CLOSE)
+        m_linger = false;
+    int len = snprintf(status, sizeof(status), "HTTP/1.1 %d ", resp.status);
+    m_dynamic_body.append(status, len).append(resp.reason).append("\r\n");
+    m_dynamic_body.append(resp.headers);
+    m_dynamic_body.append(m_linger ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n");
+    size_t n = stream->body.accept(in.data(), in.size());
+    m_dynamic_body.append(in.data(), n);
+    m_stream_sent = 0;
+
+    if (stream->body.finished())
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        pool->release(stream->conn, stream->body.reusable);
+        return DYNAMIC_REQUEST;
+    }
+    //明文连接和 kTLS 连接由内核直接把上游数据 splice 到客户端 socket，不经过用户态
+    stream->open(!m_ssl || m_ktls_send);
+    m_proxy = std::move(stream);
+    return DYNAMIC_REQUEST;
+}
 
-        if (temp < 0)
+//转发上游响应体：先把已读到的数据写给客户端，再从上游读下一段。
+//转发完毕返回 1；客户端写满或上游暂无数据返回 0，此时已注册相应事件（两个描述符同一时刻只注册一个）；出错返回 -1
+int http_conn::proxy_pump()
+{
+    proxy_stream &s = *m_proxy;
+    if (!s.attached)
+    {
+        upstream_table::get_instance()->attach(m_sockfd, s.conn.fd, this);
+        s.attached = true;
+    }
+    while (true)
+    {
+        while (s.pending() > 0)
         {
-            if (errno == EAGAIN)
+            ssize_t n;
+            if (s.pipe_fd[0] >= 0)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-                return true;
+                n = splice(s.pipe_fd[0], NULL, m_sockfd, NULL, s.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0)
+                    m_phase_bytes.fetch_add(n, std::memory_order_relaxed);
             }
-            unmap();
-            return false;
-        }
-
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            else
+            {
+                struct iovec iov;
+                iov.iov_base = s.buf.get() + s.buf_start;
+                iov.iov_len = s.buf_end - s.buf_start;
+                n = sock_writev(&iov, 1);
+            }
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                {
+                    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                    return 0;
+                }
+                proxy_finish(false);
+                return -1;
+            }
+            if (s.pipe_fd[0] >= 0)
+                s.piped -= n;
+            else
+                s.buf_start += n;
         }
-        else
+        s.buf_start = s.buf_end = 0;
+        if (s.body.finished())
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            proxy_finish(true);
+            return 1;
         }
 
-        if (bytes_to_send <= 0)
+        ssize_t n;
+        if (s.pipe_fd[0] >= 0)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-
-            if (m_linger)
+            size_t want = RELAY_PIPE_SIZE;
+            if (s.body.framing == FRAMING_LENGTH && s.body.remaining < want)
+                want = s.body.remaining;
+            n = splice(s.conn.fd, NULL, s.pipe_fd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
             {
-                init();
-                return true;
+                //数据不经过用户态，只按长度记账（分块编码不走管道）
+                s.body.accept(NULL, n);
+                s.piped = n;
+                continue;
             }
-            else
+        }
+        else
+        {
+            n = recv(s.conn.fd, s.buf.get(), RELAY_BUFFER_SIZE, 0);
+            if (n > 0)
             {
-                return false;
+                s.buf_end = s.body.accept(s.buf.get(), n);
+                if (s.body.chunks.error())
+                {
+                    LOG_WARN("upstream %s sent a malformed chunked body", s.conn.server->name.c_str());
+                    proxy_finish(false);
+                    return -1;
+                }
+                continue;
             }
         }
+        if (n == 0)
+        {
+            if (s.body.framing == FRAMING_CLOSE)
+            {
+                s.body.eof = true;
+                continue;
+            }
+            LOG_WARN("upstream %s closed before the response body ended", s.conn.server->name.c_str());
+            proxy_finish(false);
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            proxy_finish(false);
+            return -1;
+        }
+        //等待上游可读，事件由主线程按 upstream_table 找回本连接
+        epoll_event event;
+        event.data.fd = s.conn.fd;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        epoll_ctl(m_epollfd, s.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s.conn.fd, &event);
+        s.registered = true;
+        return 0;
+    }
+}
+
+//转发结束：响应体完整且上游允许时连接放回空闲列表
+void http_conn::proxy_finish(bool ok)
+{
+    proxy_stream &s = *m_proxy;
+    if (s.registered)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, s.conn.fd, 0);
+    if (s.attached)
+        upstream_table::get_instance()->detach(m_sockfd);
+    s.pool->release(s.conn, ok && s.body.reusable);
+    m_proxy.reset();
+}
+
+//连接关闭或超时：中止转发，上游连接的状态不可信，直接关闭。
+//客户端和上游描述符同一时刻只有一个注册了事件，当前这批 epoll 事件中不会残留该上游描述符的事件。
+//proxy_async 还在等待时取消其等待，协程在下一轮事件循环中恢复，发现连接已不属于自己后归还上游连接并结束
+void http_conn::proxy_abort()
+{
+    if (m_proxy)
+        proxy_finish(false);
+    if (m_proxy_wait)
+    {
+        proxy_wait *pending = m_proxy_wait;
+        m_proxy_wait = NULL;
+        pending->conn.cancelled = true;
+        coro_loop *loop = coro_loop::get_instance();
+        if (pending->flight && response_cache::get_instance()->cancel_wait(pending->key, pending->flight))
+            loop->post(pending->flight);
+        else
+            loop->cancel(pending->conn.fd);
+    }
+}
+
+std::string http_conn::metrics_text()
+{
+    char line[128];
+    std::string text;
+    int len = snprintf(line, sizeof(line), "http_connections %d\n", m_user_count);
+    text.append(line, len);
+    len = snprintf(line, sizeof(line), "verify_pending %d\n", m_verify_pool ? m_verify_pool->pending() : 0);
+    text.append(line, len);
+    len = snprintf(line, sizeof(line), "websocket_subscribers %zu\n", ws_hub::get_instance()->size());
+    text.append(line, len);
+    tls_context *tls = tls_context::get_instance();
+    if (tls->enabled())
+    {
+        len = snprintf(line, sizeof(line), "tls_handshakes %lu\ntls_resumed %lu\ntls_ktls_send %lu\n",
+                       tls->handshakes(), tls->resumed(), tls->ktls_send());
+        text.append(line, len);
+    }
+    len = snprintf(line, sizeof(line), "requests_shed %lu\n", m_shed_count.load(std::memory_order_relaxed));
+    text.append(line, len);
+    if (m_threadpool)
+        m_threadpool->metrics(text);
+    ip_limiter::get_instance()->metrics(text);
+    cpu_affinity::get_instance()->metrics(text);
+    coro_loop::get_instance()->metrics(text);
+    upstream_table::get_instance()->metrics(text);
+    response_cache::get_instance()->metrics(text);
+    return text;
+}
+
+//把请求路径映射为 doc_root 下的文件，优先从静态缓存取内容并按 Accept-Encoding 选择编码版本，不做堆分配
+http_conn::HTTP_CODE http_conn::map_file(const char *url)
+{
+    //需要登录的页面，未携带有效会话时改为返回登录页
+    if (!m_session_valid && file_needs_session(url))
+        url = "/log.html";
+    int n = snprintf(m_real_file, FILENAME_LEN, "%s%s", doc_root, url);
+    if (n < 0 || n >= FILENAME_LEN)
+        return BAD_REQUEST;
+
+    std::shared_ptr<const static_entry> entry;
+    switch (static_cache::get_instance()->acquire(m_real_file, entry, &m_file_stat))
+    {
+        case STATIC_NOT_FOUND:
+            return NO_RESOURCE;
+        case STATIC_FORBIDDEN:
+            return FORBIDDEN_REQUEST;
+        case STATIC_IS_DIR:
+            return BAD_REQUEST;
+        case STATIC_BYPASS:
+        {
+            //超出缓存上限的大文件仍然逐请求映射；空文件不映射，回复固定的空页面
+            if (m_file_stat.st_size == 0)
+                return FILE_REQUEST;
+            int fd = open(m_real_file, O_RDONLY);
+            if (fd < 0)
+                return NO_RESOURCE;
+            void *map = mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (map == MAP_FAILED)
+                return INTERNAL_ERROR;
+            m_file_address = (char *)map;
+            return FILE_REQUEST;
+        }
+        case STATIC_OK:
+        default:
+            break;
+    }
+
+    m_static = entry;
+    const static_body *body = entry->identity.get();
+    if (m_accept_br && entry->br)
+        body = entry->br.get();
+    else if (m_accept_gzip && entry->gzip)
+        body = entry->gzip.get();
+    m_static_body = body;
+    m_file_address = (char *)body->data;
+    m_file_stat.st_size = body->len;
+    return FILE_REQUEST;
+}
+
+//在校验线程中执行：比对口令散列，旧版明文口令校验通过后顺便升级为散列
+const char *http_conn::verify_login(const std::string &name, const std::string &password)
+{
+    std::string stored;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = users.find(name);
+        if (it == users.end())
+            return "/logError.html";
+        stored = it->second;
+    }
+
+    if (!password_hasher::verify(password, stored))
+        return "/logError.html";
+
+    if (!password_hasher::is_hashed(stored))
+        upgrade_legacy_password(name, password);
+
+    verify_cache::get_instance()->insert(name, password);
+    return "/welcome.html";
+}
+
+//在校验线程中执行：先散列口令，再写入数据库
+const char *http_conn::register_user(const std::string &name, const std::string &password)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (users.find(name) != users.end())
+            return "/registerError.html";
+    }
+
+    std::string hashed = password_hasher::hash(password);
+    if (hashed.empty())
+    {
+        LOG_ERROR("hash password failed for user %s", name.c_str());
+        return "/registerError.html";
+    }
+
+    MYSQL *conn = NULL;
+    connectionRAII mysqlcon(&conn, sql_pool);
+    if (!conn)
+        return "/registerError.html";
+
+    std::string sql_insert = "INSERT INTO user(username, passwd) VALUES('" + escape_sql(conn, name) + "', '" + hashed + "')";
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    //散列期间可能有同名用户抢先注册
+    if (users.find(name) != users.end())
+        return "/registerError.html";
+    if (mysql_query(conn, sql_insert.c_str()))
+    {
+        LOG_ERROR("INSERT error: %s", mysql_error(conn));
+        return "/registerError.html";
+    }
+    users[name] = hashed;
+    return "/log.html";
+}
+
+void http_conn::upgrade_legacy_password(const std::string &name, const std::string &password)
+{
+    std::string hashed = password_hasher::hash(password);
+    if (hashed.empty())
+        return;
+
+    MYSQL *conn = NULL;
+    connectionRAII mysqlcon(&conn, sql_pool);
+    if (!conn)
+        return;
+
+    std::string sql_update = "UPDATE user SET passwd='" + hashed + "' WHERE username='" + escape_sql(conn, name) + "'";
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (mysql_query(conn, sql_update.c_str()))
+    {
+        LOG_ERROR("UPDATE error: %s", mysql_error(conn));
+        return;
+    }
+    users[name] = hashed;
+}
+
+//校验完成后在主线程中生成响应报文；连接若已关闭或被复用则丢弃结果
+void http_conn::finish_async(int sockfd, unsigned int conn_gen, const char *url, const std::string &session)
+{
+    if (!still_owned(sockfd, conn_gen))
+        return;
+
+    if (!session.empty())
+    {
+        strcpy(m_session_token, session.c_str());
+        m_session_valid = true;
+    }
+    HTTP_CODE ret = map_file(url);
+    if (!process_write(ret))
+    {
+        close_conn();
+        return;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+void http_conn::unmap()
+{
+    m_cached.reset();
+    //静态缓存中的内容由缓存管理，这里只释放引用
+    if (m_static)
+    {
+        m_static.reset();
+        m_static_body = NULL;
+        m_file_address = 0;
+        return;
+    }
+    if (m_file_address)
+    {
+        munmap(m_file_address, m_file_stat.st_size);
+        m_file_address = 0;
+    }
+}
+//把 m_iv 中剩余的内容写出：全部写完返回 1，socket 写满返回 0，出错返回 -1
+int http_conn::flush_iov()
+{
+    while (bytes_to_send > 0)
+    {
+        int temp = sock_writev(m_iv, m_iv_count);
+
+        if (temp < 0)
+            return errno == EAGAIN ? 0 : -1;
+
+        bytes_have_send += temp;
+        bytes_to_send -= temp;
+
+        //按本次写出的字节数依次推进各个 iovec
+        size_t sent = temp;
+        for (int i = 0; i < m_iv_count && sent > 0; ++i)
+        {
+            size_t step = sent < m_iv[i].iov_len ? sent : m_iv[i].iov_len;
+            m_iv[i].iov_base = (char *)m_iv[i].iov_base + step;
+            m_iv[i].iov_len -= step;
+            sent -= step;
+        }
+    }
+    return 1;
+}
+
+//从 socket 读取，TLS 连接经 OpenSSL 解密：返回读到的字节数，对端关闭返回 0，
+//出错返回 -1（暂无数据时 errno 为 EAGAIN）
+ssize_t http_conn::sock_read(char *buf, size_t len)
+{
+    if (!m_ssl)
+        return recv(m_sockfd, buf, len, 0);
+
+    ERR_clear_error();
+    int n = SSL_read(m_ssl, buf, len);
+    if (n > 0)
+        return n;
+    int err = SSL_get_error(m_ssl, n);
+    if (err == SSL_ERROR_ZERO_RETURN)
+        return 0;
+    errno = (err == SSL_ERROR_WANT_READ) ? EAGAIN : EIO;
+    return -1;
+}
+
+//写出一组 iovec：明文连接和 kTLS 发送侧生效的连接直接 writev，由内核完成加密；
+//否则逐段交给 SSL_write。返回写出的字节数，出错返回 -1（socket 写满时 errno 为 EAGAIN）
+ssize_t http_conn::sock_writev(const struct iovec *iov, int count)
+{
+    if (!m_ssl || m_ktls_send)
+    {
+        ssize_t n = writev(m_sockfd, iov, count);
+        if (n > 0)
+            m_phase_bytes.fetch_add(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    ssize_t total = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const char *base = (const char *)iov[i].iov_base;
+        size_t off = 0;
+        while (off < iov[i].iov_len)
+        {
+            size_t chunk = iov[i].iov_len - off;
+            ERR_clear_error();
+            //SSL_write 返回 WANT_WRITE 后须以相同的剩余内容重试，调用方只按返回值推进，正好满足
+            int n = SSL_write(m_ssl, base + off, chunk > INT_MAX ? INT_MAX : chunk);
+            if (n > 0)
+            {
+                off += n;
+                total += n;
+                m_phase_bytes.fetch_add(n, std::memory_order_relaxed);
+                continue;
+            }
+            int err = SSL_get_error(m_ssl, n);
+            if (err == SSL_ERROR_WANT_WRITE && total > 0)
+                return total;
+            errno = (err == SSL_ERROR_WANT_WRITE) ? EAGAIN : EIO;
+            return -1;
+        }
+    }
+    return total;
+}
+
+//推进 TLS 握手：完成返回 1；需要等待 socket 可读/可写返回 0，此时已注册相应事件；失败返回 -1
+int http_conn::tls_handshake()
+{
+    if (!m_ssl)
+        return -1;
+
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret == 1)
+    {
+        m_tls_ready = true;
+        m_ktls_send = tls_context::get_instance()->on_handshake(m_ssl);
+        return 1;
+    }
+    int err = SSL_get_error(m_ssl, ret);
+    if (err == SSL_ERROR_WANT_READ)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return 0;
+    }
+    if (err == SSL_ERROR_WANT_WRITE)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+        return 0;
     }
+    LOG_INFO("tls handshake failed: %s", ERR_reason_error_string(ERR_peek_error()));
+    return -1;
 }
+
+//释放 SSL 对象；notify 为 true 且握手已完成时先尽力发出 close_notify
+void http_conn::tls_free(bool notify)
+{
+    if (!m_ssl)
+        return;
+    if (notify && m_tls_ready)
+    {
+        ERR_clear_error();
+        SSL_shutdown(m_ssl);
+    }
+    SSL_free(m_ssl);
+    m_ssl = NULL;
+}
+
+bool http_conn::write()
+{
+    //TLS 握手中途 socket 写满，写事件到来时继续握手，完成后等待请求
+    if (!m_tls_ready)
+    {
+        int ret = tls_handshake();
+        if (ret < 0)
+            return false;
+        if (ret > 0)
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    if (m_h2)
+        return write_h2();
+
+    int ret = flush_iov();
+    if (ret == 0)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+        return true;
+    }
+
+    unmap();
+    if (ret < 0)
+        return false;
+
+    //反向代理：响应头发出后继续转发上游响应体，未转发完时 proxy_pump 已注册需要等待的事件
+    if (m_proxy)
+    {
+        ret = proxy_pump();
+        if (ret == 0)
+            return true;
+        if (ret < 0)
+            return false;
+    }
+
+    //101 已发出，切换到 WebSocket；TLS 中已解密但尚未读出的帧不会再触发读事件，直接读取
+    if (!m_ws_accept.empty())
+    {
+        start_ws();
+        return (m_ssl && SSL_pending(m_ssl) > 0) ? ws_read() : ws_write();
+    }
+
+    //排空开始之前已按长连接回复的请求：发送完毕后同样关闭
+    if (m_linger && !m_draining.load(std::memory_order_relaxed))
+    {
+        keep_alive_reset();
+        //缓冲区中已有下一个请求时由调用方直接交给线程池处理，此时不能再注册读事件
+        if (!has_buffered_request())
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    return false;
+}
+
+//HTTP/2：输出缓冲发完后继续生成被窗口或单次预算挡住的 DATA 帧，直到无可发送的内容
+bool http_conn::write_h2()
+{
+    h2_unpark();
+    while (true)
+    {
+        int ret = flush_iov();
+        if (ret == 0)
+        {
+            h2_rearm(EPOLLOUT);
+            return true;
+        }
+        if (ret < 0)
+            return false;
+
+        //输出缓冲发完后才能追加推迟的响应：m_iv 指向其中的数据
+        m_h2->clear_output();
+        h2_drain();
+        m_h2->pump();
+        if (m_h2->output().empty())
+            break;
+        m_iv[0].iov_base = (void *)m_h2->output().data();
+        m_iv[0].iov_len = m_h2->output().size();
+        m_iv_count = 1;
+        bytes_to_send = m_iv[0].iov_len;
+    }
+
+    if (m_h2->closing() && !m_h2->has_pending_data())
+        return false;
+    set_phase(m_h2->has_deferred() ? PHASE_WRITE : PHASE_IDLE);
+    h2_rearm(EPOLLIN);
+    return true;
+}
+
 bool http_conn::add_response(const char *format, ...)
 {
     if (m_write_idx >= WRITE_BUFFER_SIZE)
@@ -600,8 +1697,6 @@ bool http_conn::add_response(const char *format, ...)
     m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
-
     return true;
 }
 bool http_conn::add_status_line(int status, const char *title)
@@ -610,21 +1705,74 @@ bool http_conn::add_status_line(int status, const char *title)
 }
 bool http_conn::add_headers(int content_len)
 {
-    return add_content_length(content_len) && add_linger() &&
-           add_blank_line();
+    return add_content_length(content_len) && add_date() && add_session_cookie() &&
+           add_linger() && add_blank_line();
 }
 bool http_conn::add_content_length(int content_len)
 {
     return add_response("Content-Length:%d\r\n", content_len);
 }
-bool http_conn::add_content_type()
+bool http_conn::add_content_type(const char *type)
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_response("Content-Type:%s\r\n", type);
 }
 bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+bool http_conn::add_date()
+{
+    return add_response("Date:%s\r\n", http_date());
+}
+bool http_conn::add_session_cookie()
+{
+    if (m_session_token[0] == '\0')
+        return true;
+    return add_response("Set-Cookie:sid=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Lax%s\r\n",
+                        m_session_token, session_store::get_instance()->get_ttl(), m_ssl ? "; Secure" : "");
+}
+//分块编码响应：响应头和已生成的分块都追加到 m_dynamic_body，
+//处理函数可以随时调用 flush_chunked() 先把已有内容发出去，不必等到知道总长度
+void http_conn::begin_chunked(int status, const char *title, const char *content_type)
+{
+    char head[256];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type:%s\r\nTransfer-Encoding:chunked\r\nConnection:%s\r\n\r\n",
+                       status, title, content_type, m_linger ? "keep-alive" : "close");
+    m_dynamic_body.assign(head, len);
+    m_stream_sent = 0;
+}
+void http_conn::add_chunk(const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    char size_line[32];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    m_dynamic_body.append(size_line, n);
+    m_dynamic_body.append(data, len);
+    m_dynamic_body.append("\r\n", 2);
+}
+void http_conn::end_chunked()
+{
+    m_dynamic_body.append("0\r\n\r\n", 5);
+}
+//工作线程持有该连接（EPOLLONESHOT 未重新注册），可以直接非阻塞地写 socket
+void http_conn::flush_chunked()
+{
+    while (m_stream_sent < m_dynamic_body.size())
+    {
+        struct iovec iv;
+        iv.iov_base = (void *)(m_dynamic_body.data() + m_stream_sent);
+        iv.iov_len = m_dynamic_body.size() - m_stream_sent;
+        ssize_t n = sock_writev(&iv, 1);
+        if (n <= 0)
+            return;
+        m_stream_sent += n;
+    }
+}
+bool http_conn::add_retry_after(int seconds)
+{
+    return add_response("Retry-After:%d\r\n", seconds);
+}
 bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
@@ -637,6 +1785,8 @@ bool http_conn::add_content(const char *content)
 // 根据 HTTP_CODE 的值，生成 HTTP 响应报文，填充写缓冲区，并准备发送数据。
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    //出错的请求不经过 do_request，异步校验完成时从这里重新开始计发送期限
+    set_phase(PHASE_WRITE);
     switch (ret)
     {
         case INTERNAL_ERROR:    // 500 错误
@@ -648,6 +1798,15 @@ bool http_conn::process_write(HTTP_CODE ret)
             break;
         }
         case BAD_REQUEST:       // 400 错误
+        {
+            m_linger = false;   // 报文有误时无法确定下一个请求从哪里开始，只能关闭连接
+            add_status_line(400, error_400_title);
+            add_headers(strlen(error_400_form));
+            if (!add_content(error_400_form))
+                return false;
+            break;
+        }
+        case NO_RESOURCE:       // 404 错误
         {
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
@@ -655,6 +1814,80 @@ bool http_conn::process_write(HTTP_CODE ret)
                 return false;
             break;
         }
+        case SERVICE_UNAVAILABLE:   // 503 错误，附带 Retry-After 让客户端退避
+        {
+            add_status_line(503, error_503_title);
+            add_content_length(strlen(error_503_form));
+            add_retry_after(1);
+            add_linger();
+            add_blank_line();
+            if (!add_content(error_503_form))
+                return false;
+            break;
+        }
+        case TOO_MANY_REQUESTS: // 429 错误，附带 Retry-After 让客户端退避
+        {
+            add_status_line(429, error_429_title);
+            add_content_length(strlen(error_429_form));
+            add_retry_after(1);
+            add_linger();
+            add_blank_line();
+            if (!add_content(error_429_form))
+                return false;
+            break;
+        }
+        case WS_UPGRADE:        // 101，发送完毕后在 write() 中切换到 WebSocket
+        {
+            add_status_line(101, "Switching Protocols");
+            if (!add_response("Upgrade:websocket\r\nConnection:Upgrade\r\nSec-WebSocket-Accept:%s\r\n",
+                              m_ws_accept.c_str()) ||
+                !add_date() || !add_blank_line())
+                return false;
+            break;
+        }
+        case DYNAMIC_REQUEST:   // 动态生成的完整响应报文（如运行指标），跳过已提前发出的部分
+        {
+            m_iv[0].iov_base = &m_dynamic_body[0] + m_stream_sent;
+            m_iv[0].iov_len = m_dynamic_body.size() - m_stream_sent;
+            m_iv_count = 1;
+            bytes_to_send = m_iv[0].iov_len;
+            return true;
+        }
+        case CACHED_REQUEST:    // 代理缓存命中，响应体直接从缓存条目发出
+        {
+            m_iv[0].iov_base = &m_dynamic_body[0];
+            m_iv[0].iov_len = m_dynamic_body.size();
+            m_iv[1].iov_base = (void *)m_cached->body.data();
+            m_iv[1].iov_len = m_cached->body.size();
+            m_iv_count = 2;
+            bytes_to_send = m_iv[0].iov_len + m_iv[1].iov_len;
+            return true;
+        }
+        case ENTITY_TOO_LARGE:  // 413 错误
+        {
+            m_linger = false;   // 未读完的请求体无法跳过，只能关闭连接
+            add_status_line(413, error_413_title);
+            add_headers(strlen(error_413_form));
+            if (!add_content(error_413_form))
+                return false;
+            break;
+        }
+        case BAD_GATEWAY:       // 502 错误
+        {
+            add_status_line(502, error_502_title);
+            add_headers(strlen(error_502_form));
+            if (!add_content(error_502_form))
+                return false;
+            break;
+        }
+        case GATEWAY_TIMEOUT:   // 504 错误
+        {
+            add_status_line(504, error_504_title);
+            add_headers(strlen(error_504_form));
+            if (!add_content(error_504_form))
+                return false;
+            break;
+        }
         case FORBIDDEN_REQUEST:     // 403 错误
         {
             add_status_line(403, error_403_title);
@@ -665,9 +1898,32 @@ bool http_conn::process_write(HTTP_CODE ret)
         }
         case FILE_REQUEST:      // 文件请求（成功的请求）
         {
+            //缓存命中：状态行和固定响应头直接引用缓存，写缓冲区只放每个请求不同的几行
+            if (m_static_body && m_file_stat.st_size != 0)
+            {
+                if (!add_date() || !add_session_cookie() || !add_linger() || !add_blank_line())
+                    return false;
+                m_iv[0].iov_base = (void *)m_static_body->header.data();
+                m_iv[0].iov_len = m_static_body->header.size();
+                m_iv[1].iov_base = m_write_buf;
+                m_iv[1].iov_len = m_write_idx;
+                m_iv[2].iov_base = m_file_address;
+                m_iv[2].iov_len = m_file_stat.st_size;
+                m_iv_count = 3;
+                bytes_to_send = m_iv[0].iov_len + m_write_idx + m_file_stat.st_size;
+                return true;
+            }
             add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0)
             {
+                //未经缓存直接映射的文件：ETag、Vary 与缓存中的原文表示一致
+                static_cache *cache = static_cache::get_instance();
+                char etag[64];
+                cache->format_etag(m_file_stat, NULL, etag, sizeof(etag));
+                add_response("ETag:%s\r\n", etag);
+                add_content_type(mime_table::get_instance()->lookup(m_real_file, strlen(m_real_file)));
+                if (cache->bypass_vary(m_real_file, m_file_stat))
+                    add_response("Vary:Accept-Encoding\r\n");
                 add_headers(m_file_stat.st_size);
                 m_iv[0].iov_base = m_write_buf;
                 m_iv[0].iov_len = m_write_idx;
@@ -684,6 +1940,7 @@ bool http_conn::process_write(HTTP_CODE ret)
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
         }
         default:
             return false;
@@ -697,13 +1954,67 @@ bool http_conn::process_write(HTTP_CODE ret)
 
 void http_conn::process()
 {
+    //TLS 握手在工作线程中完成，完成后立即读取客户端随 Finished 一起发来的请求
+    if (!m_tls_ready)
+    {
+        int ret = tls_handshake();
+        if (ret < 0)
+        {
+            close_conn();
+            return;
+        }
+        if (ret == 0)
+            return;
+        if (!read_once())
+        {
+            close_conn();
+            return;
+        }
+    }
+    if (m_h2)
+    {
+        process_h2();
+        return;
+    }
+    //连接以 HTTP/2 前言开头（prior knowledge），直接切换到 HTTP/2
+    if (m_check_state == CHECK_STATE_REQUESTLINE && m_checked_idx == 0 && m_read_idx > 0 && m_read_buf[0] == 'P')
+    {
+        size_t n = m_read_idx < (long)h2_session::PREFACE_LEN ? m_read_idx : h2_session::PREFACE_LEN;
+        if (memcmp(m_read_buf, h2_session::PREFACE, n) == 0)
+        {
+            if (n < h2_session::PREFACE_LEN)
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            else
+                start_h2(false);
+            return;
+        }
+    }
+
     HTTP_CODE read_ret = process_read();    // 处理读取客户端请求
+    //TLS：读缓冲区满时已解密的数据留在 OpenSSL 中，不会再触发读事件，请求体回收缓冲区后直接接着读
+    while (read_ret == NO_REQUEST && m_ssl && SSL_pending(m_ssl) > 0 && m_read_idx < m_read_buffer_size)
+    {
+        if (!read_once())
+        {
+            close_conn();
+            return;
+        }
+        read_ret = process_read();
+    }
     // 如果没有完整的请求
     if (read_ret == NO_REQUEST)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);    // 继续等待读取事件
         return;
     }
+    // 请求已交给协程，由其生成响应并注册写事件
+    if (read_ret == ASYNC_REQUEST)
+        return;
+    if (read_ret == H2_UPGRADE)
+    {
+        start_h2(true);
+        return;
+    }
     bool write_ret = process_write(read_ret);   // 处理并生成响应
     if (!write_ret)
     {
@@ -711,3 +2022,598 @@ void http_conn::process()
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);   // 修改文件描述符，等待写事件
 }
+
+//握手未完成的 TLS 连接和 HTTP/2 连接无法直接写出 HTTP/1.1 响应，直接关闭
+void http_conn::shed()
+{
+    m_shed_count.fetch_add(1, std::memory_order_relaxed);
+    if (!m_tls_ready || m_h2 || m_ws || m_proxy)
+    {
+        close_conn();
+        return;
+    }
+    m_linger = false;
+    if (!process_write(SERVICE_UNAVAILABLE))
+    {
+        close_conn();
+        return;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+//切换到 HTTP/2：读缓冲区中剩余的字节（前言及之后的帧）全部转交给 h2_session
+void http_conn::start_h2(bool upgrade)
+{
+    m_h2.reset(new h2_session([this](h2_stream &stream) { h2_request(stream); }));
+    long consumed = 0;
+    if (upgrade)
+    {
+        if (!m_h2->start(m_http2_settings))
+        {
+            m_h2.reset();
+            if (!process_write(BAD_REQUEST))
+                close_conn();
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return;
+        }
+        //升级请求本身作为流 1，其响应在 101 和 SETTINGS 之后以 HTTP/2 帧发出
+        h2_stream *stream = m_h2->open_upgrade_stream();
+        stream->method = "GET";
+        stream->path = m_url;
+        stream->session_valid = m_session_valid;
+        stream->accept_gzip = m_accept_gzip;
+        stream->accept_br = m_accept_br;
+        m_h2->dispatch(*stream);
+        consumed = m_checked_idx;
+    }
+    else
+        m_h2->start();
+
+    //HTTP/1.1 的解析状态不再使用，此后读缓冲区只作为 HTTP/2 的接收区。
+    //这里不能调用 init()：reactor 模式下主线程正等待本线程置位的 improv
+    m_h2->feed(m_read_buf + consumed, m_read_idx - consumed);
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_start_line = 0;
+    LOG_INFO("switch to http/2 (%s)", upgrade ? "upgrade" : "prior knowledge");
+    process_h2();
+}
+
+//HTTP/2 连接的读事件：把新到的字节交给 h2_session，有输出则注册写事件
+void http_conn::process_h2()
+{
+    bool ok = true;
+    while (ok)
+    {
+        //TLS：读缓冲区放不下的已解密数据留在 OpenSSL 中，不会再触发读事件，这里直接接着读
+        if (m_read_idx == 0 && m_ssl && SSL_pending(m_ssl) > 0)
+            ok = read_once();
+        if (!ok || m_read_idx == 0)
+            break;
+        ok = m_h2->feed(m_read_buf, m_read_idx);
+        m_read_idx = 0;
+    }
+    h2_drain();
+    m_h2->pump();
+    if (!m_h2->output().empty())
+    {
+        m_iv[0].iov_base = (void *)m_h2->output().data();
+        m_iv[0].iov_len = m_h2->output().size();
+        m_iv_count = 1;
+        bytes_to_send = m_iv[0].iov_len;
+        set_phase(PHASE_WRITE);
+        h2_rearm(EPOLLOUT);
+    }
+    else if (!ok || (m_h2->closing() && !m_h2->has_pending_data()))
+        close_conn();
+    else
+    {
+        //HTTP/2 的请求头分散在帧中，这里不区分阶段：没有待发送的数据时按空闲期限计，收到数据即顺延；
+        //还有流在等待异步结果时按写期限计
+        set_phase(m_h2->has_deferred() ? PHASE_WRITE : PHASE_IDLE);
+        h2_rearm(EPOLLIN);
+    }
+}
+
+//推迟响应的流完成后由主线程调用。持有者已交出连接时改为等待写事件，由写事件取走结果；
+//连接正由工作线程处理时只放入队列，持有者注册事件前会看到它
+void http_conn::h2_complete(int sockfd, unsigned int conn_gen, uint32_t stream_id,
+                            std::function<void(h2_stream &)> respond)
+{
+    if (!still_owned(sockfd, conn_gen))
+        return;
+    std::lock_guard<std::mutex> guard(m_h2_mutex);
+    m_h2_results.push_back(h2_result{stream_id, std::move(respond)});
+    if (m_h2_parked)
+    {
+        m_h2_parked = false;
+        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    }
+}
+
+//HTTP/2 连接的持有者处理完事件后注册下一个事件，此后连接不再归它所有；已有待取的结果时等待写事件
+void http_conn::h2_rearm(int ev)
+{
+    std::lock_guard<std::mutex> guard(m_h2_mutex);
+    if (!m_h2_results.empty())
+        ev = EPOLLOUT;
+    m_h2_parked = true;
+    modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
+}
+
+//事件到来、连接重新有了持有者：之后投递的结果不必再注册写事件
+void http_conn::h2_unpark()
+{
+    std::lock_guard<std::mutex> guard(m_h2_mutex);
+    m_h2_parked = false;
+}
+
+//把已完成的推迟响应交给会话；流已被对端重置的结果直接丢弃
+void http_conn::h2_drain()
+{
+    std::vector<h2_result> results;
+    {
+        std::lock_guard<std::mutex> guard(m_h2_mutex);
+        results.swap(m_h2_results);
+    }
+    for (h2_result &result : results)
+        m_h2->resume(result.stream_id, result.respond);
+}
+
+//处理一个 HTTP/2 请求：与 do_request 使用同一张路由表
+void http_conn::h2_request(h2_stream &stream)
+{
+    //同一连接上的每个流各消耗一个令牌
+    if (!ip_limiter::get_instance()->allow(m_address.sin_addr.s_addr))
+    {
+        h2_error(stream, 429, error_429_form);
+        return;
+    }
+    unsigned method = 0;
+    if (stream.method == "GET")
+        method = 1u << GET;
+    else if (stream.method == "POST")
+        method = 1u << POST;
+    if (!method)
+    {
+        h2_error(stream, 400, error_400_form);
+        return;
+    }
+
+    stream.path.resize(normalize_path(&stream.path[0], stream.path.size()));
+    const route *r = find_route(method, stream.path.data(), stream.path.size());
+    upstream_pool *pool = r ? NULL : upstream_table::get_instance()->match(stream.path.data(), stream.path.size());
+    //HTTP/2 连接的读事件按最近一个流的分类入队
+    m_lane = route_lane(r, pool);
+    if (!r)
+    {
+        if (pool)
+            h2_proxy(stream, pool);
+        else
+            h2_file(stream, stream.path.c_str(), std::string());
+        return;
+    }
+    if (r->need_session && !stream.session_valid)
+    {
+        h2_file(stream, "/log.html", std::string());
+        return;
+    }
+
+    switch (r->handler)
+    {
+        case ROUTE_LOGIN:
+        case ROUTE_REGISTER:
+        {
+            char name[100], password[100];
+            if (!parse_credentials(stream.body.data(), stream.body.size(), name, password))
+            {
+                h2_error(stream, 400, error_400_form);
+                return;
+            }
+            //登录先查已校验缓存，命中则直接回复
+            bool is_login = r->handler == ROUTE_LOGIN;
+            if (is_login && verify_cache::get_instance()->lookup(name, password))
+            {
+                h2_file(stream, "/welcome.html", session_store::get_instance()->create(name));
+                return;
+            }
+            //否则与 HTTP/1.1 一样交给校验线程池。只推迟这一个流，连接上的其它流照常收发
+            bool rejected = false;
+            coro_spawn(h2_verify_async(is_login, stream.id, name, password, &rejected));
+            if (rejected)
+            {
+                LOG_WARN("verify pool is saturated, reject %s", is_login ? "login" : "register");
+                h2_error(stream, 503, error_503_form);
+                return;
+            }
+            m_h2->defer(stream);
+            return;
+        }
+        case ROUTE_METRICS:
+        {
+            stream.owned = metrics_text();
+            std::string block;
+            char length[24];
+            int length_len = snprintf(length, sizeof(length), "%zu", stream.owned.size());
+            hpack_encode_status(block, 200);
+            hpack_encode_header(block, "content-type", "text/plain", 10);
+            hpack_encode_header(block, "content-length", length, length_len);
+            m_h2->respond(stream, block, stream.owned.data(), stream.owned.size());
+            return;
+        }
+        case ROUTE_WEBSOCKET:
+        {
+            //HTTP/2 上的 WebSocket（RFC 8441 扩展 CONNECT）未实现，客户端会退回 HTTP/1.1
+            h2_error(stream, 400, error_400_form);
+            return;
+        }
+        case ROUTE_STATIC:
+        default:
+            h2_file(stream, r->file ? r->file : stream.path.c_str(), std::string());
+            return;
+    }
+}
+
+//与 verify_async 相同，只是结果经 h2_complete 交给连接的持有者，在推迟的流上回复
+coro_task<void> http_conn::h2_verify_async(bool is_login, uint32_t stream_id, std::string name, std::string password,
+                                           bool *rejected)
+{
+    int sockfd = m_sockfd;
+    unsigned int conn_gen = m_conn_gen;
+    std::optional<const char *> url = co_await coro_offload(m_verify_pool, [this, is_login, &name, &password]() {
+        return is_login ? verify_login(name, password) : register_user(name, password);
+    });
+    if (!url)
+    {
+        *rejected = true;
+        co_return;
+    }
+    std::string session;
+    if (is_login && strcmp(*url, "/welcome.html") == 0)
+        session = session_store::get_instance()->create(name);
+    co_await coro_loop::get_instance()->schedule();
+    const char *file = *url;
+    h2_complete(sockfd, conn_gen, stream_id, [this, file, session](h2_stream &stream) {
+        h2_file(stream, file, session);
+    });
+}
+
+//HTTP/2 的静态文件响应：缓存命中时直接使用预先编码好的头部块，只追加 date 和 set-cookie
+void http_conn::h2_file(h2_stream &stream, const char *url, const std::string &session)
+{
+    //需要登录的页面，未携带有效会话（也不是刚登录成功）时改为返回登录页
+    if (!stream.session_valid && session.empty() && file_needs_session(url))
+        url = "/log.html";
+    char real_file[FILENAME_LEN];
+    int n = snprintf(real_file, FILENAME_LEN, "%s%s", doc_root, url);
+    if (n < 0 || n >= FILENAME_LEN)
+    {
+        h2_error(stream, 400, error_400_form);
+        return;
+    }
+
+    struct stat st;
+    std::string block;
+    const char *data;
+    size_t len;
+    switch (static_cache::get_instance()->acquire(real_file, stream.entry, &st))
+    {
+        case STATIC_NOT_FOUND:
+            h2_error(stream, 404, error_404_form);
+            return;
+        case STATIC_FORBIDDEN:
+            h2_error(stream, 403, error_403_form);
+            return;
+        case STATIC_IS_DIR:
+            h2_error(stream, 400, error_400_form);
+            return;
+        case STATIC_BYPASS:
+        {
+            data = "";
+            len = 0;
+            if (st.st_size > 0)
+            {
+                int fd = open(real_file, O_RDONLY);
+                if (fd < 0)
+                {
+                    h2_error(stream, 404, error_404_form);
+                    return;
+                }
+                void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (map == MAP_FAILED)
+                {
+                    h2_error(stream, 500, error_500_form);
+                    return;
+                }
+                stream.map = map;
+                stream.map_len = st.st_size;
+                data = (const char *)map;
+                len = st.st_size;
+            }
+
+            static_cache *cache = static_cache::get_instance();
+            char length[24], etag[64];
+            int length_len = snprintf(length, sizeof(length), "%zu", len);
+            int etag_len = cache->format_etag(st, NULL, etag, sizeof(etag));
+            const char *type = mime_table::get_instance()->lookup(real_file, n);
+            hpack_encode_status(block, 200);
+            hpack_encode_header(block, "content-length", length, length_len);
+            hpack_encode_header(block, "etag", etag, etag_len);
+            hpack_encode_header(block, "content-type", type, strlen(type));
+            if (cache->bypass_vary(real_file, st))
+                hpack_encode_header(block, "vary", "accept-encoding", 15);
+            break;
+        }
+        case STATIC_OK:
+        default:
+        {
+            const static_body *body = stream.entry->identity.get();
+            if (stream.accept_br && stream.entry->br)
+                body = stream.entry->br.get();
+            else if (stream.accept_gzip && stream.entry->gzip)
+                body = stream.entry->gzip.get();
+            block = body->h2_header;
+            data = body->data;
+            len = body->len;
+            break;
+        }
+    }
+
+    const char *date = http_date();
+    hpack_encode_header(block, "date", date, strlen(date));
+    if (!session.empty())
+    {
+        char cookie[128];
+        int cookie_len = snprintf(cookie, sizeof(cookie), "sid=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Lax%s",
+                                  session.c_str(), session_store::get_instance()->get_ttl(), m_ssl ? "; Secure" : "");
+        hpack_encode_header(block, "set-cookie", cookie, cookie_len);
+    }
+    m_h2->respond(stream, block, data, len);
+}
+
+void http_conn::h2_error(h2_stream &stream, int status, const char *form)
+{
+    std::string block;
+    char length[24];
+    int length_len = snprintf(length, sizeof(length), "%zu", strlen(form));
+    hpack_encode_status(block, status);
+    hpack_encode_header(block, "content-length", length, length_len);
+    m_h2->respond(stream, block, form, strlen(form));
+}
+
+//上游响应头行转成小写的 HPACK 字段；分块编码已解码、长度由调用方按实际响应体重新给出
+static void h2_upstream_headers(std::string &block, const std::string &headers)
+{
+    const char *p = headers.data();
+    const char *end = p + headers.size();
+    while (p < end)
+    {
+        const char *eol = (const char *)memmem(p, end - p, "\r\n", 2);
+        const char *colon = (const char *)memchr(p, ':', eol - p);
+        if (colon)
+        {
+            std::string name(p, colon - p);
+            for (char &c : name)
+                c = tolower((unsigned char)c);
+            const char *value = colon + 1;
+            value += strspn(value, " \t");
+            if (name != "transfer-encoding" && name != "content-length")
+                hpack_encode_header(block, name.c_str(), value, eol - value);
+        }
+        p = eol + 2;
+    }
+}
+
+//HTTP/2 的反向代理：转成 HTTP/1.1 请求交给上游。同一连接上的其它流不能等待逐段转发，
+//在主线程上读完整个响应体再以 DATA 帧发出；与 HTTP/1.1 共用响应缓存和交换上游的协程
+void http_conn::h2_proxy(h2_stream &stream, upstream_pool *pool)
+{
+    relay_headers headers;
+    const std::string *authority = NULL;
+    bool has_host = false;
+    for (const hpack_field &field : stream.headers)
+    {
+        if (!field.first.empty() && field.first[0] == ':')
+        {
+            if (field.first == ":authority")
+                authority = &field.second;
+            continue;
+        }
+        has_host = has_host || field.first == "host";
+        headers.push_back(field);
+    }
+    if (authority && !has_host)
+        headers.emplace_back("host", *authority);
+
+    std::string head, key;
+    const char *x_cache = NULL;
+    CACHE_STATUS status = proxy_lookup(pool, stream.method.c_str(), stream.path, headers, stream.body,
+                                       head, key, stream.cached, x_cache);
+    if (status == CACHE_HIT || status == CACHE_STALE)
+    {
+        h2_proxy_respond(stream, RELAY_OK, x_cache, upstream_response());
+        return;
+    }
+    //与 HTTP/1.1 一样在主线程上等待上游，只推迟这一个流
+    coro_spawn(h2_proxy_async(pool, status, stream.id, x_cache, stream.method, stream.path, std::move(headers),
+                              std::move(head), stream.body, std::move(key)));
+    m_h2->defer(stream);
+}
+
+//在主线程上获取并读完整个响应体，结果经 h2_complete 交给连接的持有者。
+//连接上还有其它流，不登记到 m_proxy_wait：连接关闭后等待照常结束（受上游超时限制），结果被丢弃
+coro_task<void> http_conn::h2_proxy_async(upstream_pool *pool, CACHE_STATUS status, uint32_t stream_id,
+                                          const char *x_cache, std::string method, std::string path,
+                                          relay_headers headers, std::string head, std::string body, std::string key)
+{
+    int sockfd = m_sockfd;
+    unsigned int conn_gen = m_conn_gen;
+    co_await coro_loop::get_instance()->schedule();
+
+    upstream_conn conn;
+    upstream_response resp;
+    std::string in, owned;
+    std::shared_ptr<const cached_response> cached;
+    response_cache *cache = response_cache::get_instance();
+    while (status == CACHE_PENDING)
+    {
+        co_await cache->wait_flight(key);
+        status = proxy_lookup(pool, method.c_str(), path, headers, body, head, key, cached, x_cache, true);
+    }
+    RELAY_RESULT result = RELAY_OK;
+    if (!cached)
+        result = co_await proxy_fetch(status, pool, method.c_str(), head, path, headers, body, key, conn, resp, in,
+                                      cached);
+    if (result == RELAY_OK && !cached)
+    {
+        result = co_await relay_read_body(conn, resp, in, MAX_BODY_SIZE, owned);
+        pool->release(conn, result == RELAY_OK && resp.keep_alive);
+    }
+    h2_complete(sockfd, conn_gen, stream_id,
+                [this, result, x_cache, cached = std::move(cached), resp = std::move(resp),
+                 owned = std::move(owned)](h2_stream &stream) mutable {
+                    stream.cached = std::move(cached);
+                    stream.owned = std::move(owned);
+                    h2_proxy_respond(stream, result, x_cache, resp);
+                });
+}
+
+//反向代理的 HTTP/2 响应：响应体位于 stream.cached（缓存条目）或 stream.owned 中
+void http_conn::h2_proxy_respond(h2_stream &stream, RELAY_RESULT result, const char *x_cache,
+                                 const upstream_response &resp)
+{
+    if (result != RELAY_OK)
+    {
+        LOG_WARN("proxy %s failed: %s", stream.path.c_str(), result == RELAY_TIMEOUT ? "upstream timeout" : "bad gateway");
+        stream.owned.clear();
+        if (result == RELAY_TIMEOUT)
+            h2_error(stream, 504, error_504_form);
+        else
+            h2_error(stream, 502, error_502_form);
+        return;
+    }
+
+    std::string block;
+    char length[24];
+    int length_len;
+    if (stream.cached)
+    {
+        const cached_response &entry = *stream.cached;
+        hpack_encode_status(block, entry.status);
+        h2_upstream_headers(block, entry.headers);
+        length_len = snprintf(length, sizeof(length), "%ld", (long)(entry.age + time(NULL) - entry.stored));
+        hpack_encode_header(block, "age", length, length_len);
+        hpack_encode_header(block, "x-cache", x_cache, strlen(x_cache));
+        if (entry.status != 204)
+        {
+            length_len = snprintf(length, sizeof(length), "%zu", entry.body.size());
+            hpack_encode_header(block, "content-length", length, length_len);
+        }
+        m_h2->respond(stream, block, entry.body.data(), entry.body.size());
+        return;
+    }
+    hpack_encode_status(block, resp.status);
+    h2_upstream_headers(block, resp.headers);
+    if (resp.framing != FRAMING_NONE)
+    {
+        length_len = snprintf(length, sizeof(length), "%zu", stream.owned.size());
+        hpack_encode_header(block, "content-length", length, length_len);
+    }
+    m_h2->respond(stream, block, stream.owned.data(), stream.owned.size());
+}
+
+//101 已发出：切换到 WebSocket 并加入广播。此后连接的收发和定时器都在主线程中处理，
+//升级请求之后已经到达的帧直接交给 ws_session
+void http_conn::start_ws()
+{
+    m_ws_accept.clear();
+    m_ws.reset(new ws_session([](int opcode, const std::string &message) {
+        ws_hub::get_instance()->broadcast(opcode, message.data(), message.size());
+    }));
+    ws_hub::get_instance()->subscribe(m_sockfd, this);
+
+    long consumed = m_checked_idx;
+    m_ws->feed(m_read_buf + consumed, m_read_idx - consumed);
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_start_line = 0;
+    LOG_INFO("switch to websocket, %zu subscribers", ws_hub::get_instance()->size());
+}
+
+//把发送队列中的帧（多个连接共享的同一份编码结果）直接 writev 出去：写完返回 1，socket 写满返回 0，出错返回 -1
+int http_conn::ws_flush()
+{
+    struct iovec iov[ws_session::MAX_IOV];
+    while (m_ws->has_output())
+    {
+        int count = m_ws->fill_iov(iov, ws_session::MAX_IOV);
+        ssize_t n = sock_writev(iov, count);
+        if (n < 0)
+            return errno == EAGAIN ? 0 : -1;
+        m_ws->consume(n);
+    }
+    return 1;
+}
+
+//WebSocket 连接的读事件
+bool http_conn::ws_read()
+{
+    //TLS 连接读缓冲区满时已解密的数据留在 OpenSSL 中，不会再触发读事件，需要接着读完
+    do
+    {
+        if (!read_once())
+            return false;
+        bool ok = m_ws->feed(m_read_buf, m_read_idx);
+        m_read_idx = 0;
+        if (!ok)
+            break;
+    } while (m_ssl && SSL_pending(m_ssl) > 0);
+    return ws_write();
+}
+
+//WebSocket 连接的写事件（读事件处理完毕后也会调用）：写出发送队列并重新注册事件
+bool http_conn::ws_write()
+{
+    int ret = ws_flush();
+    if (ret < 0)
+        return false;
+    //close 帧已发出，关闭连接
+    if (ret > 0 && m_ws->closing())
+        return false;
+    modfd(m_epollfd, m_sockfd, ret == 0 ? (EPOLLIN | EPOLLOUT) : EPOLLIN, m_TRIGMode);
+    return true;
+}
+
+//广播：排队共享的帧，队列原本为空时立即尝试写出，写不完再注册写事件。
+//积压过多或写出错时只 shutdown，连接由主循环在随后的 EPOLLRDHUP/EPOLLHUP 中回收，不会在广播遍历中途修改订阅表
+bool http_conn::ws_send(const ws_frame_ptr &frame)
+{
+    bool idle = !m_ws->has_output();
+    if (!m_ws->enqueue(frame))
+    {
+        LOG_WARN("websocket subscriber %d is too slow, disconnect", m_sockfd);
+        shutdown(m_sockfd, SHUT_RDWR);
+        return false;
+    }
+    if (!idle)
+        return true;
+    int ret = ws_flush();
+    if (ret < 0)
+    {
+        shutdown(m_sockfd, SHUT_RDWR);
+        return false;
+    }
+    if (ret == 0)
+        modfd(m_epollfd, m_sockfd, EPOLLIN | EPOLLOUT, m_TRIGMode);
+    return true;
+}
+
+//心跳：空闲定时器到期时发 ping；上一次 ping 之后没有收到任何数据则返回 false，由定时器关闭连接
+bool http_conn::ws_keepalive()
+{
+    if (m_ws->ping_outstanding())
+        return false;
+    m_ws->ping();
+    return ws_write();
+}
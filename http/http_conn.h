@@ -20,18 +20,45 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <vector>
+#include <functional>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../sqlConnectionPool/sqlConnectionPool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../auth/verify_pool.h"
+#include "../session/session_store.h"
+#include "router.h"
+#include "static_cache.h"
+#include "mime.h"
+#include "h2_session.h"
+#include "websocket.h"
+#include "../tls/tls_context.h"
+#include "../proxy/relay.h"
+#include "../proxy/response_cache.h"
+#include "../limit/ip_limiter.h"
+#include "../affinity/cpu_affinity.h"
+#include "../coro/coro_loop.h"
+
+template <typename T>
+class threadpool;
 
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;            // 文件名的最大长度（200）
-    static const int READ_BUFFER_SIZE = 2048;       // 读取缓冲区的大小（2048字节）
+    static const int READ_BUFFER_SIZE = 2048;       // 读取缓冲区的默认大小（2048字节），启动时可由配置文件修改
     static const int WRITE_BUFFER_SIZE = 1024;      // 写入缓冲区的大小（1024字节）
+    static const int MAX_HEADER_COUNT = 100;        // 单个请求允许的最大请求头数量
+    static const long MAX_BODY_SIZE = 8 << 20;      // 请求体（含分块编码解码后）的最大长度（8MB）
+    static const int HEADER_TIMEOUT = 10;           // 从请求的第一个字节（或 accept）到请求头收齐的期限（秒），收到数据不顺延
+    static const int BODY_TIMEOUT = 10;             // 请求体的基础期限，每收到 MIN_RATE 字节顺延一秒
+    static const int WRITE_TIMEOUT = 20;            // 从开始处理请求到响应发完的基础期限，每发出 MIN_RATE 字节顺延一秒；须大于反向代理的 RELAY_TIMEOUT_MS
+    static const int KEEPALIVE_TIMEOUT = 15;        // 长连接在两个请求之间的空闲期限
+    static const int MIN_RATE = 4096;               // 请求体和响应的最低传输速率（字节/秒）
+    // 以上期限和速率为默认值，运行中生效的是下面的 m_*_timeout/m_min_rate，收到 SIGHUP 时从配置文件重新加载
     enum METHOD
     {
         GET = 0,
@@ -50,6 +77,25 @@ public:
         CHECK_STATE_HEADER,
         CHECK_STATE_CONTENT
     };
+    enum PHASE
+    {
+        PHASE_IDLE = 0,         // 长连接等待下一个请求
+        PHASE_HEADER,           // 读取请求行和请求头（含 TLS 握手）
+        PHASE_BODY,             // 读取请求体
+        PHASE_WRITE             // 处理请求并发送响应
+    };
+    enum LANE
+    {
+        LANE_FAST = 0,          // 静态文件等开销小的请求
+        LANE_SLOW               // 反向代理、登录注册等可能长时间占用工作线程的请求
+    };
+    enum CHUNK_STATE
+    {
+        CHUNK_SIZE = 0,         // 等待分块长度行
+        CHUNK_DATA,             // 读取分块数据
+        CHUNK_DATA_END,         // 分块数据后的 CRLF
+        CHUNK_TRAILER           // 最后一个分块之后的 trailer 头部，空行结束
+    };
     enum HTTP_CODE
     {
         NO_REQUEST,             // 请求不完整，需要继续读取请求报文数据；跳转主线程继续监测读事件
@@ -59,7 +105,17 @@ public:
         FORBIDDEN_REQUEST,      // 请求资源没有访问权限；跳转process_write完成响应报文
         FILE_REQUEST,           // 请求资源有效，跳转process_write完成响应报文
         INTERNAL_ERROR,         // 服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        ASYNC_REQUEST,          // 请求已交给协程（口令校验线程池、主线程上的上游交换），由其完成后再生成响应报文
+        SERVICE_UNAVAILABLE,    // 口令校验线程池已满或请求被过载控制丢弃；跳转process_write回复503
+        DYNAMIC_REQUEST,        // 完整响应报文由处理函数生成在 m_dynamic_body 中（可能已部分发出）
+        ENTITY_TOO_LARGE,       // 请求体超过 MAX_BODY_SIZE；跳转process_write回复413
+        H2_UPGRADE,             // 请求携带 Upgrade: h2c，切换到 HTTP/2 后作为流 1 处理
+        WS_UPGRADE,             // WebSocket 握手有效；跳转process_write回复101，发送完毕后切换协议
+        BAD_GATEWAY,            // 反向代理连不上上游或上游响应无效；跳转process_write回复502
+        GATEWAY_TIMEOUT,        // 反向代理的上游未在时限内响应；跳转process_write回复504
+        CACHED_REQUEST,         // 反向代理的响应取自缓存：响应头在 m_dynamic_body 中，响应体为 m_cached 的内容
+        TOO_MANY_REQUESTS       // 客户端地址超出请求速率；跳转process_write回复429
     };
     enum LINE_STATUS
     {
@@ -69,8 +125,8 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_conn_gen(0), m_read_buf(NULL), m_h2_parked(false), m_proxy_wait(NULL), m_ssl(NULL) {}
+    ~http_conn() { delete[] m_read_buf; }
 
 public:
     void init(int sockfd, const sockaddr_in &addr, char *, int, int, std::string user, std::string passwd, std::string sqlname);
@@ -78,23 +134,104 @@ public:
     void process();
     bool read_once();
     bool write();
+    //过载时由线程池代替 process() 调用：不解析请求，直接回复 503 并关闭连接
+    void shed();
+    //入队时由线程池调用，返回请求所属的车道（LANE）
+    int lane();
+    //TLS 连接在读缓冲区满时，已解密的数据可能还留在 OpenSSL 中；WebSocket 连接的数据不经过线程池；
+    //正在转发代理响应体、或响应尚未发完（读缓冲区中还是当前请求）时不处理下一个请求
+    bool has_buffered_request() const
+    {
+        return !m_ws && !m_proxy && m_phase.load(std::memory_order_relaxed) != PHASE_WRITE &&
+               (m_read_idx > 0 || (m_ssl && SSL_pending(m_ssl) > 0));
+    }
     sockaddr_in *get_address()
     {
         return &m_address;
     }
     void initmysql_result(connection_pool *connPool);
+    //修改各阶段期限和最低速率，对之后的定时检查生效
+    static void set_timeouts(int header, int body, int write, int keepalive, int min_rate);
+    //WebSocket：升级后的连接只在主线程中收发，返回 false 时由调用方关闭连接
+    bool is_websocket() const { return m_ws != nullptr; }
+    //HTTP/1.1 长连接正在等待下一个请求、没有未处理的数据：排空时可以直接关闭
+    bool idle_keep_alive() const
+    {
+        return !m_ws && !m_h2 && !m_proxy && m_phase.load(std::memory_order_relaxed) == PHASE_IDLE && !has_buffered_request();
+    }
+    bool ws_read();
+    bool ws_write();
+    bool ws_send(const ws_frame_ptr &frame);
+    bool ws_keepalive();
+    //反向代理：中止正在转发的响应体或还在等待上游的请求，归还或回收上游连接（连接关闭、定时器超时时调用）
+    void proxy_abort();
+    //当前阶段的截止时间，由主线程的定时器读取；WebSocket 连接返回 0，沿用空闲定时器
+    time_t deadline() const;
     int timer_flag;     // 用于标记连接是否超时
     int improv;         // 标记连接是否需要改进（例如，是否需要执行某些额外操作，如超时处理、状态调整等）
 
 
 private:
+    //挂起在事件循环上的 proxy_async 协程的等待状态，位于协程帧中，登记在连接上供 proxy_abort 取消
+    struct proxy_wait
+    {
+        upstream_conn conn;                 // 正在连接或交换的上游连接，取消其描述符上的等待
+        std::string key;                    // 正在等待的同一 key 的获取
+        std::coroutine_handle<> flight;     // 挂起在该获取上时为协程本身，否则为空
+    };
+
+    //HTTP/2 推迟响应的流的异步结果：在主线程中投递，由连接的持有者在会话中给出响应
+    struct h2_result
+    {
+        uint32_t stream_id;
+        std::function<void(h2_stream &)> respond;
+    };
+
     void init();
+    void keep_alive_reset();
+    void set_phase(PHASE phase);
+    static LANE route_lane(const route *r, bool proxied);
+    void received(size_t n);
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
+    HTTP_CODE parse_chunked();
+    void compact_body();
     HTTP_CODE do_request();
+    HTTP_CODE do_verify(bool is_login);
+    coro_task<void> verify_async(bool is_login, std::string name, std::string password, bool *rejected);
+    void finish_async(int sockfd, unsigned int conn_gen, const char *url, const std::string &session);
+    //协程挂起后继续时判断连接是否仍是发起时的那个。只在主线程中调用，与定时器关闭、复用连接不会并发
+    bool still_owned(int sockfd, unsigned int conn_gen) const
+    {
+        assert(coro_loop::get_instance()->on_loop());
+        return m_sockfd == sockfd && m_conn_gen == conn_gen;
+    }
+    HTTP_CODE do_metrics();
+    HTTP_CODE do_websocket();
+    HTTP_CODE do_proxy(upstream_pool *pool);
+    relay_headers request_headers();
+    std::string proxy_head(const char *method, const std::string &path, const relay_headers &headers, size_t body_len);
+    CACHE_STATUS proxy_lookup(upstream_pool *pool, const char *method, const std::string &path,
+                              const relay_headers &headers, const std::string &body, std::string &head,
+                              std::string &key, std::shared_ptr<const cached_response> &cached, const char *&x_cache,
+                              bool waited = false);
+    static coro_task<RELAY_RESULT> proxy_fetch(CACHE_STATUS status, upstream_pool *pool, const char *method,
+                                               const std::string &head, const std::string &path,
+                                               const relay_headers &headers, const std::string &body,
+                                               const std::string &key, upstream_conn &conn, upstream_response &resp,
+                                               std::string &in, std::shared_ptr<const cached_response> &cached);
+    coro_task<void> proxy_async(upstream_pool *pool, CACHE_STATUS status, const char *method, const char *x_cache,
+                                std::string path, relay_headers headers, std::string head, std::string body,
+                                std::string key);
+    HTTP_CODE proxy_response(upstream_pool *pool, RELAY_RESULT result, const char *x_cache, upstream_conn &conn,
+                             upstream_response &resp, const std::string &in);
+    int proxy_pump();
+    void proxy_finish(bool ok);
+    std::string metrics_text();
+    HTTP_CODE map_file(const char *url);
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
     void unmap();
@@ -102,24 +239,70 @@ private:
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
-    bool add_content_type();
+    bool add_content_type(const char *type);
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_retry_after(int seconds);
+    bool add_session_cookie();
+    void begin_chunked(int status, const char *title, const char *content_type);
+    void add_chunk(const char *data, size_t len);
+    void end_chunked();
+    void flush_chunked();
+    void parse_cookie(char *text);
+    bool add_date();
+    const char *verify_login(const std::string &name, const std::string &password);
+    const char *register_user(const std::string &name, const std::string &password);
+    void upgrade_legacy_password(const std::string &name, const std::string &password);
+    void start_h2(bool upgrade);
+    void process_h2();
+    bool write_h2();
+    int flush_iov();
+    ssize_t sock_read(char *buf, size_t len);
+    ssize_t sock_writev(const struct iovec *iov, int count);
+    int tls_handshake();
+    void tls_free(bool notify);
+    void h2_request(h2_stream &stream);
+    void h2_file(h2_stream &stream, const char *url, const std::string &session);
+    void h2_error(h2_stream &stream, int status, const char *form);
+    void h2_proxy(h2_stream &stream, upstream_pool *pool);
+    coro_task<void> h2_proxy_async(upstream_pool *pool, CACHE_STATUS status, uint32_t stream_id, const char *x_cache,
+                                   std::string method, std::string path, relay_headers headers, std::string head,
+                                   std::string body, std::string key);
+    void h2_proxy_respond(h2_stream &stream, RELAY_RESULT result, const char *x_cache, const upstream_response &resp);
+    coro_task<void> h2_verify_async(bool is_login, uint32_t stream_id, std::string name, std::string password,
+                                    bool *rejected);
+    void h2_complete(int sockfd, unsigned int conn_gen, uint32_t stream_id, std::function<void(h2_stream &)> respond);
+    void h2_rearm(int ev);
+    void h2_unpark();
+    void h2_drain();
+    void start_ws();
+    int ws_flush();
 
 public:
     static int m_epollfd;
     static int m_user_count;
-    MYSQL *mysql;
+    static std::atomic<unsigned long> m_shed_count;     // 被过载控制丢弃的请求数
+    static std::atomic<bool> m_draining;                // 平滑升级排空中：响应后关闭连接，不再保持长连接
+    static int m_read_buffer_size;                      // 读缓冲区大小，只在启动时设置
+    static std::atomic<int> m_header_timeout;           // 当前生效的各阶段期限和最低速率
+    static std::atomic<int> m_body_timeout;
+    static std::atomic<int> m_write_timeout;
+    static std::atomic<int> m_keepalive_timeout;
+    static std::atomic<int> m_min_rate;
+    static verify_pool *m_verify_pool;
+    static threadpool<http_conn> *m_threadpool;         // 处理请求的线程池，用于输出运行指标
     int m_state;                                // 读为0, 写为1
 
 private:
     int m_sockfd;                               // 客户端的 socket 文件描述符
+    unsigned int m_conn_gen;                    // 连接代数，每次复用该对象时加一，异步任务据此判断连接是否已失效
     sockaddr_in m_address;                      // 客户端地址
-    char m_read_buf[READ_BUFFER_SIZE];          // 读缓冲区
+    char *m_read_buf;                           // 读缓冲区，第一次使用该对象时分配 m_read_buffer_size 字节
     long m_read_idx;                            // 当前已经读入缓冲区的数据的最后一个字节的下一个位置
     long m_checked_idx;                         // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;                           // 当前正在解析的行的起始位置
+    long m_header_start;                        // 第一个请求头在读缓冲区中的位置，反向代理据此遍历全部请求头
     char m_write_buf[WRITE_BUFFER_SIZE];        // 写缓冲区
     int m_write_idx;                            // 当前写缓冲区中已经读入的字符个数
     CHECK_STATE m_check_state;                  // 主状态机当前所处的状态
@@ -129,15 +312,49 @@ private:
     char *m_version;                            // HTTP 版本
     char *m_host;                               // Host 头
     long m_content_length;                      // 请求内容的长度
+    int m_header_count;                         // 已解析的请求头数量
+    long m_body_start;                          // 请求体在读缓冲区中的起始位置
+    long m_body_remaining;                      // 尚未到达的请求体（或当前分块）字节数
+    bool m_chunked;                             // 请求体是否使用分块传输编码
+    CHUNK_STATE m_chunk_state;                  // 分块解码状态
+    std::string m_body;                         // 请求体，边到达边从读缓冲区转存，读缓冲区随即回收
+    bool m_session_valid;                       // 请求是否携带了有效的会话 Cookie
+    char m_session_token[session_store::TOKEN_LEN + 1];    // 本次响应需要通过 Set-Cookie 下发的新会话 token
     bool m_linger;                              // 是否保持连接
-    char *m_file_address;                       // 映射到内存中的文件地址
+    char *m_file_address;                       // 映射到内存中的文件地址（或静态缓存中所选编码版本的地址）
+    std::shared_ptr<const static_entry> m_static;   // 本次响应使用的静态缓存条目，发送完毕后释放
+    const static_body *m_static_body;           // 按 Accept-Encoding 选中的表示，带预先生成的响应头
+    bool m_accept_gzip;                         // 客户端接受 gzip
+    bool m_accept_br;                           // 客户端接受 brotli
+    bool m_upgrade_h2c;                         // 请求携带 Upgrade: h2c
+    char *m_http2_settings;                     // HTTP2-Settings 头
+    bool m_upgrade_ws;                          // 请求携带 Upgrade: websocket
+    char *m_ws_key;                             // Sec-WebSocket-Key 头
+    int m_ws_version;                           // Sec-WebSocket-Version 头
+    std::string m_ws_accept;                    // 握手有效时计算出的 Sec-WebSocket-Accept，101 发送完毕后切换协议
+    std::unique_ptr<ws_session> m_ws;           // 切换到 WebSocket 之后的会话
+    std::unique_ptr<h2_session> m_h2;           // 切换到 HTTP/2 之后的会话，HTTP/1.1 连接为空
+    std::mutex m_h2_mutex;                      // 保护下面两项：主线程投递异步结果与持有者注册事件互斥
+    std::vector<h2_result> m_h2_results;        // 已完成、尚未交给会话的推迟响应
+    bool m_h2_parked;                           // 持有者已注册事件并交出连接，投递结果时需改为等待写事件
+    std::unique_ptr<proxy_stream> m_proxy;      // 正在向客户端转发的上游响应体
+    proxy_wait *m_proxy_wait;                   // 还在等待上游的 proxy_async 协程，只在主线程中访问
+    std::shared_ptr<const cached_response> m_cached;    // 本次响应使用的代理缓存条目，发送完毕后释放
+    SSL *m_ssl;                                 // TLS 连接的 SSL 对象，明文连接为空
+    bool m_tls_ready;                           // TLS 握手已完成（明文连接恒为 true）
+    bool m_ktls_send;                           // kTLS 发送侧生效，可以直接 writev 到 socket
     struct stat m_file_stat;                    // 文件状态
-    struct iovec m_iv[2];                       // 数据的结构体，用于写操作
+    struct iovec m_iv[3];                       // 数据的结构体，用于写操作
     int m_iv_count;                             // iovec 数组的大小
     int cgi;                                    // 是否是 POST 请求
-    char *m_string;                             // 存储请求头数据
+    std::string m_dynamic_body;                 // 动态生成的完整响应报文
+    size_t m_stream_sent;                       // m_dynamic_body 中已提前发出的字节数
     int bytes_to_send;                          // 需要发送的数据总长度
     int bytes_have_send;                        // 已经发送的字节数
+    std::atomic<int> m_phase;                   // 所处阶段，决定定时器的截止时间；工作线程推进，主线程读取
+    std::atomic<time_t> m_phase_start;          // 进入该阶段的时刻
+    std::atomic<size_t> m_phase_bytes;          // 该阶段已收发的字节数
+    int m_lane;                                 // 最近一个请求的车道，请求行尚未读到时据此入队
     char *doc_root;                             // 网站根目录
 
     std::map<std::string, std::string> m_users; // 保存所有用户名和密码
@@ -0,0 +1,232 @@
+#include "http_scan.h"
+#include "const_hash.h"
+
+#include <array>
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+static const char *find_line_end_scalar(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n')
+            return p;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+//SSE4.2：PCMPESTRI 一次比较 16 字节与字符集合 {'\r', '\n'}
+__attribute__((target("sse4.2")))
+static const char *find_line_end_sse42(const char *p, const char *end)
+{
+    const __m128i crlf = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int idx = _mm_cmpestri(crlf, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY);
+        if (idx < 16)
+            return p + idx;
+    }
+    return find_line_end_scalar(p, end);
+}
+
+//AVX2：一次比较 32 字节，分别与 '\r'、'\n' 比较后取掩码
+__attribute__((target("avx2")))
+static const char *find_line_end_avx2(const char *p, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_line_end_scalar(p, end);
+}
+#endif
+
+typedef const char *(*scan_fn)(const char *, const char *);
+
+struct scan_impl
+{
+    scan_fn fn;
+    const char *name;
+};
+
+//启动时根据 CPUID 选择一次实现
+static scan_impl select_scan_impl()
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_impl{find_line_end_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2"))
+        return scan_impl{find_line_end_sse42, "sse4.2"};
+#endif
+    return scan_impl{find_line_end_scalar, "scalar"};
+}
+
+static const scan_impl g_scan_impl = select_scan_impl();
+
+const char *find_line_end(const char *begin, const char *end)
+{
+    return g_scan_impl.fn(begin, end);
+}
+
+const char *scan_impl_name()
+{
+    return g_scan_impl.name;
+}
+
+struct header_entry
+{
+    const char *name;   // 小写头部名
+    size_t len;
+    HEADER_ID id;
+};
+
+static constexpr header_entry KNOWN_HEADERS[] = {
+    {"connection", 10, HEADER_CONNECTION},
+    {"content-length", 14, HEADER_CONTENT_LENGTH},
+    {"host", 4, HEADER_HOST},
+    {"cookie", 6, HEADER_COOKIE},
+    {"transfer-encoding", 17, HEADER_TRANSFER_ENCODING},
+    {"accept-encoding", 15, HEADER_ACCEPT_ENCODING},
+    {"upgrade", 7, HEADER_UPGRADE},
+    {"http2-settings", 14, HEADER_HTTP2_SETTINGS},
+    {"sec-websocket-key", 17, HEADER_SEC_WEBSOCKET_KEY},
+    {"sec-websocket-version", 21, HEADER_SEC_WEBSOCKET_VERSION},
+};
+
+static constexpr size_t HEADER_NUM = sizeof(KNOWN_HEADERS) / sizeof(KNOWN_HEADERS[0]);
+static constexpr size_t HEADER_SLOTS = 64;
+
+//编译期构造的开放寻址哈希表，按不区分大小写的 FNV-1a 查找（表中的名字已是小写）
+static constexpr std::array<int, HEADER_SLOTS> HEADER_SLOT_TABLE = build_hash_slots<HEADER_SLOTS>(
+    KNOWN_HEADERS, [](const header_entry &e) { return fnv1a(e.name, e.len, true); });
+
+static_assert(HEADER_NUM < HEADER_SLOTS, "header table is full, enlarge HEADER_SLOTS");
+
+HEADER_ID lookup_header(const char *name, size_t len)
+{
+    size_t pos = fnv1a(name, len, true) & (HEADER_SLOTS - 1);
+    while (HEADER_SLOT_TABLE[pos] != -1)
+    {
+        const header_entry &e = KNOWN_HEADERS[HEADER_SLOT_TABLE[pos]];
+        if (e.len == len)
+        {
+            size_t i = 0;
+            for (; i < len; ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(name[i]);
+                if (c >= 'A' && c <= 'Z')
+                    c = c - 'A' + 'a';
+                if (c != static_cast<unsigned char>(e.name[i]))
+                    break;
+            }
+            if (i == len)
+                return e.id;
+        }
+        pos = (pos + 1) & (HEADER_SLOTS - 1);
+    }
+    return HEADER_UNKNOWN;
+}
+
+size_t normalize_path(char *path, size_t len)
+{
+    size_t i = 0, out = 0;
+    while (i < len && path[i] != '?')
+    {
+        char c = path[i];
+        bool after_slash = out > 0 && path[out - 1] == '/';
+        if (c == '/' && after_slash)
+        {
+            ++i;
+            continue;
+        }
+        if (c == '.' && after_slash && (i + 1 == len || path[i + 1] == '/' || path[i + 1] == '?'))
+        {
+            i += (i + 1 < len && path[i + 1] == '/') ? 2 : 1;
+            continue;
+        }
+        path[out++] = c;
+        ++i;
+    }
+    while (i < len)
+        path[out++] = path[i++];
+    return out;
+}
+
+void parse_accept_encoding(const char *text, size_t len, bool *gzip, bool *br)
+{
+    const char *end = text + len;
+    while (text < end)
+    {
+        while (text < end && (*text == ' ' || *text == '\t' || *text == ','))
+            ++text;
+        if (text >= end)
+            break;
+        //长度只算一次且非负，-O2 下 memchr 不会被判为越界读取（-Wstringop-overread）
+        size_t left = end - text;
+        const char *item_end = (const char *)memchr(text, ',', left);
+        size_t item_len = item_end ? (size_t)(item_end - text) : left;
+        item_end = text + item_len;
+        size_t name_len = 0;
+        while (name_len < item_len && text[name_len] != ';' && text[name_len] != ' ' && text[name_len] != '\t')
+            ++name_len;
+
+        bool accepted = true;
+        const char *q = (const char *)memchr(text, ';', item_len);
+        if (q)
+        {
+            ++q;
+            while (q < item_end && (*q == ' ' || *q == '\t'))
+                ++q;
+            //q 值只允许 0~1 且最多三位小数，全为 0 即拒绝
+            if (item_end - q >= 3 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=' && q[2] == '0')
+            {
+                accepted = false;
+                for (const char *d = q + 3; d < item_end && *d != ' ' && *d != '\t'; ++d)
+                {
+                    if (*d != '.' && *d != '0')
+                        accepted = true;
+                }
+            }
+        }
+
+        if (name_len == 4 && strncasecmp(text, "gzip", 4) == 0)
+            *gzip = accepted;
+        else if (name_len == 2 && strncasecmp(text, "br", 2) == 0)
+            *br = accepted;
+        text = item_end;
+    }
+}
+
+const char *find_cookie(const char *text, size_t len, const char *name, size_t *value_len)
+{
+    size_t name_len = strlen(name);
+    const char *end = text + len;
+    while (text < end)
+    {
+        while (text < end && (*text == ' ' || *text == '\t' || *text == ';'))
+            ++text;
+        const char *item_end = (const char *)memchr(text, ';', end - text);
+        if (!item_end)
+            item_end = end;
+        if ((size_t)(item_end - text) > name_len && strncmp(text, name, name_len) == 0 && text[name_len] == '=')
+        {
+            *value_len = item_end - text - name_len - 1;
+            return text + name_len + 1;
+        }
+        text = item_end;
+    }
+    return NULL;
+}
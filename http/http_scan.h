@@ -0,0 +1,46 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 请求报文扫描工具：
+// 1. find_line_end 在 [begin, end) 中查找第一个 '\r' 或 '\n'，按 CPU 能力在运行时选择
+//    AVX2（32 字节一步）、SSE4.2（16 字节一步）或逐字节的标量实现；
+// 2. lookup_header 用不区分大小写的 FNV-1a 哈希识别常见请求头，替代逐个 strncasecmp；
+// 3. 若干请求路径和头部值的解析函数，HTTP/1.1 和 HTTP/2 共用。
+
+// 返回第一个行结束符的位置，没有时返回 end
+const char *find_line_end(const char *begin, const char *end);
+
+// 当前选用的扫描实现名称（"avx2"/"sse4.2"/"scalar"），用于启动日志
+const char *scan_impl_name();
+
+enum HEADER_ID
+{
+    HEADER_UNKNOWN = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_COOKIE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_HTTP2_SETTINGS,
+    HEADER_SEC_WEBSOCKET_KEY,
+    HEADER_SEC_WEBSOCKET_VERSION
+};
+
+HEADER_ID lookup_header(const char *name, size_t len);
+
+// 就地规范化请求路径：合并连续的 '/'，去掉 "/./" 中的 "./"（以及结尾的 "/."），'?' 之后的查询串原样保留。
+// 返回规范化后的长度，查找路由和访问控制都以规范化后的路径为准
+size_t normalize_path(char *path, size_t len);
+
+// 解析 Accept-Encoding，例如 "gzip, deflate, br;q=0.8"，q=0 表示明确拒绝；只关心 gzip 和 br
+void parse_accept_encoding(const char *text, size_t len, bool *gzip, bool *br);
+
+// 在 Cookie 头中查找名为 name 的条目，返回值的起始位置并写入长度，没有时返回 NULL
+const char *find_cookie(const char *text, size_t len, const char *name, size_t *value_len);
+
+#endif
@@ -0,0 +1,88 @@
+#include "mime.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+int mime_table::load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    int count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *save = NULL;
+        char *type = strtok_r(line, " \t\r\n", &save);
+        if (!type || type[0] == '#')
+            continue;
+        char *ext;
+        while ((ext = strtok_r(NULL, " \t\r\n;", &save)) != NULL)
+        {
+            if (ext[0] == '#')
+                break;
+            for (char *p = ext; *p; ++p)
+                *p = tolower((unsigned char)*p);
+            m_overrides[ext] = type;
+            ++count;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+const char *mime_table::lookup(const char *path, size_t len) const
+{
+    //取最后一个 '/' 之后的最后一个 '.' 之后的部分作为扩展名
+    size_t dot = len;
+    for (size_t i = len; i > 0; --i)
+    {
+        if (path[i - 1] == '/')
+            break;
+        if (path[i - 1] == '.')
+        {
+            dot = i;
+            break;
+        }
+    }
+    size_t ext_len = len - dot;
+    if (ext_len == 0 || ext_len > MIME_MAX_EXT)
+        return MIME_DEFAULT;
+
+    char ext[MIME_MAX_EXT + 1];
+    for (size_t i = 0; i < ext_len; ++i)
+        ext[i] = tolower((unsigned char)path[dot + i]);
+    ext[ext_len] = '\0';
+
+    if (!m_overrides.empty())
+    {
+        auto it = m_overrides.find(std::string(ext, ext_len));
+        if (it != m_overrides.end())
+            return it->second.c_str();
+    }
+
+    size_t pos = fnv1a(ext, ext_len) & (MIME_SLOTS - 1);
+    while (MIME_SLOT_TABLE[pos] != -1)
+    {
+        const mime_type &m = MIME_TYPES[MIME_SLOT_TABLE[pos]];
+        if (strcmp(m.ext, ext) == 0)
+            return m.type;
+        pos = (pos + 1) & (MIME_SLOTS - 1);
+    }
+    return MIME_DEFAULT;
+}
+
+bool mime_table::is_compressible(const char *type)
+{
+    if (strncmp(type, "text/", 5) == 0)
+        return true;
+    static const char *marks[] = {"javascript", "json", "xml"};
+    for (const char *mark : marks)
+    {
+        if (strstr(type, mark))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <unordered_map>
+
+#include "const_hash.h"
+
+// 扩展名 -> Content-Type。
+// 内置表在编译期构造成开放寻址哈希表；启动时可以再加载一个 mime.types 格式的文件覆盖或补充内置表。
+// 查找只在静态文件装入缓存（或大文件逐请求映射）时发生，类型字符串随后进入预先生成的响应头。
+
+struct mime_type
+{
+    const char *ext;    // 小写扩展名，不含 '.'
+    const char *type;
+};
+
+constexpr mime_type MIME_TYPES[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm",  "text/html; charset=utf-8"},
+    {"css",  "text/css; charset=utf-8"},
+    {"js",   "application/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt",  "text/plain; charset=utf-8"},
+    {"xml",  "application/xml"},
+    {"svg",  "image/svg+xml"},
+    {"ico",  "image/x-icon"},
+    {"jpg",  "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"png",  "image/png"},
+    {"gif",  "image/gif"},
+    {"webp", "image/webp"},
+    {"mp4",  "video/mp4"},
+    {"webm", "video/webm"},
+    {"mp3",  "audio/mpeg"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"pdf",  "application/pdf"},
+    {"wasm", "application/wasm"},
+};
+
+constexpr size_t MIME_NUM = sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]);
+constexpr size_t MIME_SLOTS = 64;       // 哈希槽数，2 的幂且远大于类型数
+constexpr size_t MIME_MAX_EXT = 15;     // 更长的扩展名不查表
+constexpr const char *MIME_DEFAULT = "application/octet-stream";
+
+// 编译期构造的哈希槽，槽内存放 MIME_TYPES 下标，-1 表示空槽
+constexpr std::array<int, MIME_SLOTS> MIME_SLOT_TABLE =
+    build_hash_slots<MIME_SLOTS>(MIME_TYPES, [](const mime_type &m) { return fnv1a(m.ext, cstrlen(m.ext)); });
+
+static_assert(MIME_NUM < MIME_SLOTS, "mime table is full, enlarge MIME_SLOTS");
+
+class mime_table
+{
+public:
+    static mime_table *get_instance()
+    {
+        static mime_table instance;
+        return &instance;
+    }
+
+    // 加载 mime.types 格式的文件（每行 "类型 扩展名..."，# 开头为注释），返回读到的扩展名个数，文件不存在返回 -1。
+    // 只应在工作线程启动前调用
+    int load(const char *path);
+
+    // 按文件路径的扩展名查找类型，未知扩展名返回 MIME_DEFAULT
+    const char *lookup(const char *path, size_t len) const;
+
+    // 文本类的类型值得压缩
+    static bool is_compressible(const char *type);
+
+private:
+    mime_table() {}
+    ~mime_table() {}
+
+    std::unordered_map<std::string, std::string> m_overrides;   // 扩展名 -> 类型，优先于内置表
+};
+
+#endif
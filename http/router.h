@@ -0,0 +1,96 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+
+#include "const_hash.h"
+
+// 路由表：method + path -> 处理方式。
+// 表在编译期构造成开放寻址哈希表，运行时查找只需一次 FNV-1a 哈希和极少量比较，
+// 不做任何堆分配；新增接口只需在 ROUTES 中加一行，不再增加 do_request 中的分支。
+
+// 请求方法掩码，取值为 1 << http_conn::METHOD
+const unsigned ROUTE_GET = 1u << 0;
+const unsigned ROUTE_POST = 1u << 1;
+const unsigned ROUTE_ANY = ~0u;
+
+enum ROUTE_HANDLER
+{
+    ROUTE_STATIC = 0,   // 静态文件，file 为空时使用请求路径本身
+    ROUTE_LOGIN,        // 登录校验
+    ROUTE_REGISTER,     // 注册
+    ROUTE_METRICS,      // 运行指标
+    ROUTE_WEBSOCKET     // WebSocket 升级，加入广播
+};
+
+struct route
+{
+    unsigned methods;           // 允许的方法掩码
+    const char *path;           // 完整匹配的请求路径
+    ROUTE_HANDLER handler;      // 处理方式
+    const char *file;           // 静态文件路由映射到的文件
+    bool need_session;          // 是否需要已登录会话（静态页面按映射到的文件检查，见 SESSION_FILES）
+};
+
+constexpr route ROUTES[] = {
+    {ROUTE_ANY,  "/",             ROUTE_STATIC,    "/judge.html",    false},
+    {ROUTE_ANY,  "/0",            ROUTE_STATIC,    "/register.html", false},
+    {ROUTE_ANY,  "/1",            ROUTE_STATIC,    "/log.html",      false},
+    {ROUTE_POST, "/2CGISQL.cgi",  ROUTE_LOGIN,     nullptr,          false},
+    {ROUTE_POST, "/3CGISQL.cgi",  ROUTE_REGISTER,  nullptr,          false},
+    {ROUTE_ANY,  "/5",            ROUTE_STATIC,    "/picture.html",  false},
+    {ROUTE_ANY,  "/6",            ROUTE_STATIC,    "/video.html",    false},
+    {ROUTE_ANY,  "/7",            ROUTE_STATIC,    "/fans.html",     false},
+    {ROUTE_GET,  "/metrics",      ROUTE_METRICS,   nullptr,          false},
+    {ROUTE_GET,  "/ws",           ROUTE_WEBSOCKET, nullptr,          true},
+};
+
+// 需要已登录会话才能访问的页面。路由和登录结果都映射到文件，映射前按文件名检查，
+// 直接按文件名请求（/picture.html）与经由路由（/5）请求受到同样的保护
+constexpr const char *SESSION_FILES[] = {"/welcome.html", "/picture.html", "/video.html", "/fans.html"};
+
+inline bool file_needs_session(const char *file)
+{
+    for (const char *f : SESSION_FILES)
+    {
+        const char *p = file;
+        const char *q = f;
+        while (*q && *p == *q)
+            ++p, ++q;
+        //查询串不属于文件名
+        if (*q == '\0' && (*p == '\0' || *p == '?'))
+            return true;
+    }
+    return false;
+}
+
+constexpr size_t ROUTE_NUM = sizeof(ROUTES) / sizeof(ROUTES[0]);
+constexpr size_t ROUTE_SLOTS = 32;      // 哈希槽数，2 的幂且远大于路由数，探测链很短
+
+// 编译期构造的哈希槽，槽内存放 ROUTES 下标，-1 表示空槽
+constexpr std::array<int, ROUTE_SLOTS> ROUTE_SLOT_TABLE =
+    build_hash_slots<ROUTE_SLOTS>(ROUTES, [](const route &r) { return fnv1a(r.path, cstrlen(r.path)); });
+
+static_assert(ROUTE_NUM < ROUTE_SLOTS, "route table is full, enlarge ROUTE_SLOTS");
+
+// 查找路由，未命中返回 nullptr（按普通静态文件处理）
+inline const route *find_route(unsigned method, const char *path, size_t len)
+{
+    size_t pos = fnv1a(path, len) & (ROUTE_SLOTS - 1);
+    while (ROUTE_SLOT_TABLE[pos] != -1)
+    {
+        const route &r = ROUTES[ROUTE_SLOT_TABLE[pos]];
+        const char *p = r.path;
+        size_t i = 0;
+        while (i < len && p[i] && p[i] == path[i])
+            ++i;
+        if (i == len && p[i] == '\0')
+            return (r.methods & method) ? &r : nullptr;
+        pos = (pos + 1) & (ROUTE_SLOTS - 1);
+    }
+    return nullptr;
+}
+
+#endif
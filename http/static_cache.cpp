@@ -0,0 +1,395 @@
+#include "static_cache.h"
+#include "mime.h"
+#include "hpack.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+static_body::~static_body()
+{
+    if (map)
+        munmap(map, map_len);
+}
+
+void static_cache::init(size_t byte_budget, size_t max_file_size, bool compress)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byte_budget = byte_budget;
+    m_max_file_size = max_file_size;
+    m_compress = compress;
+}
+
+//预压缩的兄弟文件随原文件一起装入，不单独预热
+static bool is_sibling(const std::string &path)
+{
+    size_t n = path.size();
+    return n > 3 && (path.compare(n - 3, 3, ".gz") == 0 || path.compare(n - 3, 3, ".br") == 0);
+}
+
+static void collect_files(const std::string &path, std::vector<std::pair<off_t, std::string>> &files)
+{
+    std::error_code ec;
+    if (std::filesystem::is_regular_file(path, ec))
+    {
+        files.emplace_back(std::filesystem::file_size(path, ec), path);
+        return;
+    }
+    std::filesystem::recursive_directory_iterator it(path, std::filesystem::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec))
+    {
+        if (it->is_regular_file(ec) && !is_sibling(it->path().string()))
+            files.emplace_back(it->file_size(ec), it->path().string());
+    }
+}
+
+static_cache::prewarm_stats static_cache::prewarm(const char *doc_root, const char *list_file, size_t byte_budget, bool lock)
+{
+    prewarm_stats stats = {0, 0, 0, 0.0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::pair<off_t, std::string>> files;
+    FILE *fp = fopen(list_file, "r");
+    if (fp)
+    {
+        char line[1024];
+        while (fgets(line, sizeof(line), fp))
+        {
+            char *comment = strchr(line, '#');
+            if (comment)
+                *comment = '\0';
+            char *save = NULL;
+            char *rel = strtok_r(line, " \t\r\n", &save);
+            if (rel)
+                collect_files(std::string(doc_root) + (rel[0] == '/' ? "" : "/") + rel, files);
+        }
+        fclose(fp);
+    }
+    else
+    {
+        collect_files(doc_root, files);
+    }
+
+    //先装小文件，同样的预算覆盖尽可能多的资源；超过缓存预算的部分装入后也会被淘汰
+    std::sort(files.begin(), files.end());
+    byte_budget = std::min(byte_budget, m_byte_budget.load());
+    for (const std::pair<off_t, std::string> &file : files)
+    {
+        if (stats.bytes + (size_t)file.first > byte_budget)
+            break;
+        std::shared_ptr<const static_entry> entry;
+        struct stat st;
+        if (acquire(file.second.c_str(), entry, &st, BROTLI_PREWARM_QUALITY) != STATIC_OK)
+            continue;
+        stats.files++;
+        stats.bytes += entry_bytes(*entry);
+        if (!lock)
+            continue;
+        for (const static_body *body : {entry->identity.get(), entry->gzip.get(), entry->br.get()})
+        {
+            if (body && body->map && mlock(body->map, body->map_len) != 0)
+                stats.lock_failed++;
+        }
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+static STATIC_STATUS check_stat(const struct stat &st)
+{
+    if (!(st.st_mode & S_IROTH))
+        return STATIC_FORBIDDEN;
+    if (S_ISDIR(st.st_mode))
+        return STATIC_IS_DIR;
+    return STATIC_OK;
+}
+
+STATIC_STATUS static_cache::acquire(const char *path, std::shared_ptr<const static_entry> &out, struct stat *st,
+                                    int br_quality)
+{
+    std::string key(path);
+    time_t now = time(NULL);
+    std::shared_ptr<static_entry> cached;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            cached = *it->second;
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            if (now - cached->checked_at < REVALIDATE_INTERVAL)
+            {
+                *st = cached->st;
+                out = cached;
+                return STATIC_OK;
+            }
+        }
+    }
+
+    if (stat(path, st) < 0)
+        return STATIC_NOT_FOUND;
+    STATIC_STATUS status = check_stat(*st);
+    if (status != STATIC_OK)
+        return status;
+
+    //文件未变化，只刷新校验时间
+    if (cached && cached->st.st_mtime == st->st_mtime && cached->st.st_size == st->st_size && cached->st.st_ino == st->st_ino)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cached->checked_at = now;
+        out = cached;
+        return STATIC_OK;
+    }
+
+    if (m_byte_budget == 0 || (size_t)st->st_size > m_max_file_size || st->st_size == 0)
+        return STATIC_BYPASS;
+
+    //同一文件的并发未命中只由第一个线程装入，其余这一次直接映射原文件，不重复压缩
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_loading.insert(key).second)
+            return STATIC_BYPASS;
+    }
+    std::shared_ptr<static_entry> entry = load(key, *st, br_quality);
+    if (entry)
+        insert(entry);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loading.erase(key);
+    }
+    if (!entry)
+        return STATIC_BYPASS;
+    out = entry;
+    return STATIC_OK;
+}
+
+std::shared_ptr<static_entry> static_cache::load(const std::string &path, const struct stat &st, int br_quality)
+{
+    std::shared_ptr<static_entry> entry = std::make_shared<static_entry>();
+    entry->path = path;
+    entry->st = st;
+    entry->checked_at = time(NULL);
+    const char *type = mime_table::get_instance()->lookup(path.c_str(), path.size());
+    entry->compressible = mime_table::is_compressible(type);
+    std::shared_ptr<static_body> identity = map_file(path, st);
+    if (!identity)
+        return nullptr;
+
+    std::shared_ptr<static_body> gzip, br;
+    if (entry->compressible)
+    {
+        //优先使用预压缩的兄弟文件，没有时按需压缩一次
+        gzip = map_sibling(path + ".gz", st);
+        br = map_sibling(path + ".br", st);
+        if (m_compress && (size_t)st.st_size >= MIN_COMPRESS_SIZE)
+        {
+            if (!gzip)
+                gzip = compress_gzip(identity->data, identity->len);
+            if (!br)
+                br = compress_brotli(identity->data, identity->len, br_quality);
+        }
+    }
+
+    //每种表示的响应头在装入时生成一次，之后每个请求直接引用
+    bool vary = gzip || br;
+    build_header(*identity, st, type, NULL, vary);
+    if (gzip)
+        build_header(*gzip, st, type, "gzip", vary);
+    if (br)
+        build_header(*br, st, type, "br", vary);
+
+    entry->identity = identity;
+    entry->gzip = gzip;
+    entry->br = br;
+    return entry;
+}
+
+int static_cache::format_etag(const struct stat &st, const char *encoding, char *buf, size_t size)
+{
+    return snprintf(buf, size, "\"%lx-%lx%s%s\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size,
+                    encoding ? "-" : "", encoding ? encoding : "");
+}
+
+//与 load() 的判断一致：有预压缩的兄弟文件，或会按需压缩（压缩收益不足时实际没有压缩版本，多带 Vary 无害）
+bool static_cache::bypass_vary(const char *path, const struct stat &st) const
+{
+    if (m_byte_budget == 0 || (size_t)st.st_size > m_max_file_size || st.st_size == 0)
+        return false;
+    size_t path_len = strlen(path);
+    if (!mime_table::is_compressible(mime_table::get_instance()->lookup(path, path_len)))
+        return false;
+    if (m_compress && (size_t)st.st_size >= MIN_COMPRESS_SIZE)
+        return true;
+    std::string sibling(path, path_len);
+    struct stat sst;
+    for (const char *ext : {".gz", ".br"})
+    {
+        sibling.resize(path_len);
+        sibling.append(ext);
+        if (stat(sibling.c_str(), &sst) == 0 && S_ISREG(sst.st_mode) && sst.st_size > 0 && sst.st_mtime >= st.st_mtime)
+            return true;
+    }
+    return false;
+}
+
+void static_cache::build_header(static_body &body, const struct stat &st, const char *type,
+                                const char *encoding, bool vary)
+{
+    char length[24], etag[64];
+    int length_len = snprintf(length, sizeof(length), "%zu", body.len);
+    int etag_len = format_etag(st, encoding, etag, sizeof(etag));
+
+    body.header.assign("HTTP/1.1 200 OK\r\n");
+    body.header.append("Content-Length:").append(length, length_len).append("\r\n");
+    body.header.append("ETag:").append(etag, etag_len).append("\r\n");
+    body.header.append("Content-Type:").append(type).append("\r\n");
+    if (encoding)
+        body.header.append("Content-Encoding:").append(encoding).append("\r\n");
+    if (vary)
+        body.header.append("Vary:Accept-Encoding\r\n");
+
+    //同样的头部再按 HPACK 编码一份，供 HTTP/2 流直接使用
+    body.h2_header.clear();
+    hpack_encode_status(body.h2_header, 200);
+    hpack_encode_header(body.h2_header, "content-length", length, length_len);
+    hpack_encode_header(body.h2_header, "etag", etag, etag_len);
+    hpack_encode_header(body.h2_header, "content-type", type, strlen(type));
+    if (encoding)
+        hpack_encode_header(body.h2_header, "content-encoding", encoding, strlen(encoding));
+    if (vary)
+        hpack_encode_header(body.h2_header, "vary", "accept-encoding", 15);
+}
+
+size_t static_cache::entry_bytes(const static_entry &entry)
+{
+    size_t bytes = entry.identity->len;
+    if (entry.gzip)
+        bytes += entry.gzip->len;
+    if (entry.br)
+        bytes += entry.br->len;
+    return bytes;
+}
+
+void static_cache::insert(const std::shared_ptr<static_entry> &entry)
+{
+    size_t bytes = entry_bytes(*entry);
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_index.find(entry->path);
+    if (it != m_index.end())
+    {
+        m_bytes -= entry_bytes(**it->second);
+        m_lru.erase(it->second);
+        m_index.erase(it);
+    }
+
+    evict(bytes);
+    if (bytes > m_byte_budget)
+        return;
+
+    m_lru.push_front(entry);
+    m_index[entry->path] = m_lru.begin();
+    m_bytes += bytes;
+}
+
+//从表尾淘汰最久未使用的条目，直到再放入 incoming 字节也不超出预算；调用方持有锁
+void static_cache::evict(size_t incoming)
+{
+    while (!m_lru.empty() && m_bytes + incoming > m_byte_budget)
+    {
+        const std::shared_ptr<static_entry> &victim = m_lru.back();
+        m_bytes -= entry_bytes(*victim);
+        m_index.erase(victim->path);
+        m_lru.pop_back();
+    }
+}
+
+void static_cache::set_budget(size_t byte_budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byte_budget = byte_budget;
+    evict(0);
+}
+
+std::shared_ptr<static_body> static_cache::map_file(const std::string &path, const struct stat &st)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    //缓存的文件总是整个发出，装入时就读入并建立页表，首个请求不再逐页缺页
+    void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<static_body> body = std::make_shared<static_body>();
+    body->map = addr;
+    body->map_len = st.st_size;
+    body->data = static_cast<const char *>(addr);
+    body->len = st.st_size;
+    return body;
+}
+
+//预压缩的兄弟文件必须不旧于原文件，否则视为过期不用
+std::shared_ptr<static_body> static_cache::map_sibling(const std::string &path, const struct stat &origin)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return nullptr;
+    if (st.st_mtime < origin.st_mtime)
+        return nullptr;
+    return map_file(path, st);
+}
+
+std::shared_ptr<static_body> static_cache::compress_gzip(const char *data, size_t len)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits 加 16 表示输出 gzip 格式
+    if (deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return nullptr;
+
+    std::shared_ptr<static_body> body = std::make_shared<static_body>();
+    body->owned.resize(deflateBound(&zs, len) + 32);
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&body->owned[0];
+    zs.avail_out = body->owned.size();
+    int ret = deflate(&zs, Z_FINISH);
+    size_t out_len = zs.total_out;
+    deflateEnd(&zs);
+
+    //压缩收益不足 10% 时不值得额外的 Vary 处理
+    if (ret != Z_STREAM_END || out_len >= len - len / 10)
+        return nullptr;
+    body->owned.resize(out_len);
+    body->data = body->owned.data();
+    body->len = out_len;
+    return body;
+}
+
+std::shared_ptr<static_body> static_cache::compress_brotli(const char *data, size_t len, int quality)
+{
+    std::shared_ptr<static_body> body = std::make_shared<static_body>();
+    size_t out_len = BrotliEncoderMaxCompressedSize(len);
+    if (out_len == 0)
+        return nullptr;
+    body->owned.resize(out_len);
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               len, (const uint8_t *)data, &out_len, (uint8_t *)&body->owned[0]))
+        return nullptr;
+    if (out_len >= len - len / 10)
+        return nullptr;
+    body->owned.resize(out_len);
+    body->data = body->owned.data();
+    body->len = out_len;
+    return body;
+}
@@ -0,0 +1,124 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// 静态资源的一种表示（原文、gzip 或 brotli）。
+// 内容要么来自文件的只读映射，要么是启动后压缩一次得到的字节串。
+struct static_body
+{
+    static_body() : data(NULL), len(0), map(NULL), map_len(0) {}
+    ~static_body();
+    static_body(const static_body &) = delete;
+    static_body &operator=(const static_body &) = delete;
+
+    const char *data;       // 内容起始地址
+    size_t len;             // 内容长度
+    std::string owned;      // 压缩生成的内容
+    void *map;              // 文件映射地址，析构时解除映射
+    size_t map_len;
+    std::string header;     // 预先生成的状态行及固定响应头（不含 Connection/Date 和结尾空行）
+    std::string h2_header;  // 同样的响应头按 HPACK 编码（含 :status），供 HTTP/2 使用
+};
+
+// 缓存中的一个静态文件及其各编码版本
+struct static_entry
+{
+    std::string path;                           // 文件完整路径
+    struct stat st;                             // 原文件状态
+    time_t checked_at;                          // 上一次 stat 校验的时间
+    bool compressible;                          // 是否为可压缩的文本类型（由 MIME 类型判断）
+    std::shared_ptr<const static_body> identity;
+    std::shared_ptr<const static_body> gzip;    // .gz 兄弟文件或压缩生成，可能为空
+    std::shared_ptr<const static_body> br;      // .br 兄弟文件或压缩生成，可能为空
+};
+
+enum STATIC_STATUS
+{
+    STATIC_OK = 0,          // 命中缓存（或新装入缓存）
+    STATIC_NOT_FOUND,       // 文件不存在
+    STATIC_FORBIDDEN,       // 无读权限
+    STATIC_IS_DIR,          // 请求的是目录
+    STATIC_BYPASS           // 文件过大或缓存已关闭，由调用方自行映射，st 已填好
+};
+
+// 静态文件缓存：按路径缓存文件内容的只读映射以及 gzip/brotli 版本，按字节预算做 LRU 淘汰。
+// 同一文件的压缩只在装入缓存时做一次；同一秒内的重复访问不再 stat。
+// 取出的 shared_ptr 在响应发送完毕前保持内容有效，被淘汰的条目在最后一个使用者释放后才解除映射。
+class static_cache
+{
+public:
+    static const time_t REVALIDATE_INTERVAL = 1;    // 重新 stat 校验的间隔（秒）
+    static const size_t MIN_COMPRESS_SIZE = 256;    // 小于该长度的文件不压缩
+    static const int BROTLI_QUALITY = 5;            // 请求中按需压缩的 brotli 质量，压缩率接近 gzip -9 而耗时低一个数量级
+    static const int BROTLI_PREWARM_QUALITY = 11;   // 启动预热时尚未开始监听，用最高质量
+
+    static static_cache *get_instance()
+    {
+        static static_cache instance;
+        return &instance;
+    }
+
+    void init(size_t byte_budget, size_t max_file_size, bool compress);
+    // 运行中修改字节预算（SIGHUP 重新加载配置），调小时立即淘汰到预算以内
+    void set_budget(size_t byte_budget);
+
+    // 启动预热的结果
+    struct prewarm_stats
+    {
+        int files;              // 装入缓存的文件数
+        size_t bytes;           // 占用的缓存字节数（含压缩版本）
+        int lock_failed;        // mlock 失败的映射数（通常是 RLIMIT_MEMLOCK 不足）
+        double seconds;         // 耗时
+    };
+    // 启动预热：list_file 每行一个相对 doc_root 的文件或目录（目录递归展开），文件不存在时预热整个 doc_root。
+    // 文件按大小从小到大装入缓存，累计不超过 byte_budget 字节，装入时即读入并建立页表；
+    // lock 为真时再 mlock 文件映射，不被换出
+    prewarm_stats prewarm(const char *doc_root, const char *list_file, size_t byte_budget, bool lock);
+
+    // 同一文件正在由其它线程装入（映射、压缩）时不等待，返回 STATIC_BYPASS 由调用方直接映射原文件
+    STATIC_STATUS acquire(const char *path, std::shared_ptr<const static_entry> &out, struct stat *st,
+                          int br_quality = BROTLI_QUALITY);
+
+    // 调用方直接映射原文件（STATIC_BYPASS）时给出与缓存中原文表示相同的 ETag 和 Vary：
+    // 文件可以进缓存、且是可能带 gzip/br 版本的文本类型时，同一 URL 的响应随 Accept-Encoding 变化
+    static int format_etag(const struct stat &st, const char *encoding, char *buf, size_t size);
+    bool bypass_vary(const char *path, const struct stat &st) const;
+
+private:
+    static_cache() : m_byte_budget(0), m_max_file_size(0), m_compress(false), m_bytes(0) {}
+    ~static_cache() {}
+
+    std::shared_ptr<static_entry> load(const std::string &path, const struct stat &st, int br_quality);
+    void insert(const std::shared_ptr<static_entry> &entry);
+    void evict(size_t incoming);
+    static size_t entry_bytes(const static_entry &entry);
+    static void build_header(static_body &body, const struct stat &st, const char *type,
+                             const char *encoding, bool vary);
+    static std::shared_ptr<static_body> map_file(const std::string &path, const struct stat &st);
+    static std::shared_ptr<static_body> map_sibling(const std::string &path, const struct stat &origin);
+    static std::shared_ptr<static_body> compress_gzip(const char *data, size_t len);
+    static std::shared_ptr<static_body> compress_brotli(const char *data, size_t len, int quality);
+
+    typedef std::list<std::shared_ptr<static_entry>> lru_list;
+
+    std::atomic<size_t> m_byte_budget;  // 缓存总字节预算
+    size_t m_max_file_size;     // 单个文件的缓存上限
+    bool m_compress;            // 是否对文本资源做一次性压缩
+    size_t m_bytes;             // 当前占用字节数
+    lru_list m_lru;             // 表头为最近使用
+    std::unordered_map<std::string, lru_list::iterator> m_index;
+    std::unordered_set<std::string> m_loading;      // 正在装入的路径，同一文件只由一个线程映射和压缩
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include "websocket.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_UNMASK_X86 1
+#endif
+
+std::string ws_accept_key(const char *key, size_t len)
+{
+    static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    std::string text(key, len);
+    text.append(GUID, sizeof(GUID) - 1);
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_Digest(text.data(), text.size(), digest, &digest_len, EVP_sha1(), NULL);
+
+    char accept[32];
+    int n = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(accept), digest, digest_len);
+    return std::string(accept, n);
+}
+
+static void ws_unmask_scalar(char *data, size_t len, const uint8_t mask[4], size_t offset)
+{
+    for (size_t i = 0; i < len; ++i)
+        data[i] ^= mask[(offset + i) & 3];
+}
+
+#ifdef WS_UNMASK_X86
+//把掩码按 offset 旋转后拼成 32 位，向量中每 4 字节重复一次；步长是 4 的倍数，循环中无需再旋转
+static uint32_t rotated_mask(const uint8_t mask[4], size_t offset)
+{
+    uint8_t rotated[4];
+    for (int i = 0; i < 4; ++i)
+        rotated[i] = mask[(offset + i) & 3];
+    uint32_t key;
+    memcpy(&key, rotated, 4);
+    return key;
+}
+
+//SSE2：一次异或 16 字节
+__attribute__((target("sse2")))
+static void ws_unmask_sse2(char *data, size_t len, const uint8_t mask[4], size_t offset)
+{
+    const __m128i key = _mm_set1_epi32(static_cast<int>(rotated_mask(mask, offset)));
+    size_t i = 0;
+    for (; len - i >= 16; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_xor_si128(chunk, key));
+    }
+    ws_unmask_scalar(data + i, len - i, mask, offset + i);
+}
+
+//AVX2：一次异或 32 字节
+__attribute__((target("avx2")))
+static void ws_unmask_avx2(char *data, size_t len, const uint8_t mask[4], size_t offset)
+{
+    const __m256i key = _mm256_set1_epi32(static_cast<int>(rotated_mask(mask, offset)));
+    size_t i = 0;
+    for (; len - i >= 32; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_xor_si256(chunk, key));
+    }
+    ws_unmask_scalar(data + i, len - i, mask, offset + i);
+}
+#endif
+
+typedef void (*unmask_fn)(char *, size_t, const uint8_t *, size_t);
+
+struct unmask_impl
+{
+    unmask_fn fn;
+    const char *name;
+};
+
+//启动时根据 CPUID 选择一次实现
+static unmask_impl select_unmask_impl()
+{
+#ifdef WS_UNMASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return unmask_impl{ws_unmask_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2"))
+        return unmask_impl{ws_unmask_sse2, "sse2"};
+#endif
+    return unmask_impl{ws_unmask_scalar, "scalar"};
+}
+
+static const unmask_impl g_unmask_impl = select_unmask_impl();
+
+void ws_unmask(char *data, size_t len, const uint8_t mask[4], size_t offset)
+{
+    g_unmask_impl.fn(data, len, mask, offset);
+}
+
+const char *ws_unmask_impl_name()
+{
+    return g_unmask_impl.name;
+}
+
+ws_frame_ptr ws_encode_frame(int opcode, const char *data, size_t len)
+{
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    frame->reserve(len + 10);
+    frame->push_back(static_cast<char>(0x80 | opcode));
+    if (len < 126)
+        frame->push_back(static_cast<char>(len));
+    else if (len <= 0xffff)
+    {
+        frame->push_back(126);
+        frame->push_back(static_cast<char>(len >> 8));
+        frame->push_back(static_cast<char>(len));
+    }
+    else
+    {
+        frame->push_back(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            frame->push_back(static_cast<char>(static_cast<uint64_t>(len) >> shift));
+    }
+    frame->append(data, len);
+    return frame;
+}
+
+ws_session::ws_session(message_handler on_message)
+    : m_on_message(on_message), m_state(STATE_HEADER), m_head_len(0), m_fin(false), m_opcode(0),
+      m_payload_len(0), m_payload_done(0), m_message_opcode(0), m_out_offset(0), m_out_bytes(0),
+      m_closing(false), m_close_sent(false), m_ping_outstanding(false)
+{
+}
+
+//帧头长度：2 字节基本头 + 扩展长度（0/2/8 字节）+ 掩码（4 字节），需已收到前 2 字节
+static size_t header_size(const uint8_t *head)
+{
+    uint8_t len7 = head[1] & 0x7f;
+    return 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + ((head[1] & 0x80) ? 4 : 0);
+}
+
+bool ws_session::feed(char *data, size_t len)
+{
+    //收到任何数据都说明对端仍然存活
+    if (len > 0)
+        m_ping_outstanding = false;
+
+    while (!m_closing)
+    {
+        if (m_state == STATE_HEADER)
+        {
+            size_t need = m_head_len < 2 ? 2 : header_size(m_head);
+            if (m_head_len < need)
+            {
+                if (len == 0)
+                    break;
+                size_t n = need - m_head_len < len ? need - m_head_len : len;
+                memcpy(m_head + m_head_len, data, n);
+                m_head_len += n;
+                data += n;
+                len -= n;
+                continue;
+            }
+            if (!on_header())
+                return false;
+            continue;
+        }
+
+        if (m_payload_done == m_payload_len)
+        {
+            if (!on_frame())
+                return false;
+            continue;
+        }
+        if (len == 0)
+            break;
+
+        //负载边到达边去掩码，直接追加到消息（或控制帧）缓冲区
+        uint64_t remaining = m_payload_len - m_payload_done;
+        size_t n = remaining < len ? remaining : len;
+        std::string &dst = m_opcode >= WS_CLOSE ? m_control : m_message;
+        size_t old_size = dst.size();
+        dst.append(data, n);
+        ws_unmask(&dst[old_size], n, m_mask, m_payload_done);
+        m_payload_done += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ws_session::on_header()
+{
+    uint8_t b0 = m_head[0];
+    uint8_t b1 = m_head[1];
+    m_fin = (b0 & 0x80) != 0;
+    m_opcode = b0 & 0x0f;
+
+    //未协商任何扩展，RSV 位必须为 0；客户端发来的帧必须带掩码
+    if ((b0 & 0x70) || !(b1 & 0x80))
+        return fail(WS_CLOSE_PROTOCOL_ERROR);
+
+    uint64_t len = b1 & 0x7f;
+    size_t pos = 2;
+    if (len == 126)
+    {
+        len = (static_cast<uint64_t>(m_head[2]) << 8) | m_head[3];
+        pos = 4;
+    }
+    else if (len == 127)
+    {
+        len = 0;
+        for (int i = 0; i < 8; ++i)
+            len = (len << 8) | m_head[2 + i];
+        pos = 10;
+    }
+    memcpy(m_mask, m_head + pos, 4);
+
+    if (m_opcode >= WS_CLOSE)
+    {
+        //控制帧不能分片，负载不超过 125 字节
+        if (!m_fin || len > 125 || m_opcode > WS_PONG)
+            return fail(WS_CLOSE_PROTOCOL_ERROR);
+        m_control.clear();
+    }
+    else
+    {
+        if (m_opcode == WS_CONTINUATION)
+        {
+            if (!m_message_opcode)
+                return fail(WS_CLOSE_PROTOCOL_ERROR);
+        }
+        else if (m_opcode == WS_TEXT || m_opcode == WS_BINARY)
+        {
+            if (m_message_opcode)
+                return fail(WS_CLOSE_PROTOCOL_ERROR);
+            m_message_opcode = m_opcode;
+        }
+        else
+            return fail(WS_CLOSE_PROTOCOL_ERROR);
+
+        if (len > MAX_MESSAGE_SIZE - m_message.size())
+            return fail(WS_CLOSE_TOO_BIG);
+    }
+
+    m_payload_len = len;
+    m_payload_done = 0;
+    m_head_len = 0;
+    m_state = STATE_PAYLOAD;
+    return true;
+}
+
+bool ws_session::on_frame()
+{
+    m_state = STATE_HEADER;
+    switch (m_opcode)
+    {
+        case WS_PING:
+        {
+            if (!enqueue(ws_encode_frame(WS_PONG, m_control.data(), m_control.size())))
+                return fail(WS_CLOSE_TOO_BIG);
+            return true;
+        }
+        case WS_PONG:
+            return true;
+        case WS_CLOSE:
+        {
+            if (m_control.size() == 1)
+                return fail(WS_CLOSE_PROTOCOL_ERROR);
+            //回复 close 并带回对端的状态码，随后关闭连接
+            int code = WS_CLOSE_NORMAL;
+            if (m_control.size() >= 2)
+                code = (static_cast<uint8_t>(m_control[0]) << 8) | static_cast<uint8_t>(m_control[1]);
+            send_close(code);
+            return true;
+        }
+        default:
+        {
+            if (!m_fin)
+                return true;
+            int opcode = m_message_opcode;
+            m_message_opcode = 0;
+            m_on_message(opcode, m_message);
+            //大消息用过的缓冲区不长期占用，空闲连接只保留很小的状态
+            if (m_message.capacity() > 4096)
+                std::string().swap(m_message);
+            else
+                m_message.clear();
+            return true;
+        }
+    }
+}
+
+bool ws_session::fail(int code)
+{
+    send_close(code);
+    return false;
+}
+
+void ws_session::send_close(int code)
+{
+    m_closing = true;
+    if (m_close_sent)
+        return;
+    char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code)};
+    ws_frame_ptr frame = ws_encode_frame(WS_CLOSE, payload, sizeof(payload));
+    //close 帧不受积压上限限制
+    m_out.push_back(frame);
+    m_out_bytes += frame->size();
+    m_close_sent = true;
+}
+
+bool ws_session::enqueue(const ws_frame_ptr &frame)
+{
+    //已发出 close 之后不再发送其它帧
+    if (m_close_sent)
+        return true;
+    if (m_out_bytes + frame->size() > MAX_QUEUE_BYTES)
+        return false;
+    m_out.push_back(frame);
+    m_out_bytes += frame->size();
+    return true;
+}
+
+void ws_session::ping()
+{
+    static const ws_frame_ptr frame = ws_encode_frame(WS_PING, NULL, 0);
+    enqueue(frame);
+    m_ping_outstanding = true;
+}
+
+int ws_session::fill_iov(struct iovec *iov, int max) const
+{
+    int count = 0;
+    size_t offset = m_out_offset;
+    for (auto it = m_out.begin(); it != m_out.end() && count < max; ++it)
+    {
+        iov[count].iov_base = const_cast<char *>((*it)->data()) + offset;
+        iov[count].iov_len = (*it)->size() - offset;
+        ++count;
+        offset = 0;
+    }
+    return count;
+}
+
+void ws_session::consume(size_t n)
+{
+    m_out_bytes -= n;
+    while (n > 0)
+    {
+        size_t left = m_out.front()->size() - m_out_offset;
+        if (n < left)
+        {
+            m_out_offset += n;
+            return;
+        }
+        n -= left;
+        m_out.pop_front();
+        m_out_offset = 0;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <sys/uio.h>
+
+// WebSocket（RFC 6455）帧层：解析客户端帧（去掩码、分片重组、控制帧），维护发送队列。
+// 与 socket、epoll 无关，由 http_conn 负责收发字节。
+// 发送队列中的帧以 shared_ptr 保存，广播时同一份编码结果被所有订阅者的队列共享，直接 writev 出去。
+
+enum WS_OPCODE
+{
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xa
+};
+
+enum WS_CLOSE_CODE
+{
+    WS_CLOSE_NORMAL = 1000,
+    WS_CLOSE_PROTOCOL_ERROR = 1002,
+    WS_CLOSE_TOO_BIG = 1009
+};
+
+typedef std::shared_ptr<const std::string> ws_frame_ptr;
+
+// 由 Sec-WebSocket-Key 计算 Sec-WebSocket-Accept（base64(SHA-1(key + GUID))，28 个字符）
+std::string ws_accept_key(const char *key, size_t len);
+
+// 用 4 字节掩码对 data 做异或，offset 为 data 首字节在帧负载中的位置（决定从掩码的哪个字节开始）。
+// 启动时按 CPUID 选择 AVX2（32 字节一步）、SSE2（16 字节一步）或标量实现
+void ws_unmask(char *data, size_t len, const uint8_t mask[4], size_t offset);
+// 当前选用的去掩码实现名称，用于启动日志
+const char *ws_unmask_impl_name();
+
+// 编码一个服务端帧（FIN 置位、不带掩码）
+ws_frame_ptr ws_encode_frame(int opcode, const char *data, size_t len);
+
+class ws_session
+{
+public:
+    static const size_t MAX_MESSAGE_SIZE = 64 << 10;    // 重组后单条消息的最大长度
+    static const size_t MAX_QUEUE_BYTES = 1 << 20;      // 发送队列积压上限，超过视为慢消费者
+    static const int MAX_IOV = 16;                      // 一次 writev 最多带出的帧数
+
+    // 收到一条完整的数据消息（文本或二进制）
+    typedef std::function<void(int opcode, const std::string &message)> message_handler;
+
+    explicit ws_session(message_handler on_message);
+
+    // 输入收到的字节（可以是不完整的帧）。协议错误时排队 close 帧并返回 false
+    bool feed(char *data, size_t len);
+
+    // 排队一个已编码的帧，积压超过上限时返回 false
+    bool enqueue(const ws_frame_ptr &frame);
+    // 把发送队列填入 iov，返回使用的个数
+    int fill_iov(struct iovec *iov, int max) const;
+    // 已写出 n 字节，弹出发送完的帧
+    void consume(size_t n);
+    bool has_output() const { return !m_out.empty(); }
+
+    // 已收到或发出 close 帧：发送队列清空后关闭连接
+    bool closing() const { return m_closing; }
+    // 心跳：发出 ping 后到收到任意帧之前为 true
+    bool ping_outstanding() const { return m_ping_outstanding; }
+    void ping();
+
+private:
+    enum STATE
+    {
+        STATE_HEADER = 0,   // 接收帧头（2~14 字节）
+        STATE_PAYLOAD       // 接收负载
+    };
+
+    bool on_header();
+    bool on_frame();
+    bool fail(int code);
+    void send_close(int code);
+
+    message_handler m_on_message;
+    STATE m_state;
+    uint8_t m_head[14];             // 跨读取累积的帧头
+    size_t m_head_len;
+    bool m_fin;
+    int m_opcode;
+    uint8_t m_mask[4];
+    uint64_t m_payload_len;         // 当前帧负载长度
+    uint64_t m_payload_done;        // 已收到的负载字节数
+    int m_message_opcode;           // 正在重组的消息类型，0 表示不在分片消息中
+    std::string m_message;          // 重组中的数据消息
+    std::string m_control;          // 当前控制帧的负载（不超过 125 字节）
+
+    std::deque<ws_frame_ptr> m_out; // 发送队列
+    size_t m_out_offset;            // 队首帧已写出的字节数
+    size_t m_out_bytes;             // 队列中尚未写出的总字节数
+    bool m_closing;
+    bool m_close_sent;
+    bool m_ping_outstanding;
+};
+
+#endif
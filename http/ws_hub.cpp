@@ -0,0 +1,47 @@
+#include "ws_hub.h"
+#include "http_conn.h"
+
+void ws_hub::init(int max_fd)
+{
+    m_conns.assign(max_fd, NULL);
+    m_pos.assign(max_fd, -1);
+}
+
+void ws_hub::subscribe(int fd, http_conn *conn)
+{
+    if (fd < 0 || fd >= (int)m_conns.size() || m_conns[fd])
+        return;
+    m_conns[fd] = conn;
+    m_pos[fd] = m_subscribers.size();
+    m_subscribers.push_back(fd);
+    m_count = m_subscribers.size();
+}
+
+void ws_hub::unsubscribe(int fd)
+{
+    if (fd < 0 || fd >= (int)m_conns.size() || !m_conns[fd])
+        return;
+    int pos = m_pos[fd];
+    int last = m_subscribers.back();
+    m_subscribers[pos] = last;
+    m_pos[last] = pos;
+    m_subscribers.pop_back();
+    m_conns[fd] = NULL;
+    m_pos[fd] = -1;
+    m_count = m_subscribers.size();
+}
+
+void ws_hub::broadcast(int opcode, const char *data, size_t len)
+{
+    ws_frame_ptr frame = ws_encode_frame(opcode, data, len);
+    //ws_send 不会同步关闭连接（出错时只 shutdown，由主循环回收），遍历期间订阅表不变
+    for (int fd : m_subscribers)
+        m_conns[fd]->ws_send(frame);
+}
+
+bool ws_hub::keepalive(int fd)
+{
+    if (fd < 0 || fd >= (int)m_conns.size() || !m_conns[fd])
+        return false;
+    return m_conns[fd]->ws_keepalive();
+}
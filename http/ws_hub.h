@@ -0,0 +1,47 @@
+#ifndef WS_HUB_H
+#define WS_HUB_H
+
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+#include "websocket.h"
+
+class http_conn;
+
+// /ws 的广播中心：订阅者发来的数据消息只编码成帧一次，同一份帧共享给所有订阅者的发送队列。
+// 订阅表只在主线程中访问：WebSocket 连接升级后的收发、定时器都在主线程完成；
+// reactor 模式下升级在工作线程中完成，此时主线程正等待该线程（improv），同样不会并发。
+class ws_hub
+{
+public:
+    static const int PONG_TIMEOUT = 15;     // 发出 ping 后等待对端任意帧的秒数
+
+    static ws_hub *get_instance()
+    {
+        static ws_hub instance;
+        return &instance;
+    }
+
+    void init(int max_fd);
+
+    void subscribe(int fd, http_conn *conn);
+    void unsubscribe(int fd);
+    // 把一条消息编码成帧后发给所有订阅者（包括发送者自己）
+    void broadcast(int opcode, const char *data, size_t len);
+    // 空闲定时器到期：描述符是订阅者且上一次 ping 已得到回应时发出 ping 并返回 true，否则返回 false（应关闭）
+    bool keepalive(int fd);
+
+    size_t size() const { return m_count; }
+
+private:
+    ws_hub() : m_count(0) {}
+    ~ws_hub() {}
+
+    std::vector<http_conn *> m_conns;   // 按描述符索引，非订阅者为 NULL
+    std::vector<int> m_pos;             // 描述符在 m_subscribers 中的位置
+    std::vector<int> m_subscribers;     // 订阅者描述符，紧凑排列便于遍历，删除时与末尾交换
+    std::atomic<size_t> m_count;        // 订阅者数，供 /metrics 在工作线程中读取
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "ip_limiter.h"
+
+#include <stdio.h>
+#include <time.h>
+
+void ip_limiter::init(int max_fd, int max_conns, int rate, int burst)
+{
+    set_limits(max_conns, rate, burst);
+    if (!m_max_conns && !m_rate)
+        return;
+
+    //地址数不超过连接数，表大小取不小于两倍连接数的 2 的幂，探测链保持较短
+    size_t size = 1;
+    while (size < (size_t)max_fd * 2)
+        size <<= 1;
+    m_slots.reset(new slot[size]);
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_slots[i].owner.store((uint64_t)EMPTY << 32, std::memory_order_relaxed);
+        m_slots[i].bucket.store(0, std::memory_order_relaxed);
+    }
+    m_mask = size - 1;
+}
+
+//已有地址的连接数和令牌数保留，新的上限对之后的 accept 和请求生效
+bool ip_limiter::set_limits(int max_conns, int rate, int burst)
+{
+    m_max_conns.store(max_conns > 0 ? max_conns : 0, std::memory_order_relaxed);
+    m_rate.store(rate > 0 ? rate : 0, std::memory_order_relaxed);
+    //令牌以千分之一为单位存放在 32 位中
+    m_burst.store(burst > 0 ? (burst < 4000000 ? burst : 4000000) : 1, std::memory_order_relaxed);
+    return enabled() || (!max_conns && !rate);
+}
+
+uint32_t ip_limiter::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+size_t ip_limiter::home(uint32_t key) const
+{
+    //乘法散列，同一网段的相邻地址分散到不同位置
+    return (size_t)((key * 2654435761u) ^ (key >> 16)) & m_mask;
+}
+
+//按经过的时间补充令牌，返回新的桶状态
+uint64_t ip_limiter::refill(uint64_t bucket, uint32_t now) const
+{
+    uint64_t tokens = bucket >> 32;
+    uint32_t last = (uint32_t)bucket;
+    int32_t elapsed = (int32_t)(now - last);
+    //其它线程可能已用更晚的时刻更新过
+    if (elapsed <= 0)
+        return bucket;
+    uint64_t cap = (uint64_t)m_burst.load(std::memory_order_relaxed) * 1000;
+    tokens += (uint64_t)elapsed * m_rate.load(std::memory_order_relaxed);
+    if (tokens > cap)
+        tokens = cap;
+    return (tokens << 32) | now;
+}
+
+//查找已有的槽，遇到空槽即可确定不存在（墓碑继续往后找）
+ip_limiter::slot *ip_limiter::find(uint32_t key)
+{
+    size_t i = home(key);
+    for (int n = 0; n < MAX_PROBE; ++n, i = (i + 1) & m_mask)
+    {
+        uint32_t k = m_slots[i].owner.load(std::memory_order_acquire) >> 32;
+        if (k == key)
+            return &m_slots[i];
+        if (k == EMPTY)
+            return NULL;
+    }
+    return NULL;
+}
+
+bool ip_limiter::acquire(in_addr_t addr)
+{
+    if (!enabled())
+        return true;
+    uint32_t key = addr;
+    uint32_t max_conns = m_max_conns.load(std::memory_order_relaxed);
+    size_t i = home(key);
+    slot *free = NULL;
+    for (int n = 0; n < MAX_PROBE; ++n, i = (i + 1) & m_mask)
+    {
+        slot &s = m_slots[i];
+        uint64_t owner = s.owner.load(std::memory_order_acquire);
+        uint32_t k = owner >> 32;
+        if (k == key)
+        {
+            //其它线程可能同时在 release 中减少连接数
+            while (true)
+            {
+                if (max_conns && (uint32_t)owner >= max_conns)
+                {
+                    m_refused.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (s.owner.compare_exchange_weak(owner, owner + 1, std::memory_order_acq_rel))
+                    return true;
+            }
+        }
+        if (k == TOMBSTONE && !free)
+            free = &s;
+        if (k == EMPTY)
+        {
+            if (!free)
+                free = &s;
+            break;
+        }
+    }
+    //探测范围内已满：不记录该地址（放行且不限制），比拒绝正常客户端更可取
+    if (!free)
+        return true;
+    //插入只发生在主线程，先写好令牌桶再发布地址，工作线程找到该槽时桶已就绪
+    free->bucket.store(((uint64_t)m_burst.load(std::memory_order_relaxed) * 1000 << 32) | now_ms(), std::memory_order_relaxed);
+    free->owner.store(((uint64_t)key << 32) | 1, std::memory_order_release);
+    return true;
+}
+
+void ip_limiter::release(in_addr_t addr)
+{
+    if (!enabled())
+        return;
+    slot *s = find(addr);
+    if (!s)
+        return;
+    uint64_t owner = s->owner.load(std::memory_order_acquire);
+    while ((owner >> 32) == addr && (uint32_t)owner > 0)
+    {
+        if (s->owner.compare_exchange_weak(owner, owner - 1, std::memory_order_acq_rel))
+            return;
+    }
+}
+
+bool ip_limiter::allow(in_addr_t addr)
+{
+    if (!enabled() || !m_rate.load(std::memory_order_relaxed))
+        return true;
+    slot *s = find(addr);
+    if (!s)
+        return true;
+    uint32_t now = now_ms();
+    uint64_t bucket = s->bucket.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint64_t next = refill(bucket, now);
+        if ((next >> 32) < 1000)
+        {
+            m_limited.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        next -= (uint64_t)1000 << 32;
+        if (s->bucket.compare_exchange_weak(bucket, next, std::memory_order_relaxed))
+            return true;
+    }
+}
+
+//主线程是唯一的插入和删除者，这里不会与 acquire 竞争；连接数为 0 时也不会有 release
+void ip_limiter::sweep()
+{
+    if (!enabled())
+        return;
+    uint32_t now = now_ms();
+    uint32_t rate = m_rate.load(std::memory_order_relaxed);
+    uint64_t full = (uint64_t)m_burst.load(std::memory_order_relaxed) * 1000;
+    size_t tracked = 0;
+    for (size_t i = 0; i <= m_mask; ++i)
+    {
+        slot &s = m_slots[i];
+        uint64_t owner = s.owner.load(std::memory_order_acquire);
+        uint32_t k = owner >> 32;
+        if (k == EMPTY || k == TOMBSTONE)
+            continue;
+        bool idle = (uint32_t)owner == 0 &&
+                    (!rate || (refill(s.bucket.load(std::memory_order_relaxed), now) >> 32) >= full);
+        //删除后其它地址的探测链不能断开，置为墓碑而不是空槽
+        if (!idle || !s.owner.compare_exchange_strong(owner, (uint64_t)TOMBSTONE << 32, std::memory_order_acq_rel))
+            ++tracked;
+    }
+    m_tracked.store(tracked, std::memory_order_relaxed);
+}
+
+void ip_limiter::metrics(std::string &text)
+{
+    if (!enabled())
+        return;
+    char line[160];
+    int len = snprintf(line, sizeof(line), "ip_tracked %zu\nip_refused_connections %lu\nip_limited_requests %lu\n",
+                       m_tracked.load(std::memory_order_relaxed), m_refused.load(std::memory_order_relaxed),
+                       m_limited.load(std::memory_order_relaxed));
+    text.append(line, len);
+}
@@ -0,0 +1,72 @@
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <netinet/in.h>
+
+// 按客户端 IPv4 地址限制并发连接数和请求速率（令牌桶）。
+// 状态放在定长的开放寻址哈希表中，每个槽两个 64 位原子量，查找和计数都不加锁：
+// 新地址只在主线程 accept 时插入、空闲地址只在主线程的定时处理中删除（置为墓碑），
+// 工作线程只查找已有的槽，对连接数和令牌桶做 CAS 更新。
+class ip_limiter
+{
+public:
+    static const int MAX_PROBE = 32;        // 线性探测的最大长度，超出时该地址不受限制
+
+    static ip_limiter *get_instance()
+    {
+        static ip_limiter instance;
+        return &instance;
+    }
+
+    // max_fd 决定表的大小；max_conns 为每个地址的并发连接上限，rate/burst 为每秒请求数和令牌桶容量，为 0 时不限制
+    void init(int max_fd, int max_conns, int rate, int burst);
+    // 运行中修改上限（SIGHUP 重新加载配置）。启动时两项限制都为 0 则没有建表，返回 false，需重启才能启用
+    bool set_limits(int max_conns, int rate, int burst);
+    bool enabled() const { return m_slots != nullptr; }
+
+    // 新连接（只在主线程调用）：超过并发上限时返回 false，否则连接数加一
+    bool acquire(in_addr_t addr);
+    // 连接关闭，连接数减一
+    void release(in_addr_t addr);
+    // 一个请求消耗一个令牌，令牌不足时返回 false
+    bool allow(in_addr_t addr);
+    // 删除没有连接且令牌桶已回满的地址，由定时器每个时间片调用一次
+    void sweep();
+
+    void metrics(std::string &text);
+
+private:
+    ip_limiter() : m_mask(0), m_max_conns(0), m_rate(0), m_burst(0), m_tracked(0), m_refused(0), m_limited(0) {}
+    ~ip_limiter() {}
+
+    // 高 32 位为地址（EMPTY 为空槽，TOMBSTONE 为已删除），低 32 位为连接数
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr uint32_t TOMBSTONE = 0xffffffff;
+
+    struct slot
+    {
+        std::atomic<uint64_t> owner;
+        std::atomic<uint64_t> bucket;   // 高 32 位为令牌数（千分之一个），低 32 位为上次补充的时刻（毫秒）
+    };
+
+    static uint32_t now_ms();
+    size_t home(uint32_t key) const;
+    slot *find(uint32_t key);
+    uint64_t refill(uint64_t bucket, uint32_t now) const;
+
+    std::unique_ptr<slot[]> m_slots;
+    size_t m_mask;
+    std::atomic<uint32_t> m_max_conns;      // 上限可在运行中修改，各自独立读取
+    std::atomic<uint32_t> m_rate;
+    std::atomic<uint32_t> m_burst;
+    std::atomic<size_t> m_tracked;          // 上一次清理时仍在表中的地址数
+    std::atomic<unsigned long> m_refused;   // 因并发上限拒绝的连接
+    std::atomic<unsigned long> m_limited;   // 因速率限制回复 429 的请求
+};
+
+#endif
@@ -6,9 +6,10 @@
 #include <cstdarg>
 #include <filesystem>
 
-Log::Log() : _count(0), _is_async(false) {}
+Log::Log() : _count(0), _is_async(false), _stop(false), _level(0) {}
 
 Log::~Log() {
+    stop();
     if (_fp.is_open()) {
         _fp.close();
     }
@@ -19,8 +20,7 @@ bool Log::init(const std::string& file_name, int split_lines, int max_queue_size
     if (max_queue_size >= 1) {
         _is_async = true;
         _log_queue = std::make_unique<block_queue<std::string>>(max_queue_size);
-        std::thread flush_thread(flush_log_thread, nullptr);
-        flush_thread.detach(); // 在后台运行
+        _writer = std::thread(flush_log_thread, nullptr); // 在后台运行，stop() 时回收
     }
 
     // 配置分割行数。
@@ -125,6 +125,22 @@ void Log::flush() {
     _fp.flush();
 }
 
+void Log::stop() {
+    if (!_writer.joinable()) {
+        return;
+    }
+    // 先切换为同步写入，再等写线程写完队列；切换前已取得异步标志的写入可能晚于写线程退出，由这里补写
+    _is_async = false;
+    _stop = true;
+    _writer.join();
+    std::vector<std::string> rest;
+    std::string single_log;
+    while (_log_queue->pop(single_log, 0)) {
+        rest.emplace_back(std::move(single_log));
+    }
+    write_batch(rest);
+}
+
 void Log::write_batch(std::vector<std::string>& logs) {
     std::lock_guard<std::mutex> lock(_mutex);
     for (const auto& log : logs) {
@@ -140,7 +156,7 @@ void Log::async_write_log() {
     log_strs.reserve(300);
     const size_t batch_size = std::min<size_t>(16, _log_queue->max_size() / 10); // 动态调整
 
-    while (true) {
+    while (!_stop || !_log_queue->empty()) {
         std::string single_log;
         // 使用带超时的 pop，等待 100ms
         while (_log_queue->pop(single_log, 100)) {
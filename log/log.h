@@ -7,6 +7,7 @@
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
 #include "blockQueue.h"
 
 class Log {
@@ -27,6 +28,13 @@ public:
 
     void flush();
 
+    // 低于 level 的日志不输出（0 debug，1 info，2 warn，3 error），可在运行中修改
+    void set_level(int level) { _level.store(level, std::memory_order_relaxed); }
+    bool enabled(int level) const { return level >= _level.load(std::memory_order_relaxed); }
+
+    // 停止异步写线程：写完队列中剩余的日志后回收线程，之后的日志同步写入。退出前调用，析构时也会调用
+    void stop();
+
 private:
     Log();
     ~Log();
@@ -41,13 +49,16 @@ private:
     int _today;                    // 当前日期，用于日志分割
     std::ofstream _fp;             // 日志输出文件流
     std::unique_ptr<block_queue<std::string>> _log_queue; // 异步日志阻塞队列
-    bool _is_async;                // 是否异步写入日志
+    std::atomic<bool> _is_async;   // 是否异步写入日志
+    std::atomic<bool> _stop;       // 异步写线程是否应在队列写空后退出
+    std::atomic<int> _level;       // 输出的最低级别
+    std::thread _writer;           // 异步写线程
     std::mutex _mutex;             // 线程安全的互斥锁
 };
 
-#define LOG_DEBUG(format, ...) if (!m_close_log) { Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_INFO(format, ...)  if (!m_close_log) { Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_WARN(format, ...)  if (!m_close_log) { Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_ERROR(format, ...) if (!m_close_log) { Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+#define LOG_DEBUG(format, ...) if (!m_close_log && Log::get_instance()->enabled(0)) { Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+#define LOG_INFO(format, ...)  if (!m_close_log && Log::get_instance()->enabled(1)) { Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+#define LOG_WARN(format, ...)  if (!m_close_log && Log::get_instance()->enabled(2)) { Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+#define LOG_ERROR(format, ...) if (!m_close_log && Log::get_instance()->enabled(3)) { Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
 
 #endif
\ No newline at end of file
@@ -22,18 +22,34 @@ int main(int argc, char *argv[])
 
         WebServer server;
 
+        //平滑升级时以同样的参数重新执行
+        server.command_line(argv);
+
         //初始化
         server.init(config.getPort(), user, passwd, databasename, config.getLOGWrite(), 
                     config.getOPTLINGER(), config.getTRIGMode(),  config.getSqlNum(),  config.getThreadNum(), 
-                    config.getCloseLog(), config.getActorModel());
+                    config.getMaxThreadNum(), config.getCloseLog(), config.getActorModel(), config.getTLS(), config.getAffinity());
+        server.settings(config);
         
 
         // 日志
         server.log_write();
 
+        // CPU 亲和性
+        server.affinity();
+
         // 数据库
         server.sql_pool();
 
+        // 静态文件缓存
+        server.static_files();
+
+        // TLS
+        server.tls();
+
+        // 反向代理
+        server.upstream();
+
         // 线程池
         server.thread_pool();
 
@@ -0,0 +1,499 @@
+#include "relay.h"
+#include "../coro/coro_loop.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+//头部名不区分大小写比较
+static bool name_is(const char *name, size_t len, const char *target)
+{
+    return strlen(target) == len && strncasecmp(name, target, len) == 0;
+}
+
+bool relay_hop_by_hop(const char *name, size_t len)
+{
+    return name_is(name, len, "Connection") || name_is(name, len, "Keep-Alive") ||
+           name_is(name, len, "Proxy-Connection") || name_is(name, len, "TE") ||
+           name_is(name, len, "Trailer") || name_is(name, len, "Upgrade");
+}
+
+relay_request::relay_request(const char *method, const char *path, size_t path_len)
+{
+    m_post = strcmp(method, "POST") == 0;
+    m_head.reserve(512);
+    m_head.append(method).append(" ").append(path, path_len).append(" HTTP/1.1\r\n");
+}
+
+void relay_request::add_header(const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    if (relay_hop_by_hop(name, name_len) || name_is(name, name_len, "Content-Length") ||
+        name_is(name, name_len, "Transfer-Encoding") || name_is(name, name_len, "Expect") ||
+        name_is(name, name_len, "HTTP2-Settings") || name_is(name, name_len, "X-Forwarded-Proto"))
+        return;
+    if (name_is(name, name_len, "Cookie"))
+    {
+        if (!m_cookie.empty())
+            m_cookie.append("; ");
+        m_cookie.append(value, value_len);
+        return;
+    }
+    if (name_is(name, name_len, "X-Forwarded-For"))
+    {
+        if (!m_forwarded_for.empty())
+            m_forwarded_for.append(", ");
+        m_forwarded_for.append(value, value_len);
+        return;
+    }
+    m_head.append(name, name_len).append(": ").append(value, value_len).append("\r\n");
+}
+
+const std::string &relay_request::finish(const char *client_ip, bool tls, size_t body_len)
+{
+    if (!m_cookie.empty())
+        m_head.append("Cookie: ").append(m_cookie).append("\r\n");
+    m_head.append("X-Forwarded-For: ");
+    if (!m_forwarded_for.empty())
+        m_head.append(m_forwarded_for).append(", ");
+    m_head.append(client_ip).append("\r\n");
+    m_head.append(tls ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n");
+    if (body_len > 0 || m_post)
+    {
+        char line[48];
+        int len = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", body_len);
+        m_head.append(line, len);
+    }
+    m_head.append("Connection: keep-alive\r\n\r\n");
+    return m_head;
+}
+
+//取出逗号分隔的最后一个值，判断 Transfer-Encoding 的最终编码是否为 chunked
+static bool ends_with_chunked(const char *value, size_t len)
+{
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+        --len;
+    size_t start = len;
+    while (start > 0 && value[start - 1] != ',')
+        --start;
+    while (start < len && (value[start] == ' ' || value[start] == '\t'))
+        ++start;
+    return name_is(value + start, len - start, "chunked");
+}
+
+//解析上游响应头，data 以空行结束。逐跳头部去掉，Connection 中的 close/keep-alive 决定连接能否复用
+static bool parse_response(const char *data, size_t len, upstream_response &resp)
+{
+    const char *end = data + len;
+    const char *eol = static_cast<const char *>(memmem(data, len, "\r\n", 2));
+    if (!eol || eol - data < 12 || memcmp(data, "HTTP/1.", 7) != 0 || data[8] != ' ')
+        return false;
+    int status = 0;
+    for (int i = 9; i < 12; ++i)
+    {
+        if (data[i] < '0' || data[i] > '9')
+            return false;
+        status = status * 10 + (data[i] - '0');
+    }
+    if (status < 100 || (eol - data > 12 && data[12] != ' '))
+        return false;
+    resp.status = status;
+    if (eol - data > 13)
+        resp.reason.assign(data + 13, eol);
+    else
+        resp.reason.clear();
+    resp.keep_alive = data[7] == '1';
+    resp.headers.clear();
+
+    bool has_te = false, chunked = false, has_length = false;
+    uint64_t length = 0;
+    const char *p = eol + 2;
+    while (p < end)
+    {
+        eol = static_cast<const char *>(memmem(p, end - p, "\r\n", 2));
+        if (!eol || eol == p)
+            break;
+        const char *colon = static_cast<const char *>(memchr(p, ':', eol - p));
+        if (!colon || colon == p)
+            return false;
+        size_t name_len = colon - p;
+        const char *value = colon + 1;
+        while (value < eol && (*value == ' ' || *value == '\t'))
+            ++value;
+        const char *value_end = eol;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            --value_end;
+        size_t value_len = value_end - value;
+
+        if (name_is(p, name_len, "Connection"))
+        {
+            //逗号分隔的选项中查找 close 和 keep-alive
+            const char *token = value;
+            while (token < value_end)
+            {
+                const char *comma = static_cast<const char *>(memchr(token, ',', value_end - token));
+                const char *token_end = comma ? comma : value_end;
+                const char *trimmed = token_end;
+                while (token < trimmed && (*token == ' ' || *token == '\t'))
+                    ++token;
+                while (trimmed > token && (trimmed[-1] == ' ' || trimmed[-1] == '\t'))
+                    --trimmed;
+                if (name_is(token, trimmed - token, "close"))
+                    resp.keep_alive = false;
+                else if (name_is(token, trimmed - token, "keep-alive"))
+                    resp.keep_alive = true;
+                token = comma ? comma + 1 : value_end;
+            }
+        }
+        else if (!relay_hop_by_hop(p, name_len))
+        {
+            if (name_is(p, name_len, "Transfer-Encoding"))
+            {
+                has_te = true;
+                chunked = ends_with_chunked(value, value_len);
+            }
+            else if (name_is(p, name_len, "Content-Length"))
+            {
+                //重复的 Content-Length 必须一致，否则无法确定边界
+                uint64_t n = 0;
+                if (value_len == 0 || value_len > 19)
+                    return false;
+                for (size_t i = 0; i < value_len; ++i)
+                {
+                    if (value[i] < '0' || value[i] > '9')
+                        return false;
+                    n = n * 10 + (value[i] - '0');
+                }
+                if (has_length && n != length)
+                    return false;
+                has_length = true;
+                length = n;
+            }
+            resp.headers.append(p, eol + 2 - p);
+        }
+        p = eol + 2;
+    }
+
+    //RFC 9112 6.3：1xx/204/304 没有响应体；Transfer-Encoding 优先于 Content-Length
+    resp.content_length = 0;
+    if (status < 200 || status == 204 || status == 304)
+        resp.framing = FRAMING_NONE;
+    else if (has_te)
+        resp.framing = chunked ? FRAMING_CHUNKED : FRAMING_CLOSE;
+    else if (has_length)
+    {
+        resp.framing = FRAMING_LENGTH;
+        resp.content_length = length;
+    }
+    else
+        resp.framing = FRAMING_CLOSE;
+    if (resp.framing == FRAMING_CLOSE)
+        resp.keep_alive = false;
+    return true;
+}
+
+size_t chunk_scanner::scan(const char *data, size_t len, std::string *decoded)
+{
+    size_t i = 0;
+    while (i < len && m_state != STATE_DONE && m_state != STATE_ERROR)
+    {
+        char c = data[i];
+        switch (m_state)
+        {
+            case STATE_SIZE:
+            {
+                int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                          : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if (digit >= 0)
+                {
+                    if (++m_digits > 15)
+                    {
+                        m_state = STATE_ERROR;
+                        break;
+                    }
+                    m_size = (m_size << 4) | digit;
+                }
+                else if (m_digits == 0)
+                    m_state = STATE_ERROR;
+                else if (c == '\r')
+                    m_state = STATE_SIZE_LF;
+                else if (c == ';' || c == ' ' || c == '\t')
+                    m_state = STATE_EXT;
+                else
+                    m_state = STATE_ERROR;
+                ++i;
+                break;
+            }
+            case STATE_EXT:
+                if (c == '\r')
+                    m_state = STATE_SIZE_LF;
+                ++i;
+                break;
+            case STATE_SIZE_LF:
+                if (c != '\n')
+                    m_state = STATE_ERROR;
+                else
+                    m_state = m_size == 0 ? STATE_TRAILER_START : STATE_DATA;
+                m_digits = 0;
+                ++i;
+                break;
+            case STATE_DATA:
+            {
+                //分块数据整段跳过
+                size_t n = len - i < m_size ? len - i : m_size;
+                if (decoded)
+                    decoded->append(data + i, n);
+                m_size -= n;
+                i += n;
+                if (m_size == 0)
+                    m_state = STATE_DATA_CR;
+                break;
+            }
+            case STATE_DATA_CR:
+                m_state = c == '\r' ? STATE_DATA_LF : STATE_ERROR;
+                ++i;
+                break;
+            case STATE_DATA_LF:
+                m_state = c == '\n' ? STATE_SIZE : STATE_ERROR;
+                ++i;
+                break;
+            case STATE_TRAILER_START:
+                m_state = c == '\r' ? STATE_LAST_LF : STATE_TRAILER;
+                ++i;
+                break;
+            case STATE_TRAILER:
+                if (c == '\r')
+                    m_state = STATE_TRAILER_LF;
+                ++i;
+                break;
+            case STATE_TRAILER_LF:
+                m_state = c == '\n' ? STATE_TRAILER_START : STATE_ERROR;
+                ++i;
+                break;
+            case STATE_LAST_LF:
+                m_state = c == '\n' ? STATE_DONE : STATE_ERROR;
+                ++i;
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+//复用的连接在收到任何响应之前断开
+static const int RELAY_STALE = -1;
+
+static coro_task<int> exchange_once(upstream_conn &conn, const std::string &head, const std::string &body,
+                                    upstream_response &resp, std::string &in, long deadline)
+{
+    coro_loop *loop = coro_loop::get_instance();
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(head.data());
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = const_cast<char *>(body.data());
+    iov[1].iov_len = body.size();
+    int first = 0, count = body.empty() ? 1 : 2;
+    while (first < count)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov + first;
+        msg.msg_iovlen = count - first;
+        ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!co_await loop->wait(conn.fd, EPOLLOUT, deadline))
+                    co_return RELAY_TIMEOUT;
+                continue;
+            }
+            co_return conn.reused ? RELAY_STALE : RELAY_BAD_GATEWAY;
+        }
+        size_t sent = n;
+        while (first < count && sent >= iov[first].iov_len)
+            sent -= iov[first++].iov_len;
+        if (first < count)
+        {
+            iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + sent;
+            iov[first].iov_len -= sent;
+        }
+    }
+
+    in.clear();
+    size_t scanned = 0;
+    while (true)
+    {
+        size_t pos = in.find("\r\n\r\n", scanned);
+        if (pos != std::string::npos)
+        {
+            if (!parse_response(in.data(), pos + 4, resp))
+                co_return RELAY_BAD_GATEWAY;
+            in.erase(0, pos + 4);
+            scanned = 0;
+            //101 意味着上游切换了协议，代理不支持；其余 1xx 是中间响应，继续读最终响应
+            if (resp.status == 101)
+                co_return RELAY_BAD_GATEWAY;
+            if (resp.status < 200)
+                continue;
+            co_return RELAY_OK;
+        }
+        if (in.size() > RELAY_MAX_HEAD)
+            co_return RELAY_BAD_GATEWAY;
+        scanned = in.size() > 3 ? in.size() - 3 : 0;
+
+        size_t old = in.size();
+        in.resize(old + RELAY_BUFFER_SIZE);
+        ssize_t n = recv(conn.fd, &in[old], RELAY_BUFFER_SIZE, 0);
+        in.resize(old + (n > 0 ? n : 0));
+        if (n > 0)
+            continue;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (!co_await loop->wait(conn.fd, EPOLLIN, deadline))
+                co_return RELAY_TIMEOUT;
+            continue;
+        }
+        co_return conn.reused && old == 0 && resp.status == 0 ? RELAY_STALE : RELAY_BAD_GATEWAY;
+    }
+}
+
+coro_task<RELAY_RESULT> relay_exchange(upstream_pool *pool, const std::string &head, const std::string &body,
+                                       bool idempotent, upstream_conn &conn, upstream_response &resp, std::string &in)
+{
+    long deadline = coro_loop::now_ms() + RELAY_TIMEOUT_MS;
+    for (int attempt = 0;; ++attempt)
+    {
+        if (!co_await pool->acquire(conn, attempt > 0))
+            co_return RELAY_BAD_GATEWAY;
+        resp = upstream_response();
+        int ret = co_await exchange_once(conn, head, body, resp, in, deadline);
+        if (ret == RELAY_OK)
+            co_return RELAY_OK;
+        pool->release(conn, false);
+        if (ret == RELAY_STALE && idempotent && attempt == 0)
+            continue;
+        co_return ret == RELAY_TIMEOUT ? RELAY_TIMEOUT : RELAY_BAD_GATEWAY;
+    }
+}
+
+coro_task<RELAY_RESULT> relay_read_body(upstream_conn &conn, upstream_response &resp, const std::string &in,
+                                        size_t max_len, std::string &body)
+{
+    body.clear();
+    if (resp.framing == FRAMING_LENGTH && resp.content_length > max_len)
+        co_return RELAY_BAD_GATEWAY;
+    relay_body state(resp);
+    state.accept(in.data(), in.size(), &body);
+
+    coro_loop *loop = coro_loop::get_instance();
+    long deadline = coro_loop::now_ms() + RELAY_TIMEOUT_MS;
+    char buf[RELAY_BUFFER_SIZE];
+    while (!state.finished())
+    {
+        if (state.chunks.error() || body.size() > max_len)
+            co_return RELAY_BAD_GATEWAY;
+        ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+            state.accept(buf, n, &body);
+        else if (n == 0)
+        {
+            if (state.framing != FRAMING_CLOSE)
+                co_return RELAY_BAD_GATEWAY;
+            state.eof = true;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (!co_await loop->wait(conn.fd, EPOLLIN, deadline))
+                co_return RELAY_TIMEOUT;
+        }
+        else if (errno != EINTR)
+            co_return RELAY_BAD_GATEWAY;
+    }
+    if (state.chunks.error() || body.size() > max_len)
+        co_return RELAY_BAD_GATEWAY;
+    resp.keep_alive = state.reusable;
+    co_return RELAY_OK;
+}
+
+relay_body::relay_body(const upstream_response &resp)
+    : framing(resp.framing), remaining(resp.content_length), reusable(resp.keep_alive), eof(false)
+{
+}
+
+size_t relay_body::accept(const char *data, size_t len, std::string *decoded)
+{
+    size_t n = 0;
+    switch (framing)
+    {
+        case FRAMING_LENGTH:
+            n = len < remaining ? len : remaining;
+            remaining -= n;
+            if (decoded)
+                decoded->append(data, n);
+            break;
+        case FRAMING_CHUNKED:
+            n = chunks.scan(data, len, decoded);
+            break;
+        case FRAMING_CLOSE:
+            n = len;
+            if (decoded)
+                decoded->append(data, n);
+            break;
+        default:
+            break;
+    }
+    //上游在响应体之后多发了数据，连接状态不可信
+    if (n < len)
+        reusable = false;
+    return n;
+}
+
+bool relay_body::finished() const
+{
+    switch (framing)
+    {
+        case FRAMING_LENGTH:
+            return remaining == 0;
+        case FRAMING_CHUNKED:
+            return chunks.done();
+        case FRAMING_CLOSE:
+            return eof;
+        default:
+            return true;
+    }
+}
+
+proxy_stream::proxy_stream(upstream_pool *pool, const upstream_conn &conn, const upstream_response &resp)
+    : pool(pool), conn(conn), body(resp), attached(false), registered(false), piped(0), buf_start(0), buf_end(0)
+{
+    pipe_fd[0] = pipe_fd[1] = -1;
+}
+
+proxy_stream::~proxy_stream()
+{
+    if (pipe_fd[0] >= 0)
+    {
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+    }
+}
+
+void proxy_stream::open(bool can_splice)
+{
+    if (can_splice && body.framing != FRAMING_CHUNKED && pipe2(pipe_fd, O_NONBLOCK | O_CLOEXEC) == 0)
+        return;
+    pipe_fd[0] = pipe_fd[1] = -1;
+    buf.reset(new char[RELAY_BUFFER_SIZE]);
+}
@@ -0,0 +1,161 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include "upstream.h"
+#include "../coro/coro_task.h"
+
+// 反向代理的 HTTP/1.1 报文处理：生成转发给上游的请求头，与上游交换请求和响应头（协程，见 coro/coro_loop.h），
+// 识别响应体的边界，以及向客户端转发响应体时的状态。只操作上游描述符和字符串，与 http_conn 无关。
+
+const int RELAY_TIMEOUT_MS = 10000;         // 一次交换（发出请求到收齐响应头）的总时限，须小于客户端空闲超时
+const size_t RELAY_MAX_HEAD = 16 << 10;     // 上游响应头的最大长度
+const size_t RELAY_PIPE_SIZE = 64 << 10;    // 一次 splice 最多搬运的字节数（管道默认容量）
+const size_t RELAY_BUFFER_SIZE = 16 << 10;  // 不能 splice 时经用户态转发的缓冲区大小
+
+enum RELAY_RESULT
+{
+    RELAY_OK = 0,
+    RELAY_BAD_GATEWAY,      // 连不上上游、上游断开或响应格式错误，回复 502
+    RELAY_TIMEOUT           // 上游未在时限内给出响应头，回复 504
+};
+
+// 响应体的边界
+enum RELAY_FRAMING
+{
+    FRAMING_NONE = 0,       // 没有响应体（1xx/204/304）
+    FRAMING_LENGTH,         // Content-Length
+    FRAMING_CHUNKED,        // 分块传输编码：原样转发，扫描分块格式确定结束位置
+    FRAMING_CLOSE           // 既无长度也不分块，读到上游关闭为止，客户端连接随后也要关闭
+};
+
+// 请求头列表（名称, 值），名称的大小写保持原样
+typedef std::vector<std::pair<std::string, std::string>> relay_headers;
+
+// 逐跳头部（RFC 9110 7.6.1），代理不转发
+bool relay_hop_by_hop(const char *name, size_t len);
+
+// 生成转发给上游的请求头：客户端的端到端头部原样转发，请求体（可能来自分块编码）一律以 Content-Length 发出，
+// 与上游之间固定使用长连接
+class relay_request
+{
+public:
+    relay_request(const char *method, const char *path, size_t path_len);
+    // 加入一个客户端请求头：逐跳头部、Content-Length、Expect 跳过；
+    // 多个 Cookie 头（HTTP/2 允许拆分）合并为一个，X-Forwarded-For 在末尾追加客户端地址
+    void add_header(const char *name, size_t name_len, const char *value, size_t value_len);
+    // 补上合并后的头部和 Connection、Content-Length，返回完整的请求头
+    const std::string &finish(const char *client_ip, bool tls, size_t body_len);
+
+private:
+    std::string m_head;
+    std::string m_cookie;
+    std::string m_forwarded_for;
+    bool m_post;
+};
+
+// 上游响应头的解析结果
+struct upstream_response
+{
+    upstream_response() : status(0), framing(FRAMING_NONE), content_length(0), keep_alive(false) {}
+
+    int status;
+    std::string reason;
+    RELAY_FRAMING framing;
+    uint64_t content_length;
+    bool keep_alive;            // 响应体读完后上游连接可以复用
+    std::string headers;        // 去掉逐跳头部后的头部行，每行以 CRLF 结尾
+};
+
+// 扫描分块传输编码的响应体，确定最后一个分块及 trailer 的结束位置；decoded 不为空时同时取出分块数据
+class chunk_scanner
+{
+public:
+    chunk_scanner() : m_state(STATE_SIZE), m_size(0), m_digits(0) {}
+
+    // 返回 data 中属于响应体的字节数，响应体在其中结束时之后的字节不计入；格式错误时 error() 为 true
+    size_t scan(const char *data, size_t len, std::string *decoded = NULL);
+    bool done() const { return m_state == STATE_DONE; }
+    bool error() const { return m_state == STATE_ERROR; }
+
+private:
+    enum STATE
+    {
+        STATE_SIZE = 0,         // 分块长度（十六进制）
+        STATE_EXT,              // 分块扩展，忽略到 CR
+        STATE_SIZE_LF,
+        STATE_DATA,
+        STATE_DATA_CR,
+        STATE_DATA_LF,
+        STATE_TRAILER_START,    // trailer 行首：CR 表示结束
+        STATE_TRAILER,
+        STATE_TRAILER_LF,
+        STATE_LAST_LF,
+        STATE_DONE,
+        STATE_ERROR
+    };
+
+    STATE m_state;
+    uint64_t m_size;            // 当前分块剩余字节数
+    int m_digits;
+};
+
+// 完成一次交换：借出上游连接，发出请求头和请求体，读到完整的响应头（跳过 1xx），
+// in 中返回随响应头一起到达的部分响应体。成功时连接由调用方归还，失败时已归还。
+// 复用的空闲连接在收到任何响应之前断开时（上游恰好关闭了空闲连接），幂等请求换一条新连接重试一次。
+// 在主线程中等待上游时挂起，在工作线程中以 sync() 同步执行
+coro_task<RELAY_RESULT> relay_exchange(upstream_pool *pool, const std::string &head, const std::string &body,
+                                       bool idempotent, upstream_conn &conn, upstream_response &resp, std::string &in);
+// 读完整个响应体，分块编码时解码（HTTP/2 的请求和写入缓存的响应需要完整的响应体）。响应体超过 max_len 返回 RELAY_BAD_GATEWAY；
+// 结束后多出数据时把 resp.keep_alive 置为 false
+coro_task<RELAY_RESULT> relay_read_body(upstream_conn &conn, upstream_response &resp, const std::string &in,
+                                        size_t max_len, std::string &body);
+
+// 响应体的边界状态：逐段输入从上游读到的字节，判断响应体何时结束
+struct relay_body
+{
+    explicit relay_body(const upstream_response &resp);
+
+    // 返回 len 字节中属于响应体的字节数；decoded 不为空时把响应体内容（分块编码时为解码后的数据）追加进去。
+    // 响应体结束后还有多余字节时上游连接不能复用
+    size_t accept(const char *data, size_t len, std::string *decoded = NULL);
+    bool finished() const;
+
+    RELAY_FRAMING framing;
+    uint64_t remaining;         // FRAMING_LENGTH：尚未读出的响应体字节数
+    chunk_scanner chunks;       // FRAMING_CHUNKED
+    bool reusable;              // 响应体读完后上游连接可以复用
+    bool eof;                   // FRAMING_CLOSE：上游已关闭
+};
+
+// 向客户端转发响应体的状态。响应头和随之到达的部分响应体由普通写路径发出，其余部分在写事件中边读边写
+struct proxy_stream
+{
+    proxy_stream(upstream_pool *pool, const upstream_conn &conn, const upstream_response &resp);
+    ~proxy_stream();
+    proxy_stream(const proxy_stream &) = delete;
+    proxy_stream &operator=(const proxy_stream &) = delete;
+
+    // 准备转发通道：能 splice 时创建管道，否则分配缓冲区。分块编码需要看到数据，只能经缓冲区
+    void open(bool can_splice);
+    size_t pending() const { return pipe_fd[0] >= 0 ? piped : buf_end - buf_start; }
+
+    upstream_pool *pool;
+    upstream_conn conn;
+    relay_body body;
+    bool attached;              // 已登记到 upstream_table
+    bool registered;            // 上游描述符已加入 epoll
+    int pipe_fd[2];             // splice 使用的管道，-1 表示经缓冲区转发
+    size_t piped;               // 管道中尚未写给客户端的字节数
+    std::unique_ptr<char[]> buf;
+    size_t buf_start;
+    size_t buf_end;
+};
+
+#endif
@@ -0,0 +1,428 @@
+#include "response_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+
+static bool iequals(const std::string &name, const char *target)
+{
+    return strcasecmp(name.c_str(), target) == 0;
+}
+
+//逗号分隔的列表逐项回调，项两端的空白已去掉
+template <typename F>
+static void for_each_token(const char *value, size_t len, F fn)
+{
+    const char *p = value, *end = value + len;
+    while (p < end)
+    {
+        const char *comma = static_cast<const char *>(memchr(p, ',', end - p));
+        const char *stop = comma ? comma : end;
+        const char *first = p, *last = stop;
+        while (first < last && (*first == ' ' || *first == '\t'))
+            ++first;
+        while (last > first && (last[-1] == ' ' || last[-1] == '\t'))
+            --last;
+        if (first < last)
+            fn(first, last - first);
+        p = comma ? comma + 1 : end;
+    }
+}
+
+//请求自身要求不使用缓存，或携带凭据（响应可能因人而异）
+static bool bypass(const relay_headers &headers)
+{
+    for (const auto &h : headers)
+    {
+        if (iequals(h.first, "authorization"))
+            return true;
+        if (iequals(h.first, "cache-control") || iequals(h.first, "pragma"))
+        {
+            bool no_cache = false;
+            for_each_token(h.second.data(), h.second.size(), [&no_cache](const char *token, size_t len) {
+                if ((len == 8 && strncasecmp(token, "no-cache", 8) == 0) ||
+                    (len == 8 && strncasecmp(token, "no-store", 8) == 0))
+                    no_cache = true;
+            });
+            if (no_cache)
+                return true;
+        }
+    }
+    return false;
+}
+
+static std::string base_key(const std::string &path, const relay_headers &headers)
+{
+    std::string key("GET ");
+    for (const auto &h : headers)
+    {
+        if (iequals(h.first, "host"))
+        {
+            key.append(h.second);
+            break;
+        }
+    }
+    key.append(path);
+    return key;
+}
+
+//由响应头判断能否缓存：只缓存显式给出 s-maxage/max-age、不带 Set-Cookie、响应体长度已知且不超过上限的响应
+static std::shared_ptr<cached_response> make_entry(const upstream_response &resp, size_t max_size)
+{
+    switch (resp.status)
+    {
+        case 200: case 203: case 204: case 300: case 301: case 404: case 410:
+            break;
+        default:
+            return nullptr;
+    }
+    if (resp.framing == FRAMING_LENGTH ? resp.content_length > max_size : resp.framing != FRAMING_NONE)
+        return nullptr;
+
+    std::shared_ptr<cached_response> entry = std::make_shared<cached_response>();
+    long max_age = -1, s_maxage = -1, swr = 0, age = 0;
+    bool no_store = false;
+    const char *p = resp.headers.data();
+    const char *end = p + resp.headers.size();
+    while (p < end)
+    {
+        const char *eol = static_cast<const char *>(memmem(p, end - p, "\r\n", 2));
+        if (!eol)
+            break;
+        const char *colon = static_cast<const char *>(memchr(p, ':', eol - p));
+        std::string name(p, colon ? colon - p : 0);
+        const char *value = colon ? colon + 1 : eol;
+        while (value < eol && (*value == ' ' || *value == '\t'))
+            ++value;
+        size_t value_len = eol - value;
+
+        if (iequals(name, "cache-control"))
+        {
+            for_each_token(value, value_len, [&](const char *token, size_t len) {
+                const char *eq = static_cast<const char *>(memchr(token, '=', len));
+                size_t name_len = eq ? eq - token : len;
+                long n = eq ? atol(eq + 1 + (eq[1] == '"')) : 0;
+                if ((name_len == 8 && strncasecmp(token, "no-store", 8) == 0) ||
+                    (name_len == 8 && strncasecmp(token, "no-cache", 8) == 0) ||
+                    (name_len == 7 && strncasecmp(token, "private", 7) == 0))
+                    no_store = true;
+                else if (name_len == 7 && strncasecmp(token, "max-age", 7) == 0)
+                    max_age = n;
+                else if (name_len == 8 && strncasecmp(token, "s-maxage", 8) == 0)
+                    s_maxage = n;
+                else if (name_len == 22 && strncasecmp(token, "stale-while-revalidate", 22) == 0)
+                    swr = n;
+            });
+        }
+        else if (iequals(name, "set-cookie"))
+            return nullptr;
+        else if (iequals(name, "vary"))
+        {
+            for_each_token(value, value_len, [&](const char *token, size_t len) {
+                std::string field(token, len);
+                std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+                if (field == "*")
+                    no_store = true;
+                entry->vary.push_back(field);
+            });
+        }
+        else if (iequals(name, "age"))
+        {
+            //Age 在发出时按缓存时长重新计算
+            age = atol(value);
+            p = eol + 2;
+            continue;
+        }
+        entry->headers.append(p, eol + 2 - p);
+        p = eol + 2;
+    }
+
+    //共享缓存优先使用 s-maxage
+    long lifetime = s_maxage >= 0 ? s_maxage : max_age;
+    if (no_store || lifetime <= age)
+        return nullptr;
+    std::sort(entry->vary.begin(), entry->vary.end());
+    entry->vary.erase(std::unique(entry->vary.begin(), entry->vary.end()), entry->vary.end());
+    entry->status = resp.status;
+    entry->reason = resp.reason;
+    entry->stored = time(NULL);
+    entry->age = age;
+    entry->fresh_until = entry->stored + lifetime - age;
+    entry->stale_until = entry->fresh_until + (swr > 0 ? swr : 0);
+    entry->revalidating = false;
+    entry->hot = false;
+    entry->bytes = 0;
+    return entry;
+}
+
+void response_cache::init(size_t byte_budget)
+{
+    m_byte_budget = byte_budget;
+}
+
+//键 = 方法 + Host + 路径，再加上该资源上一次响应的 Vary 所列请求头的取值
+std::string response_cache::variant_key(const std::string &base, const relay_headers &headers) const
+{
+    auto it = m_vary.find(base);
+    if (it == m_vary.end())
+        return base;
+    std::string key = base;
+    for (const std::string &field : it->second)
+    {
+        key.append("\n").append(field).append(":");
+        for (const auto &h : headers)
+            if (iequals(h.first, field.c_str()))
+                key.append(h.second).append(",");
+    }
+    return key;
+}
+
+CACHE_STATUS response_cache::lookup(const char *method, const std::string &path, const relay_headers &headers,
+                                    std::string &key, std::shared_ptr<const cached_response> &out, bool waited)
+{
+    if (!enabled() || strcmp(method, "GET") != 0 || bypass(headers))
+        return CACHE_BYPASS;
+    std::string base = base_key(path, headers);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    key = variant_key(base, headers);
+    time_t now = time(NULL);
+    auto it = m_index.find(key);
+    if (it != m_index.end())
+    {
+        std::shared_ptr<cached_response> entry = *it->second;
+        if (now < entry->stale_until)
+        {
+            touch(*entry);
+            out = entry;
+            if (now < entry->fresh_until)
+            {
+                ++m_hits;
+                return CACHE_HIT;
+            }
+            //过期但仍在 stale-while-revalidate 窗口内：照常使用，只让第一个请求负责重新获取
+            ++m_stale;
+            if (entry->revalidating)
+                return CACHE_HIT;
+            entry->revalidating = true;
+            return CACHE_STALE;
+        }
+    }
+    //等到的获取结果不可缓存，各自访问上游
+    if (waited)
+        return CACHE_BYPASS;
+
+    if (m_flights.find(key) == m_flights.end())
+    {
+        m_flights[key] = std::make_shared<flight>();
+        ++m_misses;
+        return CACHE_MISS;
+    }
+    //同一 key 正在向上游获取：由调用方等待其完成后重新查找
+    ++m_coalesced;
+    return CACHE_PENDING;
+}
+
+bool response_cache::flight_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lock(cache->m_mutex);
+    auto f = cache->m_flights.find(key);
+    if (f == cache->m_flights.end())
+        return false;
+    f->second->waiters.push_back(h);
+    if (handle)
+        *handle = h;
+    return true;
+}
+
+bool response_cache::cancel_wait(const std::string &key, std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto f = m_flights.find(key);
+    if (f == m_flights.end())
+        return false;
+    std::vector<std::coroutine_handle<>> &waiters = f->second->waiters;
+    auto it = std::find(waiters.begin(), waiters.end(), h);
+    if (it == waiters.end())
+        return false;
+    waiters.erase(it);
+    return true;
+}
+
+coro_task<RELAY_RESULT> response_cache::fetch(upstream_pool *pool, const std::string &head, const std::string &path,
+                                              const relay_headers &headers, const std::string &key, upstream_conn &conn,
+                                              upstream_response &resp, std::string &in,
+                                              std::shared_ptr<const cached_response> &out)
+{
+    std::string base = base_key(path, headers);
+    RELAY_RESULT result = co_await relay_exchange(pool, head, std::string(), true, conn, resp, in);
+    if (result != RELAY_OK)
+    {
+        complete(key, base, headers, nullptr, true);
+        co_return result;
+    }
+
+    std::shared_ptr<cached_response> entry = make_entry(resp, MAX_ENTRY_SIZE);
+    if (!entry)
+    {
+        complete(key, base, headers, nullptr, false);
+        co_return RELAY_OK;
+    }
+    result = co_await relay_read_body(conn, resp, in, MAX_ENTRY_SIZE, entry->body);
+    pool->release(conn, result == RELAY_OK && resp.keep_alive);
+    if (result != RELAY_OK)
+    {
+        complete(key, base, headers, nullptr, true);
+        co_return result;
+    }
+    complete(key, base, headers, entry, false);
+    out = entry;
+    co_return RELAY_OK;
+}
+
+coro_task<void> response_cache::revalidate(upstream_pool *pool, std::string head, std::string path,
+                                           relay_headers headers, std::string key)
+{
+    co_await coro_loop::get_instance()->schedule();
+    upstream_conn conn;
+    upstream_response resp;
+    std::string in;
+    std::shared_ptr<const cached_response> out;
+    //响应已变得不可缓存：旧条目已删除，连接上还有未读的响应体，直接关闭
+    if (co_await fetch(pool, head, path, headers, key, conn, resp, in, out) == RELAY_OK && !out)
+        pool->release(conn, false);
+}
+
+//获取结束：可缓存时写入新条目；获取失败时保留旧条目等待下一次重新获取；响应不再可缓存时删除旧条目
+void response_cache::complete(const std::string &key, const std::string &base, const relay_headers &headers,
+                              const std::shared_ptr<cached_response> &entry, bool failed)
+{
+    std::vector<std::coroutine_handle<>> waiters;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (entry)
+    {
+        if (entry->vary.empty())
+            m_vary.erase(base);
+        else
+            m_vary[base] = entry->vary;
+        entry->key = variant_key(base, headers);
+        if (entry->key != key)
+            erase(key);
+        insert(entry);
+    }
+    else if (failed)
+    {
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+            (*it->second)->revalidating = false;
+    }
+    else
+        erase(key);
+
+    auto f = m_flights.find(key);
+    if (f != m_flights.end())
+    {
+        waiters.swap(f->second->waiters);
+        m_flights.erase(f);
+    }
+    lock.unlock();
+    //等待者统一在主线程的下一轮事件循环中恢复，获取者自己也在主线程时不会在此重入
+    for (std::coroutine_handle<> h : waiters)
+        coro_loop::get_instance()->post(h);
+}
+
+//新条目进入试用段表头；超出预算时先淘汰试用段表尾
+void response_cache::insert(const std::shared_ptr<cached_response> &entry)
+{
+    entry->bytes = sizeof(cached_response) + entry->key.size() + entry->headers.size() + entry->body.size();
+    erase(entry->key);
+    if (entry->bytes > m_byte_budget)
+        return;
+
+    m_probation.push_front(entry);
+    m_index[entry->key] = m_probation.begin();
+    m_probation_bytes += entry->bytes;
+    evict();
+}
+
+//超出预算时先淘汰试用段表尾，试用段空了再淘汰受保护段；调用方持有锁
+void response_cache::evict()
+{
+    while (m_probation_bytes + m_protected_bytes > m_byte_budget)
+    {
+        lru_list &victims = m_probation.empty() ? m_protected : m_probation;
+        std::string victim = victims.back()->key;
+        //淘汰带 Vary 的条目时一并忘掉其 Vary 记录，其余变体下次按无 Vary 的键未命中后重新记录
+        if (!victims.back()->vary.empty())
+            m_vary.erase(victim.substr(0, victim.find('\n')));
+        erase(victim);
+    }
+}
+
+void response_cache::set_budget(size_t byte_budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byte_budget = byte_budget;
+    evict();
+}
+
+void response_cache::erase(const std::string &key)
+{
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+        return;
+    std::shared_ptr<cached_response> entry = *it->second;
+    if (entry->hot)
+    {
+        m_protected_bytes -= entry->bytes;
+        m_protected.erase(it->second);
+    }
+    else
+    {
+        m_probation_bytes -= entry->bytes;
+        m_probation.erase(it->second);
+    }
+    m_index.erase(it);
+}
+
+//命中：试用段的条目升入受保护段，受保护段超出比例时把表尾降回试用段
+void response_cache::touch(cached_response &entry)
+{
+    lru_list::iterator it = m_index[entry.key];
+    if (entry.hot)
+    {
+        m_protected.splice(m_protected.begin(), m_protected, it);
+        return;
+    }
+    m_protected.splice(m_protected.begin(), m_probation, it);
+    entry.hot = true;
+    m_probation_bytes -= entry.bytes;
+    m_protected_bytes += entry.bytes;
+
+    size_t limit = m_byte_budget / 100 * PROTECTED_PERCENT;
+    while (m_protected_bytes > limit && m_protected.size() > 1)
+    {
+        lru_list::iterator last = std::prev(m_protected.end());
+        (*last)->hot = false;
+        m_protected_bytes -= (*last)->bytes;
+        m_probation_bytes += (*last)->bytes;
+        m_probation.splice(m_probation.begin(), m_protected, last);
+    }
+}
+
+void response_cache::metrics(std::string &text)
+{
+    if (!enabled())
+        return;
+    char line[256];
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int len = snprintf(line, sizeof(line),
+                       "proxy_cache_entries %zu\nproxy_cache_bytes %zu\nproxy_cache_hits %lu\n"
+                       "proxy_cache_stale %lu\nproxy_cache_misses %lu\nproxy_cache_coalesced %lu\n",
+                       m_index.size(), m_probation_bytes + m_protected_bytes, m_hits, m_stale, m_misses,
+                       m_coalesced);
+    text.append(line, len);
+}
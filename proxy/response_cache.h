@@ -0,0 +1,133 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "relay.h"
+#include "../coro/coro_loop.h"
+
+// 一个缓存的上游响应
+struct cached_response
+{
+    std::string key;            // 方法 + Host + 路径 + Vary 所列请求头的取值
+    int status;
+    std::string reason;
+    std::string headers;        // 上游响应头行（已去掉逐跳头部和 Age），每行以 CRLF 结尾
+    std::string body;
+    std::vector<std::string> vary;  // 响应 Vary 所列请求头（小写，已排序）
+    time_t stored;             // 写入缓存的时刻
+    time_t age;                 // 写入时上游给出的 Age
+    time_t fresh_until;         // 在此之前直接使用
+    time_t stale_until;         // stale-while-revalidate：在此之前仍可使用，同时在后台重新获取
+    bool revalidating;          // 已有请求负责重新获取
+    bool hot;                   // 位于受保护段
+    size_t bytes;               // 计入预算的字节数
+};
+
+enum CACHE_STATUS
+{
+    CACHE_HIT = 0,      // 命中，直接使用 out
+    CACHE_STALE,        // 命中过期条目：使用 out，响应发出后由调用方 revalidate()
+    CACHE_MISS,         // 未命中：调用方负责 fetch()，同一 key 的并发请求等待其结果
+    CACHE_PENDING,      // 同一 key 正在向上游获取：co_await wait_flight() 后以 waited 为 true 重新查找，或直接访问上游
+    CACHE_BYPASS        // 不使用缓存（非 GET、带 Authorization/no-cache，或等待的获取结果不可缓存）
+};
+
+// 反向代理的响应缓存：按 Cache-Control 的 s-maxage/max-age 缓存 GET 响应，键为方法 + Host + 路径 + Vary 所列请求头。
+// 按字节预算做分段 LRU：新条目进入试用段，再次命中才升入受保护段，只被访问一次的响应不会挤掉热点条目。
+// 同一 key 的并发未命中只有第一个请求访问上游，其余挂起在主线程的事件循环上等待结果（请求合并），不阻塞任何线程。
+class response_cache
+{
+public:
+    static const size_t MAX_ENTRY_SIZE = 1 << 20;   // 单个响应体的缓存上限
+    static const int PROTECTED_PERCENT = 80;        // 受保护段占预算的比例
+
+    static response_cache *get_instance()
+    {
+        static response_cache instance;
+        return &instance;
+    }
+
+    void init(size_t byte_budget);
+    // 运行中修改字节预算（SIGHUP 重新加载配置），调小时立即淘汰到预算以内，为 0 时清空并停止缓存
+    void set_budget(size_t byte_budget);
+    bool enabled() const { return m_byte_budget > 0; }
+
+    // 查找 method + host + path 对应的响应。headers 为请求头（名称不区分大小写），key 返回实际使用的键。
+    // waited 为 true 表示已等过同一 key 的获取，仍未命中时返回 CACHE_BYPASS
+    CACHE_STATUS lookup(const char *method, const std::string &path, const relay_headers &headers,
+                        std::string &key, std::shared_ptr<const cached_response> &out, bool waited = false);
+
+    // 等待 key 正在进行的获取结束，之后在主线程中继续；获取已经结束时不挂起。
+    // handle 不为空时挂起期间记下协程，供 cancel_wait 取消
+    struct flight_awaiter
+    {
+        response_cache *cache;
+        std::string key;
+        std::coroutine_handle<> *handle;
+
+        bool await_ready() const { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        void await_resume() const {}
+    };
+    flight_awaiter wait_flight(const std::string &key, std::coroutine_handle<> *handle = NULL)
+    {
+        return flight_awaiter{this, key, handle};
+    }
+    // 把挂起在 key 的获取上的协程 h 移出等待者，由调用方负责恢复；获取已结束（h 已交给主线程）时返回 false
+    bool cancel_wait(const std::string &key, std::coroutine_handle<> h);
+
+    // 未命中或过期时向上游获取：响应可缓存时读完响应体写入缓存，out 返回该条目，连接已归还；
+    // 否则 out 为空，连接和 resp/in 交给调用方照常转发。无论结果如何都唤醒等待同一 key 的请求
+    coro_task<RELAY_RESULT> fetch(upstream_pool *pool, const std::string &head, const std::string &path,
+                                  const relay_headers &headers, const std::string &key, upstream_conn &conn,
+                                  upstream_response &resp, std::string &in, std::shared_ptr<const cached_response> &out);
+    // 后台重新获取过期条目（CACHE_STALE）：以 coro_spawn 启动，转到主线程上执行，不占用发起它的线程
+    coro_task<void> revalidate(upstream_pool *pool, std::string head, std::string path, relay_headers headers,
+                               std::string key);
+
+    void metrics(std::string &text);
+
+private:
+    response_cache() : m_byte_budget(0), m_probation_bytes(0), m_protected_bytes(0),
+                       m_hits(0), m_stale(0), m_misses(0), m_coalesced(0) {}
+    ~response_cache() {}
+
+    typedef std::list<std::shared_ptr<cached_response>> lru_list;
+
+    struct flight
+    {
+        std::vector<std::coroutine_handle<>> waiters;  // 等待结果的协程，获取结束后交给主线程恢复
+    };
+
+    std::string variant_key(const std::string &base, const relay_headers &headers) const;
+    void complete(const std::string &key, const std::string &base, const relay_headers &headers,
+                  const std::shared_ptr<cached_response> &entry, bool failed);
+    void insert(const std::shared_ptr<cached_response> &entry);
+    void erase(const std::string &key);
+    void touch(cached_response &entry);
+    void evict();
+
+    std::atomic<size_t> m_byte_budget;
+    size_t m_probation_bytes;
+    size_t m_protected_bytes;
+    lru_list m_probation;       // 试用段，表头为最近使用
+    lru_list m_protected;       // 受保护段，表头为最近使用
+    std::unordered_map<std::string, lru_list::iterator> m_index;
+    std::unordered_map<std::string, std::vector<std::string>> m_vary;   // 方法 + Host + 路径 -> Vary 所列请求头
+    std::unordered_map<std::string, std::shared_ptr<flight>> m_flights; // 正在向上游获取的 key
+    unsigned long m_hits;
+    unsigned long m_stale;
+    unsigned long m_misses;
+    unsigned long m_coalesced;
+    std::mutex m_mutex;
+};
+
+#endif
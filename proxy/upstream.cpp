@@ -0,0 +1,305 @@
+#include "upstream.h"
+#include "../http/http_conn.h"
+#include "../coro/coro_loop.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+
+upstream_pool::~upstream_pool()
+{
+    for (auto &server : m_servers)
+        for (int fd : server->idle)
+            close(fd);
+}
+
+bool upstream_pool::add_server(const std::string &addr)
+{
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == addr.size())
+        return false;
+    std::string host = addr.substr(0, colon);
+    std::string port = addr.substr(colon + 1);
+
+    //地址只在启动时解析一次
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+        return false;
+
+    std::unique_ptr<upstream_server> server(new upstream_server);
+    server->name = addr;
+    memcpy(&server->addr, res->ai_addr, sizeof(server->addr));
+    freeaddrinfo(res);
+    m_servers.push_back(std::move(server));
+    return true;
+}
+
+//最少连接数：优先选未处于失败暂停期、借出连接最少的上游；连接数相同时从轮转起点开始，避免总压在第一个上游。
+//全部处于暂停期时选最早恢复的一个，仍然尝试连接
+upstream_server *upstream_pool::pick(time_t now, const upstream_server *skip)
+{
+    size_t n = m_servers.size();
+    size_t start = m_next++ % n;
+    upstream_server *best = NULL;
+    bool best_up = false;
+    for (size_t i = 0; i < n; ++i)
+    {
+        upstream_server *server = m_servers[(start + i) % n].get();
+        if (server == skip)
+            continue;
+        bool up = server->down_until <= now;
+        if (!best || (up && !best_up) ||
+            (up && server->active < best->active) ||
+            (!up && !best_up && server->down_until < best->down_until))
+        {
+            best = server;
+            best_up = up;
+        }
+    }
+    return best;
+}
+
+//取一条空闲长连接：上游可能已关闭它（空闲超时），MSG_PEEK 探测到关闭或有多余数据的连接直接丢弃
+int upstream_pool::take_idle(upstream_server *server)
+{
+    while (true)
+    {
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(server->lock);
+            if (server->idle.empty())
+                return -1;
+            fd = server->idle.back();
+            server->idle.pop_back();
+        }
+        char c;
+        if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return fd;
+        close(fd);
+    }
+}
+
+//非阻塞 connect，最多等待 CONNECT_TIMEOUT_MS（主线程中挂起等待，工作线程中就地等待）。
+//等待期间描述符记在 conn.fd 中，客户端连接关闭时 coro_loop::cancel 可以据此提前结束等待
+coro_task<int> upstream_pool::connect_server(upstream_server *server, upstream_conn &conn)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        co_return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr *)&server->addr, sizeof(server->addr)) == 0)
+        co_return fd;
+    if (errno == EINPROGRESS)
+    {
+        coro_loop *loop = coro_loop::get_instance();
+        int err = 0;
+        socklen_t len = sizeof(err);
+        conn.fd = fd;
+        bool ok = co_await loop->wait(fd, EPOLLOUT, coro_loop::now_ms() + CONNECT_TIMEOUT_MS) &&
+                  getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+        conn.fd = -1;
+        if (ok)
+            co_return fd;
+    }
+    close(fd);
+    co_return -1;
+}
+
+coro_task<bool> upstream_pool::acquire(upstream_conn &conn, bool fresh)
+{
+    time_t now = time(NULL);
+    const upstream_server *failed = NULL;
+    for (size_t attempt = 0; attempt < m_servers.size(); ++attempt)
+    {
+        upstream_server *server = pick(now, failed);
+        if (!server)
+            break;
+        server->active++;
+        int fd = fresh ? -1 : take_idle(server);
+        conn.reused = fd >= 0;
+        if (fd < 0)
+            fd = co_await connect_server(server, conn);
+        if (fd >= 0)
+        {
+            conn.fd = fd;
+            conn.server = server;
+            co_return true;
+        }
+        server->active--;
+        //客户端连接关闭而取消，不是上游的问题
+        if (conn.cancelled)
+            break;
+        server->down_until = now + FAIL_TIMEOUT;
+        failed = server;
+    }
+    co_return false;
+}
+
+void upstream_pool::release(upstream_conn &conn, bool reusable)
+{
+    if (conn.fd < 0)
+        return;
+    bool kept = false;
+    if (reusable)
+    {
+        std::lock_guard<std::mutex> lock(conn.server->lock);
+        if (conn.server->idle.size() < MAX_IDLE)
+        {
+            conn.server->idle.push_back(conn.fd);
+            kept = true;
+        }
+    }
+    if (!kept)
+        close(conn.fd);
+    conn.server->active--;
+    conn.fd = -1;
+    conn.server = NULL;
+}
+
+void upstream_pool::forget(upstream_conn &conn)
+{
+    if (conn.fd < 0)
+        return;
+    conn.server->active--;
+    conn.fd = -1;
+    conn.server = NULL;
+}
+
+void upstream_pool::metrics(std::string &text)
+{
+    char line[512];
+    for (auto &server : m_servers)
+    {
+        size_t idle;
+        {
+            std::lock_guard<std::mutex> lock(server->lock);
+            idle = server->idle.size();
+        }
+        int len = snprintf(line, sizeof(line),
+                           "upstream_active{prefix=\"%s\",addr=\"%s\"} %d\nupstream_idle{prefix=\"%s\",addr=\"%s\"} %zu\n",
+                           m_prefix.c_str(), server->name.c_str(), server->active.load(),
+                           m_prefix.c_str(), server->name.c_str(), idle);
+        text.append(line, len);
+    }
+}
+
+bool upstream_table::load(const char *path, std::string &err)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return true;
+
+    char line[1024];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        ++line_no;
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        char *save = NULL;
+        char *prefix = strtok_r(line, " \t\r\n", &save);
+        if (!prefix)
+            continue;
+
+        char where[64];
+        snprintf(where, sizeof(where), "%s:%d: ", path, line_no);
+        if (prefix[0] != '/')
+        {
+            err = std::string(where) + "prefix must start with '/'";
+            ok = false;
+            break;
+        }
+        std::unique_ptr<upstream_pool> pool(new upstream_pool(prefix));
+        char *addr;
+        while ((addr = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            if (!pool->add_server(addr))
+            {
+                err = std::string(where) + "cannot resolve " + addr;
+                ok = false;
+                break;
+            }
+        }
+        if (ok && pool->empty())
+        {
+            err = std::string(where) + "no upstream for " + prefix;
+            ok = false;
+        }
+        if (ok)
+            m_pools.push_back(std::move(pool));
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        m_pools.clear();
+        return false;
+    }
+
+    //按前缀长度降序排列，顺序查找时第一个命中的就是最长前缀
+    std::stable_sort(m_pools.begin(), m_pools.end(),
+                     [](const std::unique_ptr<upstream_pool> &a, const std::unique_ptr<upstream_pool> &b) {
+                         return a->prefix().size() > b->prefix().size();
+                     });
+    return true;
+}
+
+upstream_pool *upstream_table::match(const char *path, size_t len) const
+{
+    for (auto &pool : m_pools)
+    {
+        const std::string &prefix = pool->prefix();
+        if (len < prefix.size() || memcmp(path, prefix.data(), prefix.size()) != 0)
+            continue;
+        //按路径段匹配：/api 匹配 /api、/api/x、/api?x，不匹配 /apix、/api-internal
+        if (len == prefix.size() || prefix.back() == '/' || path[prefix.size()] == '/' || path[prefix.size()] == '?')
+            return pool.get();
+    }
+    return NULL;
+}
+
+void upstream_table::metrics(std::string &text)
+{
+    for (auto &pool : m_pools)
+        pool->metrics(text);
+}
+
+void upstream_table::init(int max_fd)
+{
+    m_conns.assign(max_fd, NULL);
+    m_upstream.assign(max_fd, -1);
+    m_owner.assign(max_fd, NO_OWNER);
+}
+
+void upstream_table::attach(int client_fd, int upstream_fd, http_conn *conn)
+{
+    if (client_fd < 0 || client_fd >= (int)m_conns.size() || upstream_fd < 0)
+        return;
+    //上游描述符与客户端共用描述符空间，可能超出 MAX_FD：按需扩大，否则其事件找不到所属连接
+    if (upstream_fd >= (int)m_owner.size())
+        m_owner.resize(std::max((size_t)upstream_fd + 1, m_owner.size() * 2), NO_OWNER);
+    m_conns[client_fd] = conn;
+    m_upstream[client_fd] = upstream_fd;
+    m_owner[upstream_fd] = client_fd;
+}
+
+void upstream_table::detach(int client_fd)
+{
+    if (client_fd < 0 || client_fd >= (int)m_conns.size() || !m_conns[client_fd])
+        return;
+    m_owner[m_upstream[client_fd]] = NO_OWNER;
+    m_upstream[client_fd] = -1;
+    m_conns[client_fd] = NULL;
+}
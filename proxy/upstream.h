@@ -0,0 +1,125 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stddef.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "../coro/coro_task.h"
+
+class http_conn;
+
+// 反向代理的上游配置与连接池。
+// 每个上游池对应一个路径前缀和若干 host:port，请求按最少连接数选择上游；
+// 与上游之间使用 HTTP/1.1 长连接，响应读完后连接放回所属上游的空闲列表，下一个请求直接复用。
+
+// 一个上游服务器
+struct upstream_server
+{
+    upstream_server() : active(0), down_until(0) {}
+
+    std::string name;               // 配置中的 host:port
+    sockaddr_in addr;
+    std::atomic<int> active;        // 借出的连接数，最少连接数选择的依据
+    std::atomic<time_t> down_until; // 连接失败后在此时刻之前不再选择
+    std::mutex lock;                // 保护 idle
+    std::vector<int> idle;          // 空闲长连接，后进先出（最近用过的连接最可能仍然有效）
+};
+
+// 借出的一条上游连接，描述符始终为非阻塞
+struct upstream_conn
+{
+    upstream_conn() : fd(-1), server(NULL), reused(false), cancelled(false) {}
+
+    int fd;                         // 新建连接时在等待连接完成期间即已记下，以便取消等待
+    upstream_server *server;
+    bool reused;                    // 取自空闲列表：上游可能恰好在此时关闭了它
+    bool cancelled;                 // 客户端连接已关闭：等待已取消，不再重试，也不把上游记为失败
+};
+
+class upstream_pool
+{
+public:
+    static const size_t MAX_IDLE = 32;          // 每个上游保留的空闲长连接数
+    static const int CONNECT_TIMEOUT_MS = 1000; // 新建连接的超时
+    static const int FAIL_TIMEOUT = 10;         // 连接失败的上游暂停选择的秒数
+
+    explicit upstream_pool(const std::string &prefix) : m_prefix(prefix), m_next(0) {}
+    ~upstream_pool();
+
+    // 添加一个上游，addr 为 host:port，解析失败返回 false
+    bool add_server(const std::string &addr);
+
+    // 按最少连接数选择上游并借出一条连接：优先复用空闲长连接，没有时新建。
+    // fresh 为 true 时跳过空闲列表（复用的连接已失效后重试）。所有上游都连不上时返回 false。
+    // 新建连接时等待连接完成，与 relay_exchange 一样在主线程中挂起；conn.cancelled 时不再尝试其它上游
+    coro_task<bool> acquire(upstream_conn &conn, bool fresh = false);
+    // 归还连接：reusable 为 true 时放回空闲列表，否则关闭
+    void release(upstream_conn &conn, bool reusable);
+    // 结束借出但不关闭描述符，由调用方负责关闭
+    void forget(upstream_conn &conn);
+
+    const std::string &prefix() const { return m_prefix; }
+    bool empty() const { return m_servers.empty(); }
+    // 追加 /metrics 中每个上游的借出数和空闲数
+    void metrics(std::string &text);
+
+private:
+    upstream_server *pick(time_t now, const upstream_server *skip);
+    int take_idle(upstream_server *server);
+    coro_task<int> connect_server(upstream_server *server, upstream_conn &conn);
+
+    std::string m_prefix;
+    std::vector<std::unique_ptr<upstream_server>> m_servers;
+    std::atomic<unsigned> m_next;   // 连接数相同时的轮转起点
+};
+
+// 所有上游池，以及正在向客户端转发响应体的连接。
+// 配置在启动时加载，之后只读；转发表只在主线程中访问（reactor 模式下工作线程写出时主线程正等待 improv，不会并发）
+class upstream_table
+{
+public:
+    static constexpr int NO_OWNER = -1;    // 不是转发中的上游连接
+
+    static upstream_table *get_instance()
+    {
+        static upstream_table instance;
+        return &instance;
+    }
+
+    // 加载配置文件，每行 "前缀 host:port [host:port ...]"，# 之后为注释。
+    // 文件不存在时不启用反向代理；格式错误或地址无法解析时返回 false 并在 err 中给出原因
+    bool load(const char *path, std::string &err);
+    size_t size() const { return m_pools.size(); }
+    // 按最长前缀匹配请求路径（前缀之后须为 '/'、'?' 或路径结尾），未命中返回 NULL
+    upstream_pool *match(const char *path, size_t len) const;
+    void metrics(std::string &text);
+
+    void init(int max_fd);
+    // 客户端连接开始/结束转发响应体。只在主线程（或主线程等待时的工作线程）中调用
+    void attach(int client_fd, int upstream_fd, http_conn *conn);
+    void detach(int client_fd);
+    // 上游描述符上有事件时查找所属客户端连接，不是转发中的上游连接返回 NO_OWNER
+    int owner(int upstream_fd) const
+    {
+        if (upstream_fd < 0 || upstream_fd >= (int)m_owner.size())
+            return NO_OWNER;
+        return m_owner[upstream_fd];
+    }
+
+private:
+    upstream_table() {}
+    ~upstream_table() {}
+
+    std::vector<std::unique_ptr<upstream_pool>> m_pools;    // 按前缀长度降序，先匹配的即最长前缀
+    std::vector<http_conn *> m_conns;   // 按客户端描述符索引，正在转发响应体的连接
+    std::vector<int> m_upstream;        // 按客户端描述符索引，对应的上游描述符
+    std::vector<int> m_owner;           // 按上游描述符索引，所属客户端描述符
+};
+
+#endif
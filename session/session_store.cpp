@@ -0,0 +1,82 @@
+#include "session_store.h"
+
+#include <sys/random.h>
+#include <functional>
+
+void session_store::init(int ttl_seconds)
+{
+    m_ttl = ttl_seconds;
+}
+
+session_store::shard &session_store::shard_of(const std::string &token)
+{
+    return m_shards[std::hash<std::string>()(token) % SHARD_NUM];
+}
+
+std::string session_store::create(const std::string &user)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char raw[TOKEN_BYTES];
+    if (getrandom(raw, sizeof(raw), 0) != sizeof(raw))
+        return std::string();
+
+    std::string token(TOKEN_LEN, '0');
+    for (int i = 0; i < TOKEN_BYTES; ++i)
+    {
+        token[2 * i] = hex[raw[i] >> 4];
+        token[2 * i + 1] = hex[raw[i] & 0x0f];
+    }
+
+    shard &s = shard_of(token);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.sessions[token] = session{user, time(NULL) + m_ttl};
+    return token;
+}
+
+bool session_store::validate(const char *token, size_t len)
+{
+    if (!token || len != TOKEN_LEN)
+        return false;
+
+    std::string key(token, len);
+    time_t now = time(NULL);
+    shard &s = shard_of(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.sessions.find(key);
+    if (it == s.sessions.end())
+        return false;
+    if (it->second.expire <= now)
+    {
+        s.sessions.erase(it);
+        return false;
+    }
+    it->second.expire = now + m_ttl;
+    return true;
+}
+
+void session_store::remove(const char *token, size_t len)
+{
+    if (!token || len != TOKEN_LEN)
+        return;
+
+    std::string key(token, len);
+    shard &s = shard_of(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.sessions.erase(key);
+}
+
+void session_store::sweep()
+{
+    shard &s = m_shards[m_sweep_shard];
+    m_sweep_shard = (m_sweep_shard + 1) % SHARD_NUM;
+
+    time_t now = time(NULL);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (auto it = s.sessions.begin(); it != s.sessions.end();)
+    {
+        if (it->second.expire <= now)
+            it = s.sessions.erase(it);
+        else
+            ++it;
+    }
+}
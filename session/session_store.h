@@ -0,0 +1,59 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <time.h>
+
+// 登录会话表：登录成功后签发随机 token（通过 Set-Cookie 下发），后续请求凭 Cookie 校验，
+// 只需一次哈希查找，无需再访问 users 表或数据库。
+// 按 token 分片加锁，降低多个工作线程同时校验时的锁竞争；过期会话由定时器周期性清理。
+class session_store
+{
+public:
+    static const int SHARD_NUM = 16;        // 分片数
+    static const int TOKEN_BYTES = 16;      // token 随机字节数，十六进制编码后为 32 个字符
+    static const int TOKEN_LEN = TOKEN_BYTES * 2;
+
+    static session_store *get_instance()
+    {
+        static session_store instance;
+        return &instance;
+    }
+
+    void init(int ttl_seconds);
+    int get_ttl() const { return m_ttl; }
+
+    // 为用户创建会话，返回 token；取随机数失败时返回空串
+    std::string create(const std::string &user);
+    // 校验 token，有效时顺延过期时间（滑动过期）
+    bool validate(const char *token, size_t len);
+    void remove(const char *token, size_t len);
+    // 清理一个分片中的过期会话，由定时器每个时间片调用一次，轮流覆盖所有分片
+    void sweep();
+
+private:
+    session_store() : m_ttl(1800), m_sweep_shard(0) {}
+    ~session_store() {}
+
+    struct session
+    {
+        std::string user;   // 用户名
+        time_t expire;      // 过期时间
+    };
+
+    struct shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, session> sessions;
+    };
+
+    shard &shard_of(const std::string &token);
+
+    shard m_shards[SHARD_NUM];
+    int m_ttl;              // 会话有效期（秒）
+    int m_sweep_shard;      // 下一次清理的分片，只在主线程的定时处理中访问
+};
+
+#endif
@@ -0,0 +1,417 @@
+// SIGTERM 排空测试：启动服务器，在持续的长连接负载下发送 SIGTERM，检查
+// 1. 发送 SIGTERM 时正在进行的请求都完整送达：响应正在传输中（客户端读了开头后停下，服务器还有大半
+//    没有发出，SIGTERM 之后才接着读）、请求只发出一半（之后才发完，响应须以 Connection: close 结束），
+//    以及负载中的响应，按 Content-Length 核对，没有截断；服务器须等这些响应发完才退出；
+// 2. 监听套接字随即关闭，之后的新连接被拒绝，不会出现连接被接受后得不到服务；
+// 3. 服务器在 DRAIN_TIMEOUT 之内正常退出（退出码为 0）。
+// 空闲长连接在排空开始时被关闭，客户端恰好在此时发出的请求收不到任何字节（长连接固有的竞争，客户端可重试），
+// 单独计数，不算截断。传输中的响应使用测试临时生成的 root/drain_test.bin，结束时删除。
+// 所有客户端都来自 127.0.0.1，测试在服务器参数后追加 -f，用临时配置文件关闭单 IP 的请求速率限制。
+// 服务器依赖 MySQL，因此不注册为 ctest 测试，在项目根目录下运行：
+//     drain_test <port> <path> <server> [server args...]
+// 例如 ./build/drain_test 9006 /loginnew.gif ./server -p 9006
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int DRAIN_TIMEOUT = 30;        // 与 webserver.h 中的 DRAIN_TIMEOUT 相同
+static const int LOAD_CLIENTS = 16;         // 持续发请求的长连接客户端
+static const int SLOW_READERS = 4;          // 发送 SIGTERM 时响应正在传输中的客户端
+static const int PARTIAL_SENDERS = 4;       // 发送 SIGTERM 时请求只发出一半的客户端
+static const int PARTIAL_DELAY_US = 200000; // SIGTERM 之后多久发完请求的其余部分
+static const int SLOW_RCVBUF = 4096;        // 传输中的客户端的接收缓冲区
+static const int SLOW_STALL_US = 500000;    // 传输中的客户端在 SIGTERM 之后再停多久才接着读
+static const long SLOW_FILE_SIZE = 16L << 20; // 远大于两端套接字缓冲区之和，停下读取时服务器必然还有未发出的数据
+static const char SLOW_PATH[] = "/drain_test.bin"; // 服务器根目录 root/ 下的临时文件
+static const char CONF_FILE[] = "drain_test.conf";
+static const int LOAD_BEFORE_TERM_MS = 1000;
+
+static int g_port;
+static std::string g_path;
+static std::atomic<bool> g_stop(false);
+static std::atomic<bool> g_termed(false);
+static std::atomic<int> g_complete(0);
+static std::atomic<int> g_complete_after_term(0);
+static std::atomic<int> g_truncated(0);
+static std::atomic<int> g_dropped_idle(0);
+static std::atomic<int> g_refused(0);
+static std::atomic<int> g_inflight_ready(0);  // 已进入传输中状态的慢速读取和半个请求的客户端
+static std::atomic<int> g_slow_ok(0);
+static std::atomic<double> g_slow_resumed(0);  // 传输中的客户端接着读的时刻
+static std::atomic<int> g_partial_ok(0);
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//rcvbuf 大于 0 时在连接之前缩小接收缓冲区，让服务器的发送被客户端的读取速度卡住
+static int connect_server(int rcvbuf = 0)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval tv = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+enum RESULT
+{
+    RESULT_COMPLETE,
+    RESULT_NOTHING,     // 没有收到任何字节就被关闭
+    RESULT_TRUNCATED
+};
+
+//读一个响应：收齐响应头后按 Content-Length 读完响应体。started 不为空时，收到第一批数据后计数，
+//停下读取直到 SIGTERM 之后 SLOW_STALL_US 才接着读。status 返回状态码，close_after 返回响应是否要求关闭连接
+static RESULT read_response(int fd, std::atomic<int> *started, int *status, bool *close_after)
+{
+    std::string in;
+    size_t head_end = std::string::npos;
+    long content_length = -1;
+    size_t want = 0;
+    char buf[16384];
+    while (head_end == std::string::npos || in.size() < want)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return in.empty() ? RESULT_NOTHING : RESULT_TRUNCATED;
+        if (in.empty() && started)
+        {
+            started->fetch_add(1);
+            while (!g_termed)
+                usleep(1000);
+            usleep(SLOW_STALL_US);
+            g_slow_resumed = now_s();
+        }
+        in.append(buf, n);
+        if (head_end == std::string::npos && (head_end = in.find("\r\n\r\n")) != std::string::npos)
+        {
+            const char *cl = strcasestr(in.c_str(), "\r\nContent-Length:");
+            if (!cl || head_end < (size_t)(cl - in.c_str()))
+                return RESULT_TRUNCATED;
+            content_length = atol(cl + 17);
+            *status = in.size() > 12 ? atoi(in.c_str() + 9) : 0;
+            want = head_end + 4 + content_length;
+            *close_after = strcasestr(in.substr(0, head_end).c_str(), "\r\nConnection:close") != NULL ||
+                           strcasestr(in.substr(0, head_end).c_str(), "\r\nConnection: close") != NULL;
+        }
+    }
+    return in.size() == want ? RESULT_COMPLETE : RESULT_TRUNCATED;
+}
+
+static bool send_all(int fd, const std::string &data)
+{
+    return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size();
+}
+
+static bool send_request(int fd, const std::string &path, bool keep_alive)
+{
+    return send_all(fd, "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: " +
+                            (keep_alive ? "keep-alive" : "close") + "\r\n\r\n");
+}
+
+//长连接客户端：每条连接连续发请求，直到服务器要求关闭；连接被拒绝后稍后重试，直到服务器退出
+static void load_client()
+{
+    while (!g_stop)
+    {
+        int fd = connect_server();
+        if (fd < 0)
+        {
+            if (g_termed)
+                g_refused++;
+            usleep(10000);
+            continue;
+        }
+        bool close_after = false;
+        int status;
+        while (!g_stop && !close_after)
+        {
+            if (!send_request(fd, g_path, true))
+            {
+                g_dropped_idle++;
+                break;
+            }
+            bool termed = g_termed;
+            RESULT r = read_response(fd, NULL, &status, &close_after);
+            if (r == RESULT_COMPLETE)
+            {
+                g_complete++;
+                if (termed)
+                    g_complete_after_term++;
+                continue;
+            }
+            if (r == RESULT_NOTHING)
+                g_dropped_idle++;
+            else
+            {
+                g_truncated++;
+                printf("FAIL: keep-alive response truncated\n");
+            }
+            break;
+        }
+        close(fd);
+    }
+}
+
+//传输中的响应：在发送 SIGTERM 之前开始传输，客户端读了开头后停下，之后才读完
+static void slow_reader()
+{
+    int fd = connect_server(SLOW_RCVBUF);
+    bool close_after = false;
+    int status = 0;
+    if (fd < 0 || !send_request(fd, SLOW_PATH, false))
+    {
+        g_inflight_ready++;
+        printf("FAIL: slow reader could not send its request\n");
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    RESULT r = read_response(fd, &g_inflight_ready, &status, &close_after);
+    if (r == RESULT_COMPLETE && status == 200)
+        g_slow_ok++;
+    else if (r == RESULT_COMPLETE)
+        printf("FAIL: in-flight request was answered with %d\n", status);
+    else
+        printf("FAIL: in-flight response %s\n", r == RESULT_NOTHING ? "got no bytes" : "truncated");
+    close(fd);
+}
+
+//半个请求：请求行和部分请求头在 SIGTERM 之前发出，其余在之后发出；排空不关闭这样的连接，
+//响应须完整且以 Connection: close 结束
+static void partial_sender()
+{
+    int fd = connect_server();
+    bool ok = fd >= 0 && send_all(fd, "GET " + g_path + " HTTP/1.1\r\nHost: localhost\r\n");
+    g_inflight_ready++;
+    while (ok && !g_termed)
+        usleep(1000);
+    usleep(PARTIAL_DELAY_US);
+    bool close_after = false;
+    int status = 0;
+    RESULT r = RESULT_NOTHING;
+    if (ok && send_all(fd, "Connection: keep-alive\r\n\r\n"))
+        r = read_response(fd, NULL, &status, &close_after);
+    if (r == RESULT_COMPLETE && status == 200 && close_after)
+        g_partial_ok++;
+    else if (r == RESULT_COMPLETE)
+        printf("FAIL: half-sent request was answered with %d%s\n", status,
+               close_after ? "" : ", without Connection: close");
+    else
+        printf("FAIL: half-sent request %s\n", r == RESULT_NOTHING ? "got no response" : "got a truncated response");
+    if (fd >= 0)
+        close(fd);
+}
+
+//生成传输中的响应使用的文件和关闭速率限制的配置文件
+static bool make_files(const std::string &file)
+{
+    FILE *conf = fopen(CONF_FILE, "w");
+    if (!conf)
+        return false;
+    bool written = fputs("[limit]\nip_rate = 0\n", conf) >= 0;
+    if (fclose(conf) != 0 || !written)
+        return false;
+
+    FILE *fp = fopen(file.c_str(), "w");
+    if (!fp)
+        return false;
+    std::string block(1 << 20, 'x');
+    bool ok = true;
+    for (long n = 0; ok && n < SLOW_FILE_SIZE; n += block.size())
+        ok = fwrite(block.data(), 1, block.size(), fp) == block.size();
+    return fclose(fp) == 0 && ok;
+}
+
+static pid_t start_server(char *args[])
+{
+    std::vector<char *> argv;
+    for (; *args; ++args)
+        argv.push_back(*args);
+    argv.push_back((char *)"-f");
+    argv.push_back((char *)CONF_FILE);
+    argv.push_back(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        //服务器每关闭一个连接都打印一行，丢弃标准输出
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+            dup2(null_fd, STDOUT_FILENO);
+        execv(argv[0], argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s <port> <path> <server> [server args...]\n", argv[0]);
+        return 2;
+    }
+    g_port = atoi(argv[1]);
+    g_path = argv[2];
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string slow_file = std::string("root") + SLOW_PATH;
+    if (!make_files(slow_file))
+    {
+        perror("create test files");
+        unlink(CONF_FILE);
+        return 1;
+    }
+    pid_t pid = start_server(argv + 3);
+    if (pid < 0)
+    {
+        perror("fork");
+        unlink(slow_file.c_str());
+        unlink(CONF_FILE);
+        return 1;
+    }
+    int fd = -1;
+    for (int i = 0; i < 100 && (fd = connect_server()) < 0; ++i)
+        usleep(50000);
+    if (fd < 0)
+    {
+        printf("FAIL: server did not start listening on port %d\n", g_port);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        unlink(slow_file.c_str());
+        unlink(CONF_FILE);
+        return 1;
+    }
+    close(fd);
+
+    int failed = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < LOAD_CLIENTS; ++i)
+        threads.emplace_back(load_client);
+    usleep(LOAD_BEFORE_TERM_MS * 1000);
+    for (int i = 0; i < SLOW_READERS; ++i)
+        threads.emplace_back(slow_reader);
+    for (int i = 0; i < PARTIAL_SENDERS; ++i)
+        threads.emplace_back(partial_sender);
+    while (g_inflight_ready < SLOW_READERS + PARTIAL_SENDERS)
+        usleep(1000);
+    //让半个请求先到达服务器
+    usleep(50000);
+    int before = g_complete;
+
+    kill(pid, SIGTERM);
+    g_termed = true;
+    double term_at = now_s();
+
+    //监听套接字在收到 SIGTERM 的那一轮事件处理完后关闭：先等到连接被拒绝，此后不能再有连接被接受
+    double refused_at = 0;
+    int accepted_late = 0;
+    int status = 0;
+    bool exited = false;
+    while (now_s() - term_at < DRAIN_TIMEOUT + 5)
+    {
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            exited = true;
+            break;
+        }
+        int probe = connect_server();
+        if (probe < 0 && !refused_at)
+            refused_at = now_s();
+        else if (probe >= 0 && refused_at)
+            ++accepted_late;
+        if (probe >= 0)
+            close(probe);
+        usleep(20000);
+    }
+    double exit_after = now_s() - term_at;
+    g_stop = true;
+    if (!exited)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    for (std::thread &t : threads)
+        t.join();
+    unlink(slow_file.c_str());
+    unlink(CONF_FILE);
+
+    printf("responses: %d before SIGTERM, %d completed after, %d truncated, %d dropped while idle\n", before,
+           g_complete_after_term.load(), g_truncated.load(), g_dropped_idle.load());
+    printf("in flight at SIGTERM: %d of %d stalled responses, %d of %d half-sent requests complete\n", g_slow_ok.load(),
+           SLOW_READERS, g_partial_ok.load(), PARTIAL_SENDERS);
+    printf("new connections refused %.2fs after SIGTERM, %d refused connects from clients\n",
+           refused_at ? refused_at - term_at : -1.0, g_refused.load());
+    printf("server %s %.2fs after SIGTERM\n", exited ? "exited" : "killed", exit_after);
+
+    if (before == 0)
+    {
+        printf("FAIL: no responses before SIGTERM, the load did not reach the server\n");
+        ++failed;
+    }
+    if (g_truncated > 0)
+        ++failed;
+    if (g_slow_ok != SLOW_READERS || g_partial_ok != PARTIAL_SENDERS)
+        ++failed;
+    //传输中的客户端停下时服务器还有未发出的数据，服务器须等到客户端接着读、数据发完才退出
+    if (exited && g_slow_resumed && term_at + exit_after < g_slow_resumed)
+    {
+        printf("FAIL: server exited before the in-flight responses were sent\n");
+        ++failed;
+    }
+    if (!refused_at)
+    {
+        printf("FAIL: new connections were still accepted while draining\n");
+        ++failed;
+    }
+    if (accepted_late)
+    {
+        printf("FAIL: %d connections accepted after the listener was closed\n", accepted_late);
+        ++failed;
+    }
+    if (!exited || exit_after > DRAIN_TIMEOUT)
+    {
+        printf("FAIL: server did not exit within DRAIN_TIMEOUT (%ds)\n", DRAIN_TIMEOUT);
+        ++failed;
+    }
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("FAIL: server exited abnormally (status %d)\n", status);
+        ++failed;
+    }
+    printf("%s\n", failed ? "FAILED" : "ALL OK");
+    return failed ? 1 : 0;
+}
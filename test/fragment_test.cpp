@@ -0,0 +1,173 @@
+// 分段到达的请求解析测试：每条请求先整体发送一次得到参照响应，再在每个字节位置把请求切成两段、
+// 以及逐字节分开发送，分段之间稍作停顿让各段分别到达服务器，检查响应与参照完全一致（Date 头除外）。
+// 需要一个正在运行的服务器（它依赖 MySQL，因此不注册为 ctest 测试）：
+//     fragment_test <port> [host]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+struct test_case
+{
+    const char *name;
+    const char *request;
+};
+
+static const test_case CASES[] = {
+    {"pipelined-get",
+     "GET /0 HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+     "GET /1 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"},
+    {"browser-headers",
+     "GET /judge.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+     "Accept: text/html,application/xhtml+xml,*/*;q=0.8\r\nAccept-Language: zh-CN,zh;q=0.9\r\n"
+     "Accept-Encoding: gzip\r\nConnection: close\r\n\r\n"},
+    {"content-length-body",
+     "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 23\r\nConnection: close\r\n\r\n"
+     "user=alice&password=abc"},
+    {"chunked-body",
+     "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"
+     "5;ext=1\r\nuser=\r\n12\r\nalice&password=abc\r\n0\r\nX-Trailer: 1\r\n\r\n"},
+    {"bad-request-line",
+     "GARBAGE\r\nHost: localhost\r\n\r\n"},
+};
+
+static const int PAUSE_US = 3000;   // 分段之间的停顿，足以让前一段单独触发一次读事件
+
+static int connect_to(const char *host, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static bool send_all(int fd, const char *p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+//按 cuts 中的位置分段发送，读到服务器关闭连接为止；去掉每次都不同的 Date 头
+static bool exchange(const char *host, int port, const std::string &req, const std::vector<size_t> &cuts,
+                     std::string &out)
+{
+    int fd = connect_to(host, port);
+    if (fd < 0)
+        return false;
+    //服务器对有误的请求回复 400 后即关闭连接，之后的发送会失败，已收到的响应仍然照常比较
+    size_t from = 0;
+    bool sent = true;
+    for (size_t cut : cuts)
+    {
+        if (!send_all(fd, req.data() + from, cut - from))
+        {
+            sent = false;
+            break;
+        }
+        from = cut;
+        usleep(PAUSE_US);
+    }
+    if (sent)
+        send_all(fd, req.data() + from, req.size() - from);
+    out.clear();
+    char buf[16384];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+        out.append(buf, n);
+    close(fd);
+    if (n < 0 && out.empty())
+        return false;
+
+    std::string filtered;
+    size_t pos = 0;
+    while (pos < out.size())
+    {
+        size_t eol = out.find("\r\n", pos);
+        size_t next = eol == std::string::npos ? out.size() : eol + 2;
+        if (strncasecmp(out.c_str() + pos, "Date:", 5) != 0)
+            filtered.append(out, pos, next - pos);
+        pos = next;
+    }
+    out.swap(filtered);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <port> [host]\n", argv[0]);
+        return 2;
+    }
+    int port = atoi(argv[1]);
+    const char *host = argc > 2 ? argv[2] : "127.0.0.1";
+
+    int failed = 0;
+    for (const test_case &c : CASES)
+    {
+        std::string req(c.request);
+        std::string expect, got;
+        if (!exchange(host, port, req, {}, expect) || expect.empty())
+        {
+            printf("FAIL %s: no response to the unsplit request\n", c.name);
+            ++failed;
+            continue;
+        }
+
+        //每个字节位置切成两段，以及逐字节发送
+        std::vector<std::vector<size_t>> splits;
+        for (size_t i = 1; i < req.size(); ++i)
+            splits.push_back({i});
+        std::vector<size_t> every;
+        for (size_t i = 1; i < req.size(); ++i)
+            every.push_back(i);
+        splits.push_back(every);
+
+        int bad = 0;
+        for (const std::vector<size_t> &cuts : splits)
+        {
+            if (exchange(host, port, req, cuts, got) && got == expect)
+                continue;
+            if (bad++ == 0)
+                printf("FAIL %s: split at %s%zu differs\n--- expected\n%s\n--- got\n%s\n", c.name,
+                       cuts.size() > 1 ? "every byte, first " : "", cuts[0], expect.c_str(), got.c_str());
+        }
+        size_t status_end = expect.find("\r\n");
+        if (bad)
+        {
+            printf("FAIL %s: %d of %zu splits differ\n", c.name, bad, splits.size());
+            ++failed;
+        }
+        else
+            printf("PASS %s: %zu splits, %s\n", c.name, splits.size(), expect.substr(0, status_end).c_str());
+    }
+    return failed ? 1 : 0;
+}
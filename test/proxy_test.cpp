@@ -0,0 +1,368 @@
+// 反向代理的回环测试：在 127.0.0.1 上启动两个替身上游，测试线程充当事件循环驱动 coro_loop，
+// 与服务器一样先 co_await schedule() 转到事件循环上，再调用 relay_exchange/relay_read_body 和 upstream_pool。
+// 检查请求原样转发、响应体（定长和分块）读取、长连接复用、最少连接数选择，以及上游连不上、响应无效、
+// 响应体被截断时的失败路径。不依赖数据库和正在运行的服务器，由 ctest 运行。
+
+#include "../proxy/relay.h"
+#include "../proxy/upstream.h"
+#include "../coro/coro_loop.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...)                 \
+    do                                   \
+    {                                    \
+        if (!(cond))                     \
+        {                                \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n");                \
+            g_failed++;                  \
+        }                                \
+    } while (0)
+
+static std::atomic<bool> g_stop(false);
+
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ||
+        getsockname(fd, (sockaddr *)&addr, &len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+//替身上游：单线程 poll，支持长连接。按路径回复：
+// /echo    200，响应体为收到的请求头和请求体
+// /chunked 200，分块编码的 "helloworld"
+// /bad     不是 HTTP 的响应，随后关闭
+// /trunc   Content-Length 为 100，只发 3 字节后关闭
+class stand_in
+{
+public:
+    explicit stand_in(const char *name) : m_name(name), m_port(0), m_accepted(0)
+    {
+        m_listenfd = listen_loopback(&m_port);
+        if (m_listenfd >= 0)
+            m_thread = std::thread([this]() { run(); });
+    }
+    ~stand_in()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+        if (m_listenfd >= 0)
+            close(m_listenfd);
+    }
+    bool ok() const { return m_listenfd >= 0; }
+    std::string addr() const { return "127.0.0.1:" + std::to_string(m_port); }
+    int accepted() const { return m_accepted.load(); }
+
+private:
+    struct client
+    {
+        int fd;
+        std::string in;
+    };
+
+    void run()
+    {
+        std::vector<client> clients;
+        while (!g_stop)
+        {
+            std::vector<pollfd> fds(1 + clients.size());
+            fds[0].fd = m_listenfd;
+            fds[0].events = POLLIN;
+            for (size_t i = 0; i < clients.size(); ++i)
+            {
+                fds[i + 1].fd = clients[i].fd;
+                fds[i + 1].events = POLLIN;
+            }
+            if (poll(fds.data(), fds.size(), 50) <= 0)
+                continue;
+            for (size_t i = clients.size(); i > 0; --i)
+            {
+                if (fds[i].revents && !serve(clients[i - 1]))
+                {
+                    close(clients[i - 1].fd);
+                    clients.erase(clients.begin() + (i - 1));
+                }
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = accept(m_listenfd, NULL, NULL);
+                if (fd >= 0)
+                {
+                    m_accepted++;
+                    clients.push_back(client{fd, std::string()});
+                }
+            }
+        }
+        for (client &c : clients)
+            close(c.fd);
+    }
+
+    //读入数据并回复其中完整的请求，连接应关闭时返回 false
+    bool serve(client &c)
+    {
+        char buf[4096];
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return false;
+        c.in.append(buf, n);
+        while (true)
+        {
+            size_t head_end = c.in.find("\r\n\r\n");
+            if (head_end == std::string::npos)
+                return true;
+            head_end += 4;
+            size_t body_len = 0;
+            const char *cl = strcasestr(c.in.c_str(), "\r\ncontent-length:");
+            if (cl && (size_t)(cl - c.in.c_str()) < head_end)
+                body_len = strtoul(cl + 17, NULL, 10);
+            if (c.in.size() < head_end + body_len)
+                return true;
+            std::string request = c.in.substr(0, head_end + body_len);
+            c.in.erase(0, head_end + body_len);
+            if (!respond(c.fd, request))
+                return false;
+        }
+    }
+
+    bool respond(int fd, const std::string &request)
+    {
+        std::string path = request.substr(0, request.find("\r\n"));
+        std::string out;
+        bool keep = true;
+        if (path.find(" /echo") != std::string::npos)
+            out = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(request.size()) + "\r\nX-Upstream: " + m_name +
+                  "\r\n\r\n" + request;
+        else if (path.find(" /chunked") != std::string::npos)
+            out = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nX-Upstream: " + m_name +
+                  "\r\n\r\n5\r\nhello\r\n5;ext=1\r\nworld\r\n0\r\n\r\n";
+        else if (path.find(" /bad") != std::string::npos)
+        {
+            out = "garbage\r\n\r\n";
+            keep = false;
+        }
+        else
+        {
+            out = "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nabc";
+            keep = false;
+        }
+        return send(fd, out.data(), out.size(), MSG_NOSIGNAL) == (ssize_t)out.size() && keep;
+    }
+
+    std::string m_name;
+    int m_listenfd;
+    int m_port;
+    std::atomic<int> m_accepted;
+    std::thread m_thread;
+};
+
+//事件循环：与 WebServer::eventLoop 一样把就绪的描述符交给 coro_loop，并按最近的截止时刻唤醒
+static void run_loop(std::atomic<bool> *ready)
+{
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    coro_loop *loop = coro_loop::get_instance();
+    bool inited = epollfd >= 0 && loop->init(epollfd, 64);
+    *ready = true;
+    if (!inited)
+        return;
+    epoll_event events[64];
+    while (!g_stop)
+    {
+        int wait = loop->timeout();
+        if (wait < 0 || wait > 50)
+            wait = 50;
+        int n = epoll_wait(epollfd, events, 64, wait);
+        for (int i = 0; i < n; ++i)
+            loop->dispatch(events[i].data.fd);
+        loop->expire();
+    }
+}
+
+//一次完整的代理请求，与 http_conn::proxy_async 一样在事件循环上执行，读完的长连接放回空闲列表
+static coro_task<RELAY_RESULT> fetch(upstream_pool *pool, std::string head, std::string body, upstream_conn &conn,
+                                     upstream_response &resp, std::string &out)
+{
+    co_await coro_loop::get_instance()->schedule();
+    std::string in;
+    RELAY_RESULT result = co_await relay_exchange(pool, head, body, body.empty(), conn, resp, in);
+    if (result != RELAY_OK)
+        co_return result;
+    result = co_await relay_read_body(conn, resp, in, 1 << 20, out);
+    pool->release(conn, result == RELAY_OK && resp.keep_alive);
+    co_return result;
+}
+
+static coro_task<bool> acquire(upstream_pool *pool, upstream_conn &conn)
+{
+    co_await coro_loop::get_instance()->schedule();
+    co_return co_await pool->acquire(conn);
+}
+
+static std::string get(const char *path)
+{
+    return std::string("GET ") + path + " HTTP/1.1\r\nHost: proxy-test\r\nX-Probe: 42\r\n\r\n";
+}
+
+static bool from(const upstream_response &resp, const char *name)
+{
+    return resp.headers.find(std::string("X-Upstream: ") + name + "\r\n") != std::string::npos;
+}
+
+//一个必然连不上的回环端口
+static std::string dead_addr()
+{
+    int port = 0;
+    int fd = listen_loopback(&port);
+    if (fd >= 0)
+        close(fd);
+    return "127.0.0.1:" + std::to_string(port);
+}
+
+int main()
+{
+    std::atomic<bool> ready(false);
+    std::thread loop_thread(run_loop, &ready);
+    while (!ready)
+        std::this_thread::yield();
+
+    stand_in a("A"), b("B");
+    CHECK(a.ok() && b.ok(), "listen on loopback");
+
+    //转发：请求头和请求体原样到达上游，响应头、定长和分块的响应体完整取回
+    {
+        upstream_pool pool("/t");
+        pool.add_server(a.addr());
+        upstream_conn conn;
+        upstream_response resp;
+        std::string out;
+        RELAY_RESULT r = fetch(&pool, get("/echo/1"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_OK && resp.status == 200, "forward GET: result %d status %d", r, resp.status);
+        CHECK(out == get("/echo/1"), "forward GET: upstream saw '%s'", out.c_str());
+        CHECK(from(resp, "A"), "forward GET: response headers '%s'", resp.headers.c_str());
+
+        std::string head = "POST /echo/2 HTTP/1.1\r\nHost: proxy-test\r\nContent-Length: 5\r\n\r\n";
+        r = fetch(&pool, head, "hello", conn, resp, out).sync();
+        CHECK(r == RELAY_OK && out == head + "hello", "forward POST: result %d, upstream saw '%s'", r, out.c_str());
+
+        r = fetch(&pool, get("/chunked"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_OK && out == "helloworld", "chunked body: result %d, body '%s'", r, out.c_str());
+        printf("forwarding: %s\n", g_failed ? "failed" : "ok");
+    }
+
+    //长连接复用：读完的连接放回空闲列表，之后的请求不再新建连接
+    {
+        int before = a.accepted();
+        int failed = g_failed;
+        upstream_pool pool("/t");
+        pool.add_server(a.addr());
+        for (int i = 0; i < 4; ++i)
+        {
+            upstream_conn conn;
+            upstream_response resp;
+            std::string out;
+            RELAY_RESULT r = fetch(&pool, get("/echo/keep"), std::string(), conn, resp, out).sync();
+            CHECK(r == RELAY_OK && resp.keep_alive, "keep-alive #%d: result %d", i + 1, r);
+            CHECK(conn.reused == (i > 0), "keep-alive #%d: connection %sreused", i + 1, conn.reused ? "" : "not ");
+        }
+        CHECK(a.accepted() - before == 1, "keep-alive: upstream accepted %d connections, expected 1",
+              a.accepted() - before);
+        printf("keep-alive reuse: %s\n", g_failed > failed ? "failed" : "ok");
+    }
+
+    //最少连接数：一条连接借出未还时，之后的连接都选另一个上游
+    {
+        int failed = g_failed;
+        upstream_pool pool("/t");
+        pool.add_server(a.addr());
+        pool.add_server(b.addr());
+        upstream_conn held;
+        bool ok = acquire(&pool, held).sync();
+        CHECK(ok && held.server, "least-connections: acquire first connection");
+        for (int i = 0; ok && i < 4; ++i)
+        {
+            upstream_conn conn;
+            bool got = acquire(&pool, conn).sync();
+            CHECK(got && conn.server && conn.server != held.server, "least-connections #%d: picked %s while %s is busy",
+                  i + 1, conn.server ? conn.server->name.c_str() : "none", held.server->name.c_str());
+            if (got)
+                pool.release(conn, false);
+        }
+        //两个上游各借出一条时，接下来的两条分别落在两个上游上
+        upstream_conn second;
+        if (ok && acquire(&pool, second).sync())
+        {
+            upstream_conn c1, c2;
+            bool got1 = acquire(&pool, c1).sync();
+            bool got2 = acquire(&pool, c2).sync();
+            CHECK(got1 && got2 && c1.server != c2.server, "least-connections: two more connections landed on the same upstream");
+            pool.release(c1, false);
+            pool.release(c2, false);
+            pool.release(second, false);
+        }
+        pool.release(held, false);
+        printf("least-connections: %s\n", g_failed > failed ? "failed" : "ok");
+    }
+
+    //失败路径：连不上的上游回复 502，并在暂停期内改选其它上游；响应无效、响应体被截断同样是 502
+    {
+        int failed = g_failed;
+        upstream_pool down("/t");
+        down.add_server(dead_addr());
+        upstream_conn conn;
+        upstream_response resp;
+        std::string out;
+        RELAY_RESULT r = fetch(&down, get("/echo/3"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_BAD_GATEWAY, "unreachable upstream: result %d, expected bad gateway", r);
+        CHECK(conn.fd < 0, "unreachable upstream: connection returned");
+
+        upstream_pool mixed("/t");
+        mixed.add_server(dead_addr());
+        mixed.add_server(b.addr());
+        for (int i = 0; i < 4; ++i)
+        {
+            r = fetch(&mixed, get("/echo/4"), std::string(), conn, resp, out).sync();
+            CHECK(r == RELAY_OK && from(resp, "B"), "failover #%d: result %d", i + 1, r);
+        }
+
+        upstream_pool pool("/t");
+        pool.add_server(a.addr());
+        r = fetch(&pool, get("/bad"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_BAD_GATEWAY, "invalid response: result %d, expected bad gateway", r);
+        r = fetch(&pool, get("/trunc"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_BAD_GATEWAY, "truncated body: result %d, expected bad gateway", r);
+        r = fetch(&pool, get("/echo/5"), std::string(), conn, resp, out).sync();
+        CHECK(r == RELAY_OK, "request after failures: result %d", r);
+        printf("upstream failure: %s\n", g_failed > failed ? "failed" : "ok");
+    }
+
+    g_stop = true;
+    loop_thread.join();
+    printf("%s\n", g_failed ? "FAILED" : "ALL OK");
+    return g_failed ? 1 : 0;
+}
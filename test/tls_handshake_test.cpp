@@ -0,0 +1,210 @@
+// TLS 终结的回环测试：生成自签名证书交给 tls_context，在 127.0.0.1 上用 OpenSSL 客户端连接两次。
+// 检查握手、ALPN 协商出 h2、双向收发数据，第二次连接复用第一次的会话；
+// kTLS 发送侧生效时服务端直接 send() 明文，由内核加密，客户端照常解密。
+// 不依赖数据库和正在运行的服务器，由 ctest 运行。
+
+#include "../tls/tls_context.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <string>
+#include <thread>
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...)                 \
+    do                                   \
+    {                                    \
+        if (!(cond))                     \
+        {                                \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n");                \
+            ERR_print_errors_fp(stdout); \
+            g_failed++;                  \
+        }                                \
+    } while (0)
+
+//P-256 密钥和 CN=localhost 的自签名证书，写成 PEM 文件
+static bool make_cert(const std::string &cert_file, const std::string &key_file)
+{
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    if (!pkey || !cert)
+        return false;
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    bool ok = X509_sign(cert, pkey, EVP_sha256()) > 0;
+
+    FILE *fp = fopen(cert_file.c_str(), "w");
+    ok = ok && fp && PEM_write_X509(fp, cert);
+    if (fp)
+        fclose(fp);
+    fp = fopen(key_file.c_str(), "w");
+    ok = ok && fp && PEM_write_PrivateKey(fp, pkey, NULL, NULL, 0, NULL, NULL);
+    if (fp)
+        fclose(fp);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return ok;
+}
+
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0 ||
+        getsockname(fd, (sockaddr *)&addr, &len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+//客户端：校验证书（以自签名证书本身为 CA）并提供 ALPN，发出 ping、读回 pong，返回读 pong 之后的会话
+//（TLS 1.3 的票据在握手之后才到达，读过数据后才能取到可复用的会话）
+static SSL_SESSION *run_client(SSL_CTX *ctx, int port, SSL_SESSION *resume, bool *reused, std::string *alpn)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, "localhost");
+    SSL_set1_host(ssl, "localhost");
+    if (resume)
+        SSL_set_session(ssl, resume);
+
+    SSL_SESSION *session = NULL;
+    char buf[16];
+    if (SSL_connect(ssl) == 1 && SSL_write(ssl, "ping", 4) == 4 && SSL_read(ssl, buf, sizeof(buf)) == 4 &&
+        memcmp(buf, "pong", 4) == 0)
+    {
+        *reused = SSL_session_reused(ssl);
+        const unsigned char *proto;
+        unsigned int proto_len;
+        SSL_get0_alpn_selected(ssl, &proto, &proto_len);
+        alpn->assign((const char *)proto, proto_len);
+        session = SSL_get1_session(ssl);
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(fd);
+    return session;
+}
+
+//服务端：与 http_conn 相同，SSL 对象由 tls_context 创建，握手完成后调用 on_handshake
+static bool serve_once(int listenfd, bool *ktls)
+{
+    int fd = accept(listenfd, NULL, NULL);
+    if (fd < 0)
+        return false;
+    SSL *ssl = tls_context::get_instance()->create(fd);
+    bool ok = ssl && SSL_do_handshake(ssl) == 1;
+    if (ok)
+    {
+        *ktls = tls_context::get_instance()->on_handshake(ssl);
+        char buf[16];
+        ok = SSL_read(ssl, buf, sizeof(buf)) == 4 && memcmp(buf, "ping", 4) == 0;
+        //kTLS 发送侧生效时与 http_conn 一样直接写 socket
+        if (ok)
+            ok = *ktls ? send(fd, "pong", 4, 0) == 4 : SSL_write(ssl, "pong", 4) == 4;
+        //等客户端读完并关闭，避免先关闭导致客户端收到 RST
+        if (ok)
+            SSL_read(ssl, buf, sizeof(buf));
+    }
+    if (ssl)
+        SSL_free(ssl);
+    close(fd);
+    return ok;
+}
+
+int main()
+{
+    char dir[] = "/tmp/tls_handshake_test.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string cert_file = std::string(dir) + "/server.crt";
+    std::string key_file = std::string(dir) + "/server.key";
+    bool made = make_cert(cert_file, key_file);
+    CHECK(made, "generate self-signed certificate");
+
+    std::string err;
+    bool inited = made && tls_context::get_instance()->init(cert_file.c_str(), key_file.c_str(), err);
+    CHECK(inited, "tls_context::init: %s", err.c_str());
+
+    int port = 0;
+    int listenfd = listen_loopback(&port);
+    CHECK(listenfd >= 0, "listen on loopback");
+
+    SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_load_verify_locations(client_ctx, cert_file.c_str(), NULL);
+    SSL_CTX_set_alpn_protos(client_ctx, (const unsigned char *)"\x02h2\x08http/1.1", 12);
+    SSL_CTX_set_session_cache_mode(client_ctx, SSL_SESS_CACHE_CLIENT);
+
+    SSL_SESSION *session = NULL;
+    for (int round = 0; inited && listenfd >= 0 && round < 2; ++round)
+    {
+        bool served = false, ktls = false, reused = false;
+        std::string alpn;
+        std::thread server([&]() { served = serve_once(listenfd, &ktls); });
+        SSL_SESSION *next = run_client(client_ctx, port, session, &reused, &alpn);
+        server.join();
+
+        CHECK(served && next, "round %d: handshake and ping/pong", round + 1);
+        CHECK(alpn == "h2", "round %d: ALPN selected '%s', expected h2", round + 1, alpn.c_str());
+        CHECK(reused == (round == 1), "round %d: session %sreused", round + 1, reused ? "" : "not ");
+        printf("round %d: %s, alpn %s, %s, kTLS send %s\n", round + 1, served && next ? "ok" : "failed",
+               alpn.c_str(), reused ? "resumed" : "full handshake", ktls ? "on" : "off (SSL_write)");
+        if (session)
+            SSL_SESSION_free(session);
+        session = next;
+    }
+    if (session)
+        SSL_SESSION_free(session);
+
+    tls_context *tls = tls_context::get_instance();
+    CHECK(tls->handshakes() == 2, "handshakes %lu, expected 2", tls->handshakes());
+    CHECK(tls->resumed() == 1, "resumed %lu, expected 1", tls->resumed());
+
+    SSL_CTX_free(client_ctx);
+    if (listenfd >= 0)
+        close(listenfd);
+    unlink(cert_file.c_str());
+    unlink(key_file.c_str());
+    rmdir(dir);
+    printf("%s\n", g_failed ? "FAILED" : "ALL OK");
+    return g_failed ? 1 : 0;
+}
@@ -5,48 +5,114 @@
 #include <deque>
 #include <vector>
 #include <thread>
+#include <algorithm>
 #include <condition_variable>
 #include <exception>
-#include "../sqlConnectionPool/sqlConnectionPool.h"
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include "../affinity/cpu_affinity.h"
 
+// 优先级车道：任务入队时由 T::lane() 分类，每个车道一个队列。车道 0 放开销小的请求（静态文件），
+// 车道 1 放可能长时间占用工作线程的请求（同步等待上游、登录注册）。
+// 空闲的工作线程在有任务且未达并发上限的车道之间按 LANE_WEIGHT 加权轮询；每个车道的并发上限为
+// 线程数减去其它车道的预留数，慢请求再多也占不满全部线程，静态请求的尾延迟不受其影响。
+// 工作线程不从数据库连接池取连接，登录注册的数据库访问在 verify_pool 中进行。
+//
+// 过载控制（CoDel）：工作线程取出任务时计算其排队时间，某个车道的排队时间持续 CODEL_INTERVAL_MS 以上
+// 都超过 CODEL_TARGET_MS 时判定该车道过载，此后从中取出的读任务不再处理而是调用 shed() 直接回复 503，
+// 直到该车道某个任务的排队时间回落到目标以下。偶发的突发不会触发丢弃，持续的积压则尽快失败，排队时间保持有界
+//
+// 弹性线程数：max_threads 大于 thread_number 时，队列中最早的任务等待达到 SCALE_UP_DELAY_MS 就新建一个线程，
+// 应对工作线程阻塞在上游上的突发；线程数达到上限后才按过载控制丢弃请求。
+// 多出最小线程数的线程空闲 IDLE_RETIRE_SECONDS 后退出
 template <typename T>
 class threadpool {
 public:
-    threadpool(int actor_model, connection_pool* connPool, int thread_number = 16, int max_request = 10000);
+    static constexpr int LANES = 2;
+    static constexpr int LANE_WEIGHT[LANES] = {4, 1};           // 各车道都有积压时的取任务比例
+    static constexpr int LANE_RESERVE_PERCENT[LANES] = {25, 25}; // 各车道预留的线程比例（至少 1 个）
+    static constexpr int CODEL_TARGET_MS = 10;      // 可接受的排队时间
+    static constexpr int CODEL_INTERVAL_MS = 100;   // 排队时间持续超标多久判定为过载
+    static constexpr int SCALE_UP_DELAY_MS = CODEL_TARGET_MS / 2;   // 排队时间达到该值时扩容
+    static constexpr int IDLE_RETIRE_SECONDS = 30;  // 多余线程空闲多久后退出
+
+    // max_threads 不大于 thread_number 时线程数固定为 thread_number
+    threadpool(int actor_model, int thread_number = 16, int max_request = 10000, int max_threads = 0);
     ~threadpool();
     bool append(T* request, int state);
     bool append_p(T* request);
     void stop(); // 停止线程池
+    void pin_threads(); // 把工作线程依次绑定到 cpu_affinity 规划的 CPU，之后新建的线程同样绑定
+    void metrics(std::string &text);
 
 private:
-    void run();
+    typedef std::chrono::steady_clock clock;
+
+    // 队列中的任务，记录入队时刻
+    struct task {
+        T* request;
+        clock::time_point enqueued;
+    };
+
+    void run(int slot);
+    void spawn(int slot);
+    void grow(clock::time_point now, clock::time_point oldest);
+    void set_limits();
+    void handle(T* request, bool shed);
+    bool push(T* request);
+    int pick();
+    bool overloaded(int lane, clock::time_point now, clock::time_point enqueued);
 
 private:
-    int m_thread_number;                    // 线程池中的线程数
+    int m_thread_number;                    // 线程池中的最小线程数
+    int m_max_threads;                      // 线程池中的最大线程数
     int m_max_requests;                     // 请求队列中允许的最大请求数
-    std::vector<std::thread> m_threads;     // 线程池
-    std::deque<T*> m_workqueue;              // 请求队列
+    std::vector<std::thread> m_threads;     // 线程池，共 m_max_threads 个位置，退出的线程在位置复用时回收
+    std::vector<char> m_running;            // 各位置的线程是否在运行
+    int m_live;                             // 运行中的线程数
+    bool m_pinned;                          // 是否绑定 CPU
+    clock::duration m_busy_time;            // 处理任务的累计时间
+    unsigned long m_spawned;                // 扩容新建的线程数
+    unsigned long m_retired;                // 空闲退出的线程数
+    std::deque<task> m_workqueue[LANES];    // 请求队列，每个车道一个
+    size_t m_queued;                        // 各车道排队任务总数
+    int m_busy[LANES];                      // 各车道正在处理的任务数
+    int m_limit[LANES];                     // 各车道的并发上限
+    int m_credit[LANES];                    // 加权轮询的当前值
     std::mutex m_queuelocker;               // 保护请求队列的互斥锁
     std::condition_variable m_queuecond;    // 是否有任务需要处理
-    connection_pool* m_connPool;            // 数据库连接池
     int m_actor_model;                      // 模型切换
     bool m_stop;                            // 停止标志
+    clock::time_point m_first_above[LANES]; // 排队时间开始超标后的判定时刻，未超标时为默认值
 };
 
 template <typename T>
-threadpool<T>::threadpool(int actor_model, connection_pool* connPool, int thread_number, int max_requests)
-    : m_actor_model(actor_model),
-      m_thread_number(thread_number),
+threadpool<T>::threadpool(int actor_model, int thread_number, int max_requests, int max_threads)
+    : m_thread_number(thread_number),
+      m_max_threads(std::max(thread_number, max_threads)),
       m_max_requests(max_requests),
-      m_connPool(connPool),
+      m_live(0),
+      m_pinned(false),
+      m_busy_time(0),
+      m_spawned(0),
+      m_retired(0),
+      m_queued(0),
+      m_actor_model(actor_model),
       m_stop(false) {
     if (thread_number <= 0 || max_requests <= 0) {
         throw std::invalid_argument("Thread number and max requests must be positive");
     }
 
-    m_threads.reserve(thread_number);
+    for (int i = 0; i < LANES; ++i) {
+        m_busy[i] = 0;
+        m_credit[i] = 0;
+    }
+    m_threads.resize(m_max_threads);
+    m_running.assign(m_max_threads, 0);
+    std::lock_guard<std::mutex> lock(m_queuelocker);
     for (int i = 0; i < thread_number; ++i) {
-        m_threads.emplace_back(&threadpool::run, this);
+        spawn(i);
     }
 }
 
@@ -69,70 +135,237 @@ void threadpool<T>::stop() {
     m_queuecond.notify_all(); // 唤醒所有线程
 }
 
+template <typename T>
+void threadpool<T>::pin_threads() {
+    std::lock_guard<std::mutex> lock(m_queuelocker);
+    m_pinned = true;
+    for (int i = 0; i < m_max_threads; ++i) {
+        if (m_running[i]) {
+            cpu_affinity::get_instance()->pin_worker(m_threads[i].native_handle(), i);
+        }
+    }
+}
+
+template <typename T>
+void threadpool<T>::metrics(std::string &text) {
+    char line[512];
+    std::lock_guard<std::mutex> lock(m_queuelocker);
+    int busy = 0;
+    for (int i = 0; i < LANES; ++i) {
+        busy += m_busy[i];
+    }
+    // 利用率为当前忙碌线程的比例；busy_seconds 为累计值，两次采样之差除以间隔和线程数即为区间利用率
+    int len = snprintf(line, sizeof(line),
+                       "threadpool_threads %d\nthreadpool_threads_min %d\nthreadpool_threads_max %d\n"
+                       "threadpool_threads_busy %d\nthreadpool_utilization %.3f\nthreadpool_busy_seconds %.3f\n"
+                       "threadpool_spawned %lu\nthreadpool_retired %lu\n",
+                       m_live, m_thread_number, m_max_threads, busy, m_live ? (double)busy / m_live : 0.0,
+                       std::chrono::duration<double>(m_busy_time).count(), m_spawned, m_retired);
+    text.append(line, len);
+    for (int i = 0; i < LANES; ++i) {
+        len = snprintf(line, sizeof(line), "threadpool_queue{lane=\"%d\"} %zu\n", i, m_workqueue[i].size());
+        text.append(line, len);
+    }
+}
+
 template <typename T>
 bool threadpool<T>::append(T* request, int state) {
     std::lock_guard<std::mutex> lock(m_queuelocker);
-    if (m_workqueue.size() >= static_cast<size_t>(m_max_requests)) {
+    if (m_queued >= static_cast<size_t>(m_max_requests)) {
         return false;
     }
     request->m_state = state;
-    m_workqueue.push_back(request);
-    m_queuecond.notify_one();
-    return true;
+    return push(request);
 }
 
 template <typename T>
 bool threadpool<T>::append_p(T* request) {
     std::lock_guard<std::mutex> lock(m_queuelocker);
-    if (m_workqueue.size() >= static_cast<size_t>(m_max_requests)) {
+    if (m_queued >= static_cast<size_t>(m_max_requests)) {
         return false;
     }
-    m_workqueue.push_back(request);
+    return push(request);
+}
+
+// 以下函数由调用方在持有队列锁时调用
+// 在第 slot 个位置新建线程，回收该位置上已退出的线程
+template <typename T>
+void threadpool<T>::spawn(int slot) {
+    if (m_threads[slot].joinable()) {
+        m_threads[slot].join();
+    }
+    m_threads[slot] = std::thread(&threadpool::run, this, slot);
+    m_running[slot] = 1;
+    ++m_live;
+    if (m_pinned) {
+        cpu_affinity::get_instance()->pin_worker(m_threads[slot].native_handle(), slot);
+    }
+    set_limits();
+}
+
+// 车道预留随线程数变化；线程数少于车道数时无法为每个车道预留，不设上限
+template <typename T>
+void threadpool<T>::set_limits() {
+    int reserve[LANES], reserved = 0;
+    for (int i = 0; i < LANES; ++i) {
+        reserve[i] = m_live >= LANES ? std::max(1, m_live * LANE_RESERVE_PERCENT[i] / 100) : 0;
+        reserved += reserve[i];
+    }
+    for (int i = 0; i < LANES; ++i) {
+        m_limit[i] = std::max(1, m_live - (reserved - reserve[i]));
+    }
+}
+
+// 最早的任务等待 SCALE_UP_DELAY_MS 仍未被取走，说明线程不够用（都在处理任务或所在车道已达上限）
+template <typename T>
+void threadpool<T>::grow(clock::time_point now, clock::time_point oldest) {
+    if (m_stop || m_live >= m_max_threads || now - oldest < std::chrono::milliseconds(SCALE_UP_DELAY_MS)) {
+        return;
+    }
+    spawn(std::find(m_running.begin(), m_running.end(), 0) - m_running.begin());
+    ++m_spawned;
+}
+
+// 工作线程都阻塞时没有线程取任务，由入队时检查最早的任务
+template <typename T>
+bool threadpool<T>::push(T* request) {
+    int lane = request->lane();
+    if (lane < 0 || lane >= LANES) {
+        lane = 0;
+    }
+    clock::time_point now = clock::now();
+    m_workqueue[lane].push_back(task{request, now});
+    ++m_queued;
     m_queuecond.notify_one();
+    grow(now, m_workqueue[lane].front().enqueued);
     return true;
 }
 
+// 平滑加权轮询：有任务且未达上限的车道累加权重，取当前值最大者，被选中的车道减去本轮权重之和
+template <typename T>
+int threadpool<T>::pick() {
+    int best = -1, total = 0;
+    for (int i = 0; i < LANES; ++i) {
+        if (m_workqueue[i].empty() || m_busy[i] >= m_limit[i]) {
+            continue;
+        }
+        m_credit[i] += LANE_WEIGHT[i];
+        total += LANE_WEIGHT[i];
+        if (best < 0 || m_credit[i] > m_credit[best]) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        m_credit[best] -= total;
+    }
+    return best;
+}
+
 template <typename T>
-void threadpool<T>::run() {
-    while (!m_stop) {
-        std::unique_lock<std::mutex> lock(m_queuelocker);
-        m_queuecond.wait(lock, [this] { return m_stop || !m_workqueue.empty(); });
+bool threadpool<T>::overloaded(int lane, clock::time_point now, clock::time_point enqueued) {
+    if (now - enqueued < std::chrono::milliseconds(CODEL_TARGET_MS)) {
+        m_first_above[lane] = clock::time_point();
+        return false;
+    }
+    if (m_first_above[lane] == clock::time_point()) {
+        m_first_above[lane] = now + std::chrono::milliseconds(CODEL_INTERVAL_MS);
+        return false;
+    }
+    return now >= m_first_above[lane];
+}
+
+template <typename T>
+void threadpool<T>::run(int slot) {
+    std::unique_lock<std::mutex> lock(m_queuelocker);
+    while (true) {
+        int lane = -1;
+        bool ready = m_queuecond.wait_for(lock, std::chrono::seconds(IDLE_RETIRE_SECONDS),
+                                          [this, &lane] { return m_stop || (lane = pick()) >= 0; });
         if (m_stop) {
             break;
         }
-        if (m_workqueue.empty()) {
+        if (!ready) {
+            // 空闲超时：多于最小线程数时退出，线程对象在该位置复用或线程池析构时回收
+            if (m_live > m_thread_number) {
+                m_running[slot] = 0;
+                --m_live;
+                ++m_retired;
+                set_limits();
+                return;
+            }
             continue;
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
+        task t = m_workqueue[lane].front();
+        m_workqueue[lane].pop_front();
+        --m_queued;
+        ++m_busy[lane];
+        clock::time_point start = clock::now();
+        // 写任务的响应已经生成，只参与排队时间的统计，不丢弃；还能扩容时不丢弃
+        bool shed = overloaded(lane, start, t.enqueued) && m_live >= m_max_threads &&
+                    (m_actor_model != 1 || t.request->m_state == 0);
+        // 取出的任务已等待过久且后面还有积压：再加一个线程，新线程取到的任务同样过久时继续扩容
+        if (m_queued > 0) {
+            grow(start, t.enqueued);
+        }
         lock.unlock(); // 尽早释放锁
 
-        if (!request) {
-            continue;
+        handle(t.request, shed);
+
+        clock::time_point end = clock::now();
+        lock.lock();
+        m_busy_time += end - start;
+        --m_busy[lane];
+        // 该车道此前可能因达到上限而有任务在等待
+        if (!m_workqueue[lane].empty()) {
+            m_queuecond.notify_one();
         }
+    }
+}
+
+template <typename T>
+void threadpool<T>::handle(T* request, bool shed) {
+    if (!request) {
+        return;
+    }
+    if (shed) {
         if (m_actor_model == 1) {
-            if (request->m_state == 0) {
-                if (request->read_once()) {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+            // 先读走请求再回复，避免带着未读数据关闭连接时客户端收到 RST 而看不到 503
+            if (request->read_once()) {
+                request->improv = 1;
+                request->shed();
+            } else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
+        } else {
+            request->shed();
+        }
+        return;
+    }
+    if (m_actor_model == 1) {
+        if (request->m_state == 0) {
+            if (request->read_once()) {
+                request->improv = 1;
+                request->process();
+            } else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
+        } else {
+            if (request->write()) {
+                request->improv = 1;
+                // 长连接的读缓冲区中已有下一个流水线请求，直接继续处理
+                if (request->has_buffered_request()) {
                     request->process();
-                } else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
                 }
             } else {
-                if (request->write()) {
-                    request->improv = 1;
-                } else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+                request->timer_flag = 1;
             }
-        } else {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            request->process();
         }
+    } else {
+        request->process();
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,6 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../http/ws_hub.h"
 
 sort_timer_lst::sort_timer_lst()
 {
@@ -43,6 +44,19 @@ void sort_timer_lst::adjust_timer(util_timer *timer)
     {
         return;
     }
+    // 过期时间提前（进入期限更短的阶段）：摘下后从表头重新插入
+    if (timer->prev && timer->expire < timer->prev->expire)
+    {
+        timer->prev->next = timer->next;
+        if (timer->next)
+            timer->next->prev = timer->prev;
+        else
+            tail = timer->prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+        add_timer(timer);
+        return;
+    }
     util_timer *tmp = timer->next;
     // 如果 timer 的后继为空或位置正确，不需要调整。
     if (!tmp || (timer->expire < tmp->expire))
@@ -111,12 +125,33 @@ void sort_timer_lst::tick()
         {
             break;
         }
-        tmp->cb_func(tmp->user_data);
         head = tmp->next;
         if (head)
         {
             head->prev = NULL;
         }
+        //截止时间在定时器上次调整之后可能已被工作线程推迟（如请求头收齐进入发送阶段），未到则按新的截止时间重新插入
+        time_t deadline = tmp->user_data->conn ? tmp->user_data->conn->deadline() : 0;
+        if (deadline > cur)
+        {
+            tmp->expire = deadline;
+            tmp->prev = NULL;
+            tmp->next = NULL;
+            add_timer(tmp);
+            tmp = head;
+            continue;
+        }
+        //WebSocket 连接空闲到期时先发 ping，定时器推迟 PONG_TIMEOUT 后重新插入；ping 仍无回应才关闭
+        if (ws_hub::get_instance()->keepalive(tmp->user_data->sockfd))
+        {
+            tmp->expire = cur + ws_hub::PONG_TIMEOUT;
+            tmp->prev = NULL;
+            tmp->next = NULL;
+            add_timer(tmp);
+            tmp = head;
+            continue;
+        }
+        tmp->cb_func(tmp->user_data);
         delete tmp;     // 删除超时的定时器
         tmp = head;
     }
@@ -220,10 +255,11 @@ int Utils::u_epollfd = 0;
 class Utils;
 void cb_func(client_data *user_data)
 {
-    // 删除客户端的 epoll 事件
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    // 关闭套接字并减少连接数。
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
+    //定时器随后即被删除（到期时由 tick，提前关闭时由 deal_timer），清空指针，
+    //排空时按描述符遍历 users_timer 不会碰到已关闭连接留下的已删除定时器
+    user_data->timer = NULL;
+    //与工作线程关闭连接走同一处：close_conn 以 m_sockfd != -1 为准，连接计数和 IP 名额只释放一次，
+    //之后工作线程再对同一对象调用 close_conn 不会重复释放
+    user_data->conn->close_conn();
 }
@@ -25,6 +25,7 @@
 #include "../log/log.h"
 
 class util_timer;
+class http_conn;
 
 // 连接资源
 struct client_data
@@ -32,6 +33,7 @@ struct client_data
     sockaddr_in address;    // 客户端socket地址信息
     int sockfd;             // 客户端socket文件描述符
     util_timer *timer;      // 指向关联的定时器
+    http_conn *conn;        // 对应的连接对象，定时器到期时据此取当前阶段的截止时间
 };
 
 class util_timer
@@ -56,7 +58,7 @@ public:
     ~sort_timer_lst();
 
     void add_timer(util_timer *timer);      // 添加定时器
-    void adjust_timer(util_timer *timer);   // 调整定时器位置
+    void adjust_timer(util_timer *timer);   // 调整定时器位置（过期时间可以推迟也可以提前）
     void del_timer(util_timer *timer);      // 删除定时器
     void tick();                            // 定时任务处理函数
 
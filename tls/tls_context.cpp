@@ -0,0 +1,97 @@
+#include "tls_context.h"
+
+#include <string.h>
+#include <openssl/err.h>
+
+//ALPN：优先 h2，其次 http/1.1；客户端都不支持时不回应 ALPN 扩展，按 HTTP/1.1 处理
+static int select_alpn(SSL *, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    if (SSL_select_next_proto((unsigned char **)out, outlen, protos, sizeof(protos) - 1, in, inlen) !=
+        OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static std::string last_error(const char *what)
+{
+    char buf[256];
+    ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+    return std::string(what) + ": " + buf;
+}
+
+tls_context::~tls_context()
+{
+    if (m_ctx)
+        SSL_CTX_free(m_ctx);
+}
+
+bool tls_context::init(const char *cert_file, const char *key_file, std::string &err)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        err = last_error("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    //对端不发 close_notify 直接断开按正常关闭处理；不支持重协商
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF |
+                             SSL_OP_CIPHER_SERVER_PREFERENCE);
+    //socket 非阻塞：允许部分写出，重试时缓冲区地址可以变化；空闲连接释放读写缓冲
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1)
+    {
+        err = last_error(cert_file);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        err = last_error(key_file);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+
+    //会话复用
+    static const unsigned char sid_ctx[] = "tinywebserver";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT);
+    SSL_CTX_set_num_tickets(ctx, NUM_TICKETS);
+
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+
+    m_ctx = ctx;
+    return true;
+}
+
+SSL *tls_context::create(int fd)
+{
+    SSL *ssl = SSL_new(m_ctx);
+    if (!ssl)
+        return NULL;
+    //kTLS 要求使用 socket BIO
+    if (SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool tls_context::on_handshake(SSL *ssl)
+{
+    m_handshakes++;
+    if (SSL_session_reused(ssl))
+        m_resumed++;
+    bool ktls = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    if (ktls)
+        m_ktls_send++;
+    return ktls;
+}
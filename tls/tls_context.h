@@ -0,0 +1,48 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <string>
+#include <atomic>
+#include <openssl/ssl.h>
+
+// 监听端口上的 TLS 终结：进程内共享一个 SSL_CTX，每个连接一个 SSL 对象。
+// 开启 SSL_OP_ENABLE_KTLS，握手完成后若内核 TLS（kTLS）发送侧生效，记录加密交给内核，
+// 响应仍直接 writev 到 socket，不经过 OpenSSL 的用户态缓冲；未生效时退回 SSL_write。
+// 会话复用：TLS 1.2 会话 ID 使用服务端内置会话缓存，TLS 1.3 使用会话票据。
+class tls_context
+{
+public:
+    static const long SESSION_CACHE_SIZE = 20480;   // 服务端会话缓存的最大条目数
+    static const long SESSION_TIMEOUT = 3600;       // 会话（含票据）有效期（秒）
+    static const int NUM_TICKETS = 1;               // TLS 1.3 握手后下发的票据数（OpenSSL 默认为 2）
+
+    static tls_context *get_instance()
+    {
+        static tls_context instance;
+        return &instance;
+    }
+
+    // 加载证书链和私钥，失败时返回 false 并在 err 中给出原因
+    bool init(const char *cert_file, const char *key_file, std::string &err);
+    bool enabled() const { return m_ctx != NULL; }
+
+    // 为新连接创建服务端 SSL 对象，失败返回 NULL
+    SSL *create(int fd);
+    // 握手完成时调用：记录统计，返回 kTLS 发送侧是否生效
+    bool on_handshake(SSL *ssl);
+
+    unsigned long handshakes() const { return m_handshakes; }
+    unsigned long resumed() const { return m_resumed; }
+    unsigned long ktls_send() const { return m_ktls_send; }
+
+private:
+    tls_context() : m_ctx(NULL), m_handshakes(0), m_resumed(0), m_ktls_send(0) {}
+    ~tls_context();
+
+    SSL_CTX *m_ctx;
+    std::atomic<unsigned long> m_handshakes;    // 完成的握手数
+    std::atomic<unsigned long> m_resumed;       // 其中复用会话（免完整握手）的次数
+    std::atomic<unsigned long> m_ktls_send;     // 其中 kTLS 发送侧生效的次数
+};
+
+#endif
@@ -1,9 +1,32 @@
 #include "webserver.h"
+#include "config.h"
+#include "./auth/verify_cache.h"
+#include "./session/session_store.h"
+#include "./http/http_scan.h"
+#include "./http/ws_hub.h"
+#include "./tls/tls_context.h"
+#include "./proxy/upstream.h"
+#include "./proxy/response_cache.h"
+#include "./limit/ip_limiter.h"
+#include "./affinity/cpu_affinity.h"
+
+#include <stdexcept>
+#include <vector>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/close_range.h>
 
 WebServer::WebServer()
 {
-    //http_conn类对象
-    users = new http_conn[MAX_FD];
+    //http_conn类对象和定时器数组的大小可在配置文件中修改，在 settings() 中分配
+    users = NULL;
+    users_timer = NULL;
+    m_max_fd = MAX_FD;
+    m_timeslot = TIMESLOT;
+    m_log_split_lines = LOG_SPLIT_LINES;
+    m_log_queue_size = LOG_QUEUE_SIZE;
+    m_db_host = DB_HOST;
+    m_db_port = DB_PORT;
 
     //root文件夹路径
     char server_path[200];
@@ -13,23 +36,39 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    //定时器
-    users_timer = new client_data[MAX_FD];
+    m_connPool = NULL;
+    m_pool = NULL;
+    m_verify_pool = NULL;
+    m_argv = NULL;
+    m_upgrade_pid = -1;
+    m_upgrade_fd = -1;
+    m_ready_fd = -1;
+    m_drain_deadline = 0;
 }
 
+//事件循环结束后按依赖关系逆序退出：先回收仍在处理请求、访问 users 的工作线程和校验线程，
+//再释放连接对象和描述符，然后写完异步日志、回收写线程，最后关闭数据库连接
 WebServer::~WebServer()
 {
+    delete m_pool;
+    delete m_verify_pool;
+    http_conn::m_threadpool = NULL;
+    http_conn::m_verify_pool = NULL;
+    delete[] users;
+    delete[] users_timer;
     close(m_epollfd);
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
-    delete m_pool;
+    LOG_INFO("%s", "server stopped");
+    Log::get_instance()->stop();
+    if (m_connPool)
+        m_connPool->DestroyPool();
 }
 
 void WebServer::init(int port, std::string user, std::string passWord, std::string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int max_thread_num, int close_log,
+                     int actor_model, int tls, int affinity)
 {
     m_port = port;
     m_user = user;
@@ -37,11 +76,67 @@ void WebServer::init(int port, std::string user, std::string passWord, std::stri
     m_databaseName = databaseName;
     m_sql_num = sql_num;
     m_thread_num = thread_num;
+    m_max_thread_num = max_thread_num;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_tls = tls;
+    m_affinity = affinity;
+}
+
+//命令行选项以外、来自配置文件的参数
+void WebServer::settings(const Config &config)
+{
+    m_max_fd = config.getMaxFd();
+    m_timeslot = config.getTimeslot();
+    m_log_split_lines = config.getLogSplitLines();
+    m_log_queue_size = config.getLogQueueSize();
+    m_db_host = config.getDbHost();
+    m_db_port = config.getDbPort();
+    m_config_file = config.getConfigFile();
+    m_tunables = config.getTunables();
+    http_conn::m_read_buffer_size = config.getReadBufferSize();
+
+    users = new http_conn[m_max_fd];
+    //值初始化：从未使用过的描述符 timer 为空，排空时按描述符遍历据此跳过
+    users_timer = new client_data[m_max_fd]();
+    http_conn::set_timeouts(m_tunables.header_timeout, m_tunables.body_timeout, m_tunables.write_timeout,
+                            m_tunables.keepalive_timeout, m_tunables.min_rate);
+}
+
+//运行中使新的 m_tunables 生效；启动时这些参数由各模块的初始化设置
+void WebServer::apply_tunables()
+{
+    http_conn::set_timeouts(m_tunables.header_timeout, m_tunables.body_timeout, m_tunables.write_timeout,
+                            m_tunables.keepalive_timeout, m_tunables.min_rate);
+    Log::get_instance()->set_level(m_tunables.log_level);
+    if (!ip_limiter::get_instance()->set_limits(m_tunables.ip_max_conn, m_tunables.ip_rate, m_tunables.ip_burst))
+        LOG_WARN("%s", "per-IP limits were disabled at startup, restart to enable them");
+    static_cache::get_instance()->set_budget(m_tunables.static_cache_budget);
+    if (upstream_table::get_instance()->size() > 0)
+        response_cache::get_instance()->set_budget(m_tunables.proxy_cache_budget);
+}
+
+//SIGHUP：重新读取配置文件，只有 server_tunables 中的参数在运行中生效，其余参数需重启（或平滑升级）。
+//文件有误时整体不生效，保持原有参数
+void WebServer::reload()
+{
+    Config config;
+    std::string err;
+    if (!config.load_file(m_config_file.c_str(), err))
+    {
+        LOG_ERROR("reload failed, keep current settings: %s", err.c_str());
+        return;
+    }
+    m_tunables = config.getTunables();
+    apply_tunables();
+    LOG_INFO("reloaded %s: timeouts %d/%d/%d/%d s, min rate %d B/s, ip limits %d conns %d/s burst %d, "
+             "cache budgets %zu/%zu bytes, log level %d", m_config_file.c_str(),
+             m_tunables.header_timeout, m_tunables.body_timeout, m_tunables.write_timeout, m_tunables.keepalive_timeout,
+             m_tunables.min_rate, m_tunables.ip_max_conn, m_tunables.ip_rate, m_tunables.ip_burst,
+             m_tunables.static_cache_budget, m_tunables.proxy_cache_budget, m_tunables.log_level);
 }
 
 void WebServer::trig_mode()
@@ -78,9 +173,10 @@ void WebServer::log_write()
     {
         //初始化日志
         if (1 == m_log_write)
-            Log::get_instance()->init("./serverLogs/ServerLog", 800000, 800);
+            Log::get_instance()->init("./serverLogs/ServerLog", m_log_split_lines, m_log_queue_size);
         else
-            Log::get_instance()->init("./serverLogs/ServerLog", 800000, 0);
+            Log::get_instance()->init("./serverLogs/ServerLog", m_log_split_lines, 0);
+        Log::get_instance()->set_level(m_tunables.log_level);
     }
 }
 
@@ -88,16 +184,120 @@ void WebServer::sql_pool()
 {
     //初始化数据库连接池
     m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    m_connPool->init(m_db_host, m_user, m_passWord, m_databaseName, m_db_port, m_sql_num, m_close_log);
 
     //初始化数据库读取表
     users->initmysql_result(m_connPool);
 }
 
+void WebServer::static_files()
+{
+    //扩展名类型表，需在缓存生成响应头之前加载
+    int mime_count = mime_table::get_instance()->load(MIME_TYPES_FILE);
+    if (mime_count >= 0)
+        LOG_INFO("loaded %d mime types from %s", mime_count, MIME_TYPES_FILE);
+
+    //静态文件缓存，文本资源装入时压缩一次，之后按 Accept-Encoding 直接选用
+    static_cache::get_instance()->init(m_tunables.static_cache_budget, STATIC_CACHE_MAX_FILE, STATIC_COMPRESS == 1);
+
+    //开始监听之前装入常用资源（含一次性压缩），首批请求不再承担 stat、缺页和压缩的开销；
+    //平滑升级时新进程预热完才通知旧进程交接
+    if (STATIC_PREWARM_BUDGET > 0)
+    {
+        static_cache::prewarm_stats stats = static_cache::get_instance()->prewarm(m_root, STATIC_PREWARM_FILE,
+                                                                                   STATIC_PREWARM_BUDGET, STATIC_PREWARM_LOCK == 1);
+        LOG_INFO("static prewarm: %d files, %zu bytes in %.3f s", stats.files, stats.bytes, stats.seconds);
+        if (stats.lock_failed)
+            LOG_WARN("static prewarm: mlock failed for %d mappings, check RLIMIT_MEMLOCK", stats.lock_failed);
+    }
+}
+
+void WebServer::affinity()
+{
+    if (1 != m_affinity)
+        return;
+
+    //绑定失败时线程照常运行，只是不固定位置
+    cpu_affinity *aff = cpu_affinity::get_instance();
+    if (!aff->init() || !aff->pin_loop())
+    {
+        LOG_WARN("cpu affinity unavailable, threads are not pinned");
+        return;
+    }
+    //连接对象和定时器数组只由主线程和处理该连接的工作线程访问，放在主线程所在节点
+    if (!aff->bind_local(users, sizeof(http_conn) * m_max_fd) ||
+        !aff->bind_local(users_timer, sizeof(client_data) * m_max_fd))
+        LOG_WARN("mbind to node %d failed: %s", aff->loop_node(), strerror(errno));
+    LOG_INFO("event loop pinned to cpu %d, node %d", aff->loop_cpu(), aff->loop_node());
+}
+
+void WebServer::tls()
+{
+    if (1 != m_tls)
+        return;
+
+    //证书或私钥无效时不以明文方式继续监听
+    std::string err;
+    if (!tls_context::get_instance()->init(TLS_CERT_FILE, TLS_KEY_FILE, err))
+        throw std::runtime_error("TLS 初始化失败: " + err);
+    LOG_INFO("tls enabled, cert %s", TLS_CERT_FILE);
+}
+
+void WebServer::upstream()
+{
+    //配置文件不存在时不启用反向代理；配置有误时不带着残缺的路由继续运行
+    std::string err;
+    if (!upstream_table::get_instance()->load(UPSTREAM_CONF_FILE, err))
+        throw std::runtime_error("反向代理配置错误: " + err);
+    if (upstream_table::get_instance()->size() > 0)
+    {
+        response_cache::get_instance()->init(m_tunables.proxy_cache_budget);
+        LOG_INFO("reverse proxy enabled, %zu upstream pools, cache budget %zu bytes",
+                 upstream_table::get_instance()->size(), m_tunables.proxy_cache_budget);
+    }
+}
+
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num, MAX_REQUESTS, m_max_thread_num);
+    if (1 == m_affinity)
+        m_pool->pin_threads();
+    http_conn::m_threadpool = m_pool;
+
+    //口令校验线程池，与处理静态请求的线程池隔离
+    m_verify_pool = new verify_pool(VERIFY_THREAD_NUM, VERIFY_MAX_PENDING);
+    http_conn::m_verify_pool = m_verify_pool;
+    verify_cache::get_instance()->init(VERIFY_CACHE_TTL, m_max_fd);
+    session_store::get_instance()->init(SESSION_TTL);
+    ws_hub::get_instance()->init(m_max_fd);
+    upstream_table::get_instance()->init(m_max_fd);
+    ip_limiter::get_instance()->init(m_max_fd, m_tunables.ip_max_conn, m_tunables.ip_rate, m_tunables.ip_burst);
+}
+
+//记下启动参数和可执行文件的绝对路径：部署时该路径上的文件被替换，/proc/self/exe 仍指向旧文件
+void WebServer::command_line(char *argv[])
+{
+    m_argv = argv;
+    char path[4096];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len > 0)
+        m_exe_path.assign(path, len);
+}
+
+//由旧进程启动时继承监听描述符，不重新 bind：升级期间新旧进程共用同一个监听队列，不丢弃任何连接
+static int inherited_listenfd()
+{
+    const char *env = getenv(LISTEN_FD_ENV);
+    if (!env)
+        return -1;
+    int fd = atoi(env);
+    unsetenv(LISTEN_FD_ENV);
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening)
+        return -1;
+    return fd;
 }
 
 // Web 服务器的事件监听初始化函数。
@@ -105,37 +305,53 @@ void WebServer::thread_pool()
 // 建立了服务器与客户端的监听、通信和信号响应的基础架构。
 void WebServer::eventListen()
 {
-    //网络编程基础步骤
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
-
-    //优雅关闭连接
-    if (0 == m_OPT_LINGER)  // 默认
+    m_listenfd = inherited_listenfd();
+    const char *ready = getenv(READY_FD_ENV);
+    if (ready)
     {
-        struct linger tmp = {0, 1};     // 结构体linger有两项：l_onoff（是否启用优雅关闭，为 0 时，禁用优雅关闭）；l_linger（延迟关闭的时间（秒））
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        m_ready_fd = atoi(ready);
+        unsetenv(READY_FD_ENV);
     }
-    else if (1 == m_OPT_LINGER)
+    int ret = 0;
+    if (m_listenfd >= 0)
     {
-        struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        LOG_INFO("inherited listen socket %d from the previous process", m_listenfd);
     }
+    else
+    {
+        //网络编程基础步骤
+        m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+        assert(m_listenfd >= 0);
 
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(m_port);
+        //优雅关闭连接
+        if (0 == m_OPT_LINGER)  // 默认
+        {
+            struct linger tmp = {0, 1};     // 结构体linger有两项：l_onoff（是否启用优雅关闭，为 0 时，禁用优雅关闭）；l_linger（延迟关闭的时间（秒））
+            setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        }
+        else if (1 == m_OPT_LINGER)
+        {
+            struct linger tmp = {1, 1};
+            setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        }
 
-    int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
-    assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
-    assert(ret >= 0);
+        struct sockaddr_in address;
+        bzero(&address, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(m_port);
+
+        int flag = 1;
+        setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+        ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+        assert(ret >= 0);
+        ret = listen(m_listenfd, 5);
+        assert(ret >= 0);
+    }
 
-    utils.init(TIMESLOT);
+    utils.init(m_timeslot);
+    LOG_INFO("http line scanner: %s", scan_impl_name());
+    LOG_INFO("websocket unmask: %s", ws_unmask_impl_name());
 
     //epoll创建内核事件表
     epoll_event events[MAX_EVENT_NUMBER];
@@ -146,6 +362,10 @@ void WebServer::eventListen()
     utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
     http_conn::m_epollfd = m_epollfd;
 
+    //协程的等待由本事件循环驱动
+    ret = coro_loop::get_instance()->init(m_epollfd, m_max_fd);
+    assert(ret);
+
     // 创建一个双向通信的管道，用于信号处理
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
     assert(ret != -1);
@@ -155,8 +375,10 @@ void WebServer::eventListen()
     utils.addsig(SIGPIPE, SIG_IGN);                     // 忽略 SIGPIPE 信号，防止在写入关闭连接的套接字时程序崩溃。
     utils.addsig(SIGALRM, utils.sig_handler, false);    // 设置 SIGALRM 信号（定时信号，用于触发超时处理）的处理函数为 utils.sig_handler，并设置为非阻塞。
     utils.addsig(SIGTERM, utils.sig_handler, false);    // 设置 SIGTERM 信号（终止信号，用于安全关闭服务器）的处理函数为 utils.sig_handler，并设置为非阻塞。
+    utils.addsig(SIGUSR2, utils.sig_handler, false);    // SIGUSR2：平滑升级，启动新的可执行文件并交出监听套接字
+    utils.addsig(SIGHUP, utils.sig_handler, false);     // SIGHUP：重新加载配置文件中可在运行中修改的参数
 
-    alarm(TIMESLOT);
+    alarm(m_timeslot);
 
     //工具类,信号和描述符基础操作
     Utils::u_pipefd = m_pipefd;
@@ -177,21 +399,21 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = users + connfd;
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;     // 定时器的过期时间（触发时间），表示当前时间加上 3 个时间片（TIMESLOT）
+    timer->expire = users[connfd].deadline();   // 定时器的过期时间（触发时间）：从 accept 起计的请求头期限
     users_timer[connfd].timer = timer;
     utils.m_timer_lst.add_timer(timer);
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
-//并对新的定时器在链表上的位置进行调整
+//有读写事件时按连接当前阶段的截止时间重设定时器（请求头阶段收到数据不会顺延），
+//并对新的定时器在链表上的位置进行调整；WebSocket 连接仍在有数据时往后延迟3个单位
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    time_t deadline = timer->user_data->conn ? timer->user_data->conn->deadline() : 0;
+    timer->expire = deadline ? deadline : time(NULL) + 3 * m_timeslot;
     utils.m_timer_lst.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
@@ -199,11 +421,11 @@ void WebServer::adjust_timer(util_timer *timer)
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
 {
+    //连接已关闭、定时器已删除时为空
+    if (!timer)
+        return;
     timer->cb_func(&users_timer[sockfd]);
-    if (timer)
-    {
-        utils.m_timer_lst.del_timer(timer);
-    }
+    utils.m_timer_lst.del_timer(timer);
 
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
@@ -222,12 +444,21 @@ bool WebServer::dealclientdata()
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD)
+        if (http_conn::m_user_count >= m_max_fd || connfd >= m_max_fd)
         {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
+        //同一客户端地址的并发连接超出上限，不分配连接对象
+        if (!ip_limiter::get_instance()->acquire(client_address.sin_addr.s_addr))
+        {
+            utils.show_error(connfd, "Too many connections");
+            LOG_WARN("too many connections from %s", inet_ntoa(client_address.sin_addr));
+            return false;
+        }
+        //统计接收队列落在哪个节点上，用于核对网卡队列与中断的 CPU 分布
+        cpu_affinity::get_instance()->incoming(connfd);
         // 调用 timer(connfd, client_address) 为该连接创建定时器
         timer(connfd, client_address);
     }
@@ -242,12 +473,19 @@ bool WebServer::dealclientdata()
                 LOG_ERROR("%s:errno is:%d", "accept error", errno);
                 break;
             }
-            if (http_conn::m_user_count >= MAX_FD)
+            if (http_conn::m_user_count >= m_max_fd || connfd >= m_max_fd)
             {
                 utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
                 break;
             }
+            if (!ip_limiter::get_instance()->acquire(client_address.sin_addr.s_addr))
+            {
+                utils.show_error(connfd, "Too many connections");
+                LOG_WARN("too many connections from %s", inet_ntoa(client_address.sin_addr));
+                continue;
+            }
+            cpu_affinity::get_instance()->incoming(connfd);
             timer(connfd, client_address);
         }
         return false;
@@ -258,7 +496,7 @@ bool WebServer::dealclientdata()
 // 处理通过管道接收到的信号数据，更新服务器运行状态或触发相应动作。
 // 主要处理两种信号：
 // 1. SIGALRM：定时器信号，设置 timeout = true，用于触发定时任务。
-// 2. SIGTERM：终止信号，设置 stop_server = true，用于停止服务器。
+// 2. SIGTERM：终止信号，停止接受连接并排空后退出；排空期间再次收到时立即退出。
 bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
 {
     int ret = 0;
@@ -286,7 +524,20 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 }
                 case SIGTERM:
                 {
-                    stop_server = true;
+                    if (m_drain_deadline)
+                        stop_server = true;
+                    else
+                        drain();
+                    break;
+                }
+                case SIGUSR2:
+                {
+                    upgrade();
+                    break;
+                }
+                case SIGHUP:
+                {
+                    reload();
                     break;
                 }
             }
@@ -295,10 +546,131 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
     return true;
 }
 
+//平滑升级：以原来的参数启动新的可执行文件，继承监听套接字。新进程开始事件循环后本进程才停止接受连接，
+//新进程启动失败时本进程照常服务
+void WebServer::upgrade()
+{
+    if (m_upgrade_fd >= 0 || m_drain_deadline)
+    {
+        LOG_WARN("%s", "upgrade already in progress, ignore SIGUSR2");
+        return;
+    }
+    if (!m_argv || m_exe_path.empty())
+    {
+        LOG_ERROR("%s", "upgrade: executable path unknown");
+        return;
+    }
+    int ready[2];
+    if (pipe(ready) != 0)
+    {
+        LOG_ERROR("upgrade: pipe failed, errno is:%d", errno);
+        return;
+    }
+
+    //环境变量在 fork 之前准备好：多线程进程 fork 出的子进程在 exec 之前只能调用异步信号安全的函数
+    std::vector<std::string> env;
+    for (char **e = environ; *e; ++e)
+    {
+        if (strncmp(*e, LISTEN_FD_ENV, strlen(LISTEN_FD_ENV)) != 0 && strncmp(*e, READY_FD_ENV, strlen(READY_FD_ENV)) != 0)
+            env.push_back(*e);
+    }
+    env.push_back(std::string(LISTEN_FD_ENV) + "=" + std::to_string(m_listenfd));
+    env.push_back(std::string(READY_FD_ENV) + "=" + std::to_string(ready[1]));
+    std::vector<char *> envp;
+    for (std::string &e : env)
+        envp.push_back(&e[0]);
+    envp.push_back(NULL);
+    long max_fd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        //只留下标准输入输出、监听套接字和就绪通知
+        if (syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) != 0)
+        {
+            for (long fd = 3; fd < max_fd; ++fd)
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        fcntl(m_listenfd, F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        execve(m_exe_path.c_str(), m_argv, envp.data());
+        _exit(127);
+    }
+    close(ready[1]);
+    if (pid < 0)
+    {
+        close(ready[0]);
+        LOG_ERROR("upgrade: fork failed, errno is:%d", errno);
+        return;
+    }
+    m_upgrade_pid = pid;
+    m_upgrade_fd = ready[0];
+    utils.addfd(m_epollfd, m_upgrade_fd, false, 0);
+    LOG_INFO("upgrade: started %s as pid %d", m_exe_path.c_str(), (int)pid);
+}
+
+//就绪通知的读端可读：读到数据表示新进程已在接受连接；读到 EOF 表示新进程在就绪之前退出
+void WebServer::upgrade_ready()
+{
+    char c;
+    ssize_t n = read(m_upgrade_fd, &c, 1);
+    if (n < 0 && errno == EINTR)
+        return;
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_upgrade_fd, 0);
+    close(m_upgrade_fd);
+    m_upgrade_fd = -1;
+    if (n == 1)
+    {
+        LOG_INFO("upgrade: pid %d is ready, stop accepting", (int)m_upgrade_pid);
+        drain();
+        return;
+    }
+    int status = 0;
+    waitpid(m_upgrade_pid, &status, WNOHANG);
+    LOG_ERROR("upgrade: pid %d exited before it was ready (status %d), keep serving", (int)m_upgrade_pid, status);
+    m_upgrade_pid = -1;
+}
+
+//停止接受连接并排空（平滑升级和 SIGTERM）：空闲的 HTTP/1.1 长连接立即关闭，正在处理的请求照常完成，
+//响应以 Connection: close 结束。监听套接字在本轮事件处理完后关闭；平滑升级时新进程持有同一个套接字，
+//已进入监听队列的连接由新进程接受
+void WebServer::drain()
+{
+    if (m_drain_deadline)
+        return;
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    http_conn::m_draining = true;
+    m_drain_deadline = time(NULL) + DRAIN_TIMEOUT;
+    int closed = 0;
+    for (int fd = 0; fd < m_max_fd; ++fd)
+    {
+        util_timer *timer = users_timer[fd].timer;
+        if (timer && users[fd].idle_keep_alive())
+        {
+            deal_timer(timer, fd);
+            ++closed;
+        }
+    }
+    LOG_INFO("draining: closed %d idle connections, %d left", closed, http_conn::m_user_count);
+}
+
 void WebServer::dealwithread(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
 
+    //WebSocket 连接：帧很小且要访问广播订阅表，收发都直接在主线程完成，不经过线程池
+    if (users[sockfd].is_websocket())
+    {
+        if (users[sockfd].ws_read())
+        {
+            if (timer)
+                adjust_timer(timer);
+        }
+        else
+            deal_timer(timer, sockfd);
+        return;
+    }
+
     //reactor
     if (1 == m_actormodel)
     {
@@ -307,8 +679,15 @@ void WebServer::dealwithread(int sockfd)
             adjust_timer(timer);
         }
 
-        //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
+        //若监测到读事件，将该事件放入请求队列；队列已满时在主线程读走请求并回复 503
+        if (!m_pool->append(users + sockfd, 0))
+        {
+            if (users[sockfd].read_once())
+                users[sockfd].shed();
+            else
+                deal_timer(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
@@ -331,8 +710,9 @@ void WebServer::dealwithread(int sockfd)
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-            //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            //若监测到读事件，将该事件放入请求队列；队列已满时直接回复 503
+            if (!m_pool->append_p(users + sockfd))
+                users[sockfd].shed();
 
             if (timer)
             {
@@ -349,6 +729,14 @@ void WebServer::dealwithread(int sockfd)
 void WebServer::dealwithwrite(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+
+    //WebSocket 连接：写出发送队列，只有收到数据才顺延定时器
+    if (users[sockfd].is_websocket())
+    {
+        if (!users[sockfd].ws_write())
+            deal_timer(timer, sockfd);
+        return;
+    }
     //reactor
     if (1 == m_actormodel)
     {
@@ -357,7 +745,11 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
+        if (!m_pool->append(users + sockfd, 1))
+        {
+            deal_timer(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
@@ -380,6 +772,10 @@ void WebServer::dealwithwrite(int sockfd)
         {
             LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
+            //长连接的读缓冲区中已有下一个流水线请求，直接放入请求队列
+            if (users[sockfd].has_buffered_request() && !m_pool->append_p(users + sockfd))
+                users[sockfd].shed();
+
             if (timer)
             {
                 adjust_timer(timer);
@@ -403,10 +799,24 @@ void WebServer::eventLoop()
 {
     bool timeout = false;       // 用来指示定时器任务是否需要执行，当定时器超时时会被设置为 true。
     bool stop_server = false;   // 用于标记服务器是否需要停止运行
+    coro_loop *coro = coro_loop::get_instance();
+
+    //由旧进程启动时通知它：新进程已开始接受连接，旧进程可以停止接受并排空
+    if (m_ready_fd >= 0)
+    {
+        ssize_t ret = write(m_ready_fd, "1", 1);
+        (void)ret;
+        close(m_ready_fd);
+        m_ready_fd = -1;
+    }
 
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        //有协程在等待上游时，最多等到其中最早的截止时刻；排空期间每秒检查一次连接是否都已结束
+        int wait = coro->timeout();
+        if (m_drain_deadline && (wait < 0 || wait > 1000))
+            wait = 1000;
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, wait);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -416,14 +826,31 @@ void WebServer::eventLoop()
         for (int i = 0; i < number; i++)
         {
             int sockfd = events[i].data.fd;
+            int owner;
 
-            //处理新到的客户连接
+            //协程等待的描述符就绪，或其它线程交来了协程
+            if (coro->dispatch(sockfd))
+                continue;
+
+            //处理新到的客户连接（开始排空后监听套接字已移出 epoll，本轮中已取出的事件也不再处理）
             if (sockfd == m_listenfd)
             {
+                if (m_drain_deadline)
+                    continue;
                 bool flag = dealclientdata();
                 if (false == flag)
                     continue;
             }
+            //新进程就绪或启动失败
+            else if (sockfd == m_upgrade_fd)
+            {
+                upgrade_ready();
+            }
+            //反向代理的上游连接有数据：交给所属客户端连接继续转发响应体
+            else if ((owner = upstream_table::get_instance()->owner(sockfd)) != upstream_table::NO_OWNER)
+            {
+                dealwithwrite(owner);
+            }
             // 如果检测到对端关闭连接、连接挂起、连接发生错误 事件，
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
@@ -449,9 +876,26 @@ void WebServer::eventLoop()
                 dealwithwrite(sockfd);
             }
         }
+        coro->expire();
+        //本轮中可能还有监听套接字的事件，处理完才关闭，避免描述符被复用后误判
+        if (m_drain_deadline && m_listenfd >= 0)
+        {
+            close(m_listenfd);
+            m_listenfd = -1;
+        }
+        //已停止接受连接：连接全部结束或到了排空期限时退出
+        if (m_drain_deadline && (http_conn::m_user_count <= 0 || time(NULL) >= m_drain_deadline))
+        {
+            LOG_INFO("drained, %d connections left, exit", http_conn::m_user_count);
+            stop_server = true;
+        }
         if (timeout)
         {
             utils.timer_handler();
+            //每个时间片清理一个会话分片中的过期会话
+            session_store::get_instance()->sweep();
+            //删除已没有连接、令牌桶已回满的客户端地址
+            ip_limiter::get_instance()->sweep();
 
             LOG_INFO("%s", "timer tick");
 
@@ -11,13 +11,61 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/types.h>
+#include <string>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
 
-const int MAX_FD = 65536;           //最大文件描述符
+//标注“可配置”的常量为默认值，可在配置文件中修改，见 config.h
+const int MAX_FD = 65536;           //最大文件描述符（可配置）
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
-const int TIMESLOT = 5;             //最小超时单位
+const int TIMESLOT = 5;             //最小超时单位（可配置）
+const int LOG_SPLIT_LINES = 800000; //单个日志文件的最大行数（可配置）
+const int LOG_QUEUE_SIZE = 800;     //异步日志队列长度（可配置）
+const char DB_HOST[] = "localhost"; //数据库地址（可配置）
+const int DB_PORT = 3306;           //数据库端口（可配置）
+const char CONFIG_FILE[] = "./webserver.conf";  //缺省的配置文件，不存在时全部使用默认值
+const int MAX_REQUESTS = 10000;     //线程池请求队列的最大长度
+const int VERIFY_THREAD_NUM = 2;    //口令校验线程数
+const int VERIFY_MAX_PENDING = 64;  //口令校验最大排队数，超出时回复503
+const int VERIFY_CACHE_TTL = 300;   //已校验会话缓存有效期（秒）
+const int SESSION_TTL = 1800;       //登录会话有效期（秒），有访问时顺延
+const size_t STATIC_CACHE_BUDGET = 64 << 20;    //静态文件缓存字节预算（可配置，SIGHUP 生效）
+const size_t STATIC_CACHE_MAX_FILE = 4 << 20;   //单个文件超过该大小不进入缓存
+const int STATIC_COMPRESS = 1;      //是否对文本资源做一次性 gzip/brotli 压缩
+const size_t STATIC_PREWARM_BUDGET = 32 << 20;  //启动时预先装入静态文件缓存的字节数，0 表示不预热
+const int STATIC_PREWARM_LOCK = 0;  //是否 mlock 预热的文件映射（受 RLIMIT_MEMLOCK 限制）
+const char STATIC_PREWARM_FILE[] = "./prewarm.conf";   //可选的预热列表，每行一个相对 root 的文件或目录，缺省时预热整个 root
+const char MIME_TYPES_FILE[] = "./mime.types";  //可选的 mime.types 文件，覆盖内置的扩展名类型表
+const char TLS_CERT_FILE[] = "./server.crt";    //启用TLS时使用的证书链（PEM）
+const char TLS_KEY_FILE[] = "./server.key";     //启用TLS时使用的私钥（PEM）
+const char UPSTREAM_CONF_FILE[] = "./upstream.conf";    //可选的反向代理配置，每行一个路径前缀及其上游
+const size_t PROXY_CACHE_BUDGET = 32 << 20;     //反向代理响应缓存字节预算，0 表示不缓存（可配置，SIGHUP 生效）
+const int IP_MAX_CONN = 1024;       //单个客户端 IP 的最大并发连接数，0 表示不限制（可配置，SIGHUP 生效）
+const int IP_RATE = 1000;           //单个客户端 IP 每秒的请求数（令牌桶补充速率），0 表示不限制（可配置，SIGHUP 生效）
+const int IP_BURST = 2000;          //单个客户端 IP 的令牌桶容量，允许的突发请求数（可配置，SIGHUP 生效）
+const int DRAIN_TIMEOUT = 30;       //停止服务或平滑升级时等待已有连接结束的最长时间（秒），须大于 http_conn::WRITE_TIMEOUT
+const char LISTEN_FD_ENV[] = "WEBSERVER_LISTEN_FD";    //平滑升级：新进程从该环境变量取得继承的监听描述符
+const char READY_FD_ENV[] = "WEBSERVER_READY_FD";      //平滑升级：新进程开始事件循环后向该描述符写一个字节
+
+//运行中收到 SIGHUP 时从配置文件重新加载的参数，其余参数只在启动时读取
+struct server_tunables
+{
+    int header_timeout;         // 见 http_conn::HEADER_TIMEOUT 等
+    int body_timeout;
+    int write_timeout;
+    int keepalive_timeout;
+    int min_rate;
+    int ip_max_conn;
+    int ip_rate;
+    int ip_burst;
+    size_t static_cache_budget;
+    size_t proxy_cache_budget;
+    int log_level;              // 低于该级别的日志不输出：0 debug，1 info，2 warn，3 error
+};
+
+class Config;
 
 class WebServer
 {
@@ -27,12 +75,18 @@ public:
 
     void init(int port , std::string user, std::string passWord, std::string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int max_thread_num, int close_log, int actor_model, int tls, int affinity);
+    void settings(const Config &config);
 
     void thread_pool();
+    void affinity();
     void sql_pool();
+    void static_files();
+    void tls();
+    void upstream();
     void log_write();
     void trig_mode();
+    void command_line(char *argv[]);
     void eventListen();
     void eventLoop();
     void timer(int connfd, struct sockaddr_in client_address);
@@ -42,6 +96,11 @@ public:
     bool dealwithsignal(bool& timeout, bool& stop_server);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void upgrade();
+    void upgrade_ready();
+    void drain();
+    void reload();
+    void apply_tunables();
 
 public:
     //基础
@@ -50,6 +109,8 @@ public:
     int m_log_write;        // 日志写入方式，=0 默认同步
     int m_close_log;        // 是否关闭日志，=0 默认不关闭
     int m_actormodel;
+    int m_tls;              // 监听端口是否启用TLS
+    int m_affinity;         // 是否绑定CPU并按NUMA节点放置连接对象
 
     int m_pipefd[2];
     int m_epollfd;          // 用于epoll事件通知的文件描述符
@@ -61,10 +122,14 @@ public:
     std::string m_passWord;     //登陆数据库密码
     std::string m_databaseName; //使用数据库名
     int m_sql_num;
+    std::string m_db_host;      // 数据库地址
+    int m_db_port;
 
     //线程池相关
     threadpool<http_conn> *m_pool;
     int m_thread_num;
+    int m_max_thread_num;           // 弹性扩容的最大线程数，不大于 m_thread_num 时线程数固定
+    verify_pool *m_verify_pool;     // 口令校验专用线程池
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
@@ -78,5 +143,21 @@ public:
     //定时器相关
     client_data *users_timer;
     Utils utils;
+
+    //配置相关
+    int m_max_fd;               // 连接对象和定时器数组的大小，也是同时连接数的上限
+    int m_timeslot;             // 定时器的时间片（秒）
+    int m_log_split_lines;      // 单个日志文件的最大行数
+    int m_log_queue_size;       // 异步日志队列长度
+    std::string m_config_file;  // SIGHUP 时重新读取的配置文件
+    server_tunables m_tunables; // 当前生效的可重新加载参数
+
+    //平滑升级和排空相关
+    char **m_argv;              // 启动参数，新进程原样使用
+    std::string m_exe_path;     // 启动时解析出的可执行文件路径，升级时执行该路径上的新文件
+    pid_t m_upgrade_pid;        // 正在启动的新进程
+    int m_upgrade_fd;           // 新进程就绪通知的读端，-1 表示没有进行中的升级
+    int m_ready_fd;             // 本进程由旧进程启动时的就绪通知写端
+    time_t m_drain_deadline;    // 停止接受新连接后最迟退出的时刻，0 表示未在排空
 };
 #endif